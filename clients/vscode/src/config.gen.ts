@@ -22,6 +22,14 @@ export interface Config {
   excludeDirs?: string[]
   /** Thread count to use for indexing */
   indexingThreads?: number
+  /** Cache the workspace index in .slang/cache so unchanged files aren't re-indexed on startup */
+  indexCache?: boolean
+  /** Index files with the full parser instead of the faster token scanner */
+  indexWithParser?: boolean
+  /** Maximum number of workspace symbol search results; 0 for no limit */
+  workspaceSymbolLimit?: number
+  /** Milliseconds to wait after the last edit to a document before updating its diagnostics; 0 to update on every change */
+  diagnosticsDelay?: number
   /** Build file to use */
   build?: string | null
   /** Build file glob pattern, e.g. `builds/{}.f`. Used for selecting build files. If omitted and no other build source is configured, defaults to matching all `.f` files in the workspace. */
@@ -72,6 +72,19 @@ struct Config {
     rfl::Deprecated<"Use 'index' instead.", "Directories to exclude", std::vector<std::string>>
         excludeDirs;
     rfl::Description<"Thread count to use for indexing", int> indexingThreads = 0;
+    rfl::Description<"Cache the workspace index in .slang/cache so unchanged files aren't "
+                     "re-indexed on startup",
+                     bool>
+        indexCache = true;
+    rfl::Description<"Index files with the full parser instead of the faster token scanner",
+                     bool>
+        indexWithParser = false;
+    rfl::Description<"Maximum number of workspace symbol search results; 0 for no limit", int>
+        workspaceSymbolLimit = 1000;
+    rfl::Description<"Milliseconds to wait after the last edit to a document before updating its "
+                     "diagnostics; 0 to update on every change",
+                     int>
+        diagnosticsDelay = 150;
     rfl::Description<"Build file to use", std::optional<std::string>> build;
     rfl::Description<"Build file glob pattern, e.g. `builds/{}.f`. Used for selecting build "
                      "files. If omitted and no other build source is configured, defaults to "
@@ -10,15 +10,25 @@
 #include "Config.h"
 #include "lsp/LspTypes.h"
 #include "lsp/URI.h"
+#include "util/ChunkedVector.h"
+#include "util/StringPool.h"
+#include <atomic>
 #include <concepts>
-#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <memory>
 #include <mutex>
-#include <shared_mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "slang/parsing/Token.h"
 #include "slang/syntax/SyntaxTree.h"
 #include "slang/util/SmallVector.h"
 
@@ -37,6 +47,16 @@ struct Indexer {
     // Configure threading
     void setNumThreads(uint32_t numThreads) { numThreads_ = numThreads; }
 
+    // How symbols are extracted from files: a scan over the preprocessed tokens, or a full
+    // parse. The parser is slower but handles anything the scanner's heuristics don't.
+    enum class ExtractMode { Scan, Parse };
+    void setExtractMode(ExtractMode mode) { extractMode_ = mode; }
+
+    // Configure the on-disk index cache; nullopt disables it
+    void setCacheFile(std::optional<std::filesystem::path> cacheFile) {
+        cacheFile_ = std::move(cacheFile);
+    }
+
     //////////////////////////////////////////
     // Updating interface
     //////////////////////////////////////////
@@ -49,6 +69,32 @@ struct Indexer {
     void startIndexing(const std::vector<std::string>& globs,
                        const std::vector<std::string>& excludeDirs);
 
+    // Called from the indexing thread as batches are published, with done == total at the end
+    using ProgressCallback = std::function<void(size_t done, size_t total)>;
+
+    // Like startIndexing, but crawls and indexes on a background thread. Results are published in
+    // batches as they finish, so queries see a partial index in the meantime. Cancels any
+    // indexing already running.
+    void startBackgroundIndexing(std::vector<Config::IndexConfig> indexConfigs,
+                                 std::optional<std::string> workspaceFolder,
+                                 ProgressCallback onProgress);
+    void startBackgroundIndexing(std::vector<std::string> globs,
+                                 std::vector<std::string> excludeDirs,
+                                 ProgressCallback onProgress);
+
+    // Stop background indexing, or wait for it to finish
+    void cancelIndexing();
+    void waitForIndexing();
+    bool isIndexing() const { return indexing_; }
+
+    // Index the files that likely define these symbols ahead of the rest of a background index.
+    // Files are matched by name (module foo in foo.sv), and what they reference follows them.
+    void prioritize(std::span<const std::string> names);
+
+    // Bumped when indexing finishes, and when prioritized files are published. Lets callers know
+    // when to re-resolve lookups that failed against a partial index.
+    uint64_t getGeneration() const { return generation_; }
+
     // For workspace changes
     void addDocuments(const std::vector<std::filesystem::path>& paths);
     void onWorkspaceDidChangeWatchedFiles(const lsp::DidChangeWatchedFilesParams& params);
@@ -56,6 +102,9 @@ struct Indexer {
     // For open document lifecycle
     void updateDocument(const std::filesystem::path& uri, const slang::syntax::SyntaxTree& tree);
 
+    // Write the current index to the cache file, if one is configured
+    void saveCache() const;
+
     //////////////////////////////////////////
     // Querying interface
     //////////////////////////////////////////
@@ -63,6 +112,24 @@ struct Indexer {
     std::vector<std::filesystem::path> getFilesForMacro(std::string_view name) const;
     std::vector<std::filesystem::path> getFilesReferencingSymbol(std::string_view name) const;
 
+    // Dependency graph queries. A file depends on the files defining the symbols it references;
+    // the edges are the index's reference and definition postings, so they're kept up to date as
+    // files are indexed. Each walks every edge at most once, and returns files in breadth-first
+    // order without the files defining the symbol itself.
+
+    // Files the definitions of a symbol depend on, transitively
+    std::vector<std::filesystem::path> getDependencies(std::string_view name) const;
+
+    // Files that depend on a symbol, transitively
+    std::vector<std::filesystem::path> getDependents(std::string_view name) const;
+
+    // Files needed to analyze a document: the first definition of each name it references that
+    // it doesn't declare itself, plus the dependencies of packages and interfaces found this way,
+    // since their contents can be needed to resolve names in the document.
+    std::vector<std::filesystem::path> getAnalysisDependencies(
+        std::span<const std::string_view> referenced,
+        std::span<const std::string_view> declared) const;
+
     struct GlobalSymbolLoc {
         const std::filesystem::path* uri;
         slang::syntax::SyntaxKind kind;
@@ -76,13 +143,39 @@ struct Indexer {
     // Get count of unique symbol names (for testing)
     size_t getSymbolCount() const;
 
+    // Render each indexed file's symbols, macros and references in a stable order (for testing)
+    std::string dumpIndex() const;
+
+    // How files reported as changed were handled (for testing)
+    struct UpdateStats {
+        // The content hash matched, so the file wasn't parsed
+        size_t unchangedContent = 0;
+        // Parsed, but the names were the same, so the postings were kept
+        size_t unchangedNames = 0;
+        size_t reindexed = 0;
+    };
+    UpdateStats getUpdateStats();
+
     // Iterate over all symbols (for workspace symbols)
-    template<std::invocable<const std::string&, const Indexer::GlobalSymbolLoc&> Callback>
+    template<std::invocable<std::string_view, const Indexer::GlobalSymbolLoc&> Callback>
     void forEachSymbol(Callback&& callback) const;
 
+    struct SymbolMatch {
+        std::string_view name;
+        GlobalSymbolLoc loc;
+    };
+    using SymbolBatchCallback = std::function<void(std::span<const SymbolMatch>)>;
+
+    // Find symbols whose names contain the query's characters in order, ignoring case. Results
+    // are ranked (exact names, prefixes, names containing the query, then the rest; shorter names
+    // first) and capped at limit. Names stay valid for the lifetime of the indexer.
+    // If given, onBatch is called with each part of the result as soon as it's ranked: the names
+    // containing the query, which come from the trigram index, before the slower scan for the rest.
+    std::vector<SymbolMatch> findSymbols(std::string_view query, size_t limit,
+                                         const SymbolBatchCallback& onBatch = {}) const;
+
 private:
     friend struct IndexWriteGuard;
-    friend struct IndexReadGuard;
 
     // Data structures
     struct GlobalSymbol {
@@ -90,102 +183,223 @@ private:
         slang::syntax::SyntaxKind kind;
     };
 
+    // A file's symbols as extracted, or as read from the cache
     struct IndexedPath {
-        const std::filesystem::path* path = nullptr;
         slang::SmallVector<GlobalSymbol> symbols;
         slang::SmallVector<std::string> macros;
         slang::SmallVector<std::string> referencedSymbols;
+
+        // File stats, used to validate cached entries on startup
+        uint64_t fileSize = 0;
+        int64_t mtime = 0;
+        uint64_t contentHash = 0;
+
+        // Set by indexPaths when the content hash matched the known hash, so nothing was parsed
+        bool unchanged = false;
     };
 
-    // Index storage
-    // Using SmallVector<2> to avoid extra indirection for the common case
-    std::unordered_map<std::string, slang::SmallVector<GlobalSymbolLoc, 2>> symbolToFiles_;
-    std::unordered_map<std::string, slang::SmallVector<const std::filesystem::path*, 2>>
-        macroToFiles_;
-    // Top level references; References tend to have more entries
-    std::unordered_map<std::string, std::vector<const std::filesystem::path*>> symbolReferences_;
+    // Dense ids for interned names and files. Ids are never reused, so they mean the same thing
+    // in every version of the index.
+    using NameId = uint32_t;
+    using FileId = uint32_t;
 
-    // Storage for unique URIs (all pointers in the index point here)
-    std::unordered_set<std::filesystem::path> uniqueUris_;
+    struct SymbolPosting {
+        FileId file;
+        slang::syntax::SyntaxKind kind;
+    };
 
-    void indexPath(const std::filesystem::path& path, IndexedPath& indexedFile);
-    void indexAndReport(std::vector<std::filesystem::path> pathsToIndex);
+    // A file's entry in the index, with its names interned
+    struct IndexedFile {
+        struct Symbol {
+            NameId name;
+            slang::syntax::SyntaxKind kind;
+        };
+        std::vector<Symbol> symbols;
+        std::vector<NameId> macros;
+        std::vector<NameId> referencedSymbols;
+
+        uint64_t fileSize = 0;
+        int64_t mtime = 0;
+        uint64_t contentHash = 0;
+    };
 
-    // Remove all index entries for a path without needing the file contents
-    void removePathFromIndex(const std::filesystem::path* pathPtr);
+    // Index storage. A published IndexData is never modified; writers copy it, apply their
+    // changes and publish the copy, so readers can keep using the version they started with.
+    // Every table is chunked, so the copy shares all but the chunks a write edits, and updating
+    // one file doesn't cost time proportional to the size of the index.
+    struct IndexData {
+        // Interned names, pointing into namePool_, and their ids
+        server::ChunkedVector<std::string_view> names;
+        server::ChunkedMap<std::string_view, NameId> nameIds;
+
+        // Postings, indexed by NameId. Each only grows as far as the largest id it has entries
+        // for. Using SmallVector<2> to avoid extra indirection for the common case
+        server::ChunkedVector<slang::SmallVector<SymbolPosting, 2>> symbolToFiles;
+        server::ChunkedVector<slang::SmallVector<FileId, 2>> macroToFiles;
+        // Top level references; References tend to have more entries
+        server::ChunkedVector<std::vector<FileId>> symbolReferences;
+
+        // Search index over names that have been defined, for findSymbols. Names are added when
+        // first defined and never removed, so matches are checked against symbolToFiles.
+        // Lowercased trigrams packed into 24 bits, to the names containing them
+        server::ChunkedMap<uint32_t, std::vector<NameId>> symbolTrigrams;
+        // The characters each name contains, as a bitmask; 0 if it has never been defined
+        server::ChunkedVector<uint64_t> symbolCharMasks;
+
+        // Indexed by FileId. Paths point into fileIds_. Entries are null for files that aren't
+        // indexed, and are shared between versions, so copying a chunk of them doesn't copy
+        // those files' symbol lists.
+        server::ChunkedVector<const std::filesystem::path*> files;
+        server::ChunkedVector<std::shared_ptr<const IndexedFile>> indexedFiles;
+
+        // The postings for a name, or nullptr if there are none. Doesn't allocate.
+        template<typename T>
+        const T* find(const server::ChunkedVector<T>& postings, std::string_view name) const {
+            auto id = nameIds.find(name);
+            if (!id || *id >= postings.size())
+                return nullptr;
+            return &postings[*id];
+        }
+    };
+
+    // Interned names and file ids. Both only grow, and only writers touch them, so views and
+    // pointers held by older snapshots stay valid.
+    server::StringPool namePool_;
+    std::unordered_map<std::filesystem::path, FileId> fileIds_;
+
+    // The current version of the index, for readers
+    std::shared_ptr<const IndexData> snapshot() const;
+
+    void indexPath(IndexData& data, const std::filesystem::path& path,
+                   const IndexedPath& indexedFile);
+    void indexAndReport(std::vector<std::filesystem::path> pathsToIndex,
+                        const ProgressCallback& onProgress, std::stop_token stop);
+
+    // Find the files to index
+    static std::vector<std::filesystem::path> collectPaths(
+        const std::vector<Config::IndexConfig>& indexConfigs,
+        std::optional<std::string_view> workspaceFolder, uint32_t numThreads);
+    static std::vector<std::filesystem::path> collectPaths(
+        const std::vector<std::string>& globs, const std::vector<std::string>& excludeDirs);
+
+    // Index files in batches, publishing each one. Reuses entries from the cache file for files
+    // that haven't changed, and indexes prioritized files first.
+    void indexInBatches(std::vector<std::filesystem::path> paths,
+                        const ProgressCallback& onProgress, std::stop_token stop);
+
+    // Take the not yet indexed paths (after start) that match prioritized names, leaving them
+    // empty in paths
+    std::vector<std::filesystem::path> takePriorityPaths(
+        std::vector<std::filesystem::path>& paths, size_t start);
+
+    // Index files into a version of the index that's being written
+    void addDocuments(IndexData& data, const std::vector<std::filesystem::path>& paths);
+
+    // Reindex files that are already indexed, leaving the postings of files whose contents hash
+    // the same, or whose extracted names didn't change, alone. Returns how many were skipped.
+    size_t updateDocuments(IndexData& data, const std::vector<FileId>& files);
+    UpdateStats updateStats_; // Guarded by writeMutex_
+
+    // Whether an index entry has exactly the names that were extracted for it
+    static bool hasSameNames(const IndexData& data, const IndexedFile& file,
+                             const IndexedPath& indexedPath);
+
+    // Read the cache file, keyed by path. Returns an empty map if it's missing or stale.
+    std::unordered_map<std::string, IndexedPath> loadCache() const;
+
+    // Remove all index entries for a file without needing the file contents
+    static void removePathFromIndex(IndexData& data, FileId file);
 
-    // Intern a URI to get a stable pointer
-    const std::filesystem::path* internUri(const std::filesystem::path& uri);
+    // Intern a path or name to get its id, adding it to this version of the index if needed
+    FileId internFile(IndexData& data, const std::filesystem::path& path);
+    NameId internName(IndexData& data, std::string_view name);
 
-    // Storage for all indexed files (for efficient removal)
-    std::unordered_map<const std::filesystem::path*, IndexedPath> indexedFiles;
+    // Add a newly defined name to the symbol search index
+    static void addSymbolName(IndexData& data, NameId name);
+
+    // Convert an index entry back to names (for the cache and testing)
+    static IndexedPath toIndexedPath(const IndexData& data, const IndexedFile& file);
 
     // Extracts symbols and referenced symbols
     static void extractFromRoot(const slang::syntax::CompilationUnitSyntax& root,
                                 const slang::parsing::ParserMetadata& meta, IndexedPath& dest);
 
+    // Extracts symbols and referenced symbols from a preprocessed token stream without building a
+    // syntax tree. Mirrors extractFromRoot for the constructs design files actually use.
+    struct ScanResult {
+        bool hasDesignUnits = false;
+        bool hasClasses = false;
+    };
+    static ScanResult extractFromTokens(std::span<const slang::parsing::Token> tokens,
+                                        IndexedPath& dest);
+
     // Extracts macros
     template<typename MacroRange>
     static void extractMacros(const MacroRange& macros, IndexedPath& dest);
 
+    // Crawl a directory tree in parallel for SystemVerilog files, skipping excluded directories
     static void collectFilesFromDirectory(const std::filesystem::path& dir,
                                           const std::vector<std::string>& excludeDirs,
-                                          std::vector<std::filesystem::path>& outFiles);
+                                          std::vector<std::filesystem::path>& outFiles,
+                                          uint32_t numThreads);
 
-    // Core indexing function that splits work across threads
-    std::vector<IndexedPath> indexPaths(const std::vector<std::filesystem::path>& paths) const;
+    // Core indexing function that splits work across threads. If knownHashes is given, files
+    // whose content hash matches are marked unchanged instead of being parsed.
+    std::vector<IndexedPath> indexPaths(const std::vector<std::filesystem::path>& paths,
+                                        std::span<const uint64_t> knownHashes = {}) const;
 
-    // Threading - uses reader-writer lock pattern
+    // Index cache location, if enabled
+    std::optional<std::filesystem::path> cacheFile_;
+
+    ExtractMode extractMode_ = ExtractMode::Scan;
+
+    // Threading - writers are serialized and publish a new snapshot when done. The snapshot
+    // mutex only guards swapping and copying the pointer, so readers never wait on indexing.
     uint32_t numThreads_ = 0;
-    mutable std::shared_mutex indexMutex_;
-    mutable std::condition_variable_any indexingCondition_;
-    bool indexingInProgress_ = false;
+    std::mutex writeMutex_;
+    mutable std::mutex snapshotMutex_;
+    std::shared_ptr<const IndexData> snapshot_ = std::make_shared<const IndexData>();
     static const int MinFilesForThreading = 8;
+
+    // Background indexing
+    static constexpr size_t MinBatchSize = 256;
+    std::mutex priorityMutex_;
+    std::unordered_set<std::string> priorityNames_;
+    std::atomic<bool> indexing_ = false;
+    std::atomic<uint64_t> generation_ = 0;
+    // Declared last so it's joined before anything it uses is destroyed
+    std::jthread indexingThread_;
 };
 
-// Write guard - acquires exclusive lock, blocks readers and other writers
+// Write guard - serializes writers and hands out a private copy of the index, which is
+// published to readers when the guard goes out of scope. The copy shares its chunks with the
+// current snapshot until they're edited.
 struct IndexWriteGuard {
     Indexer& indexer;
-    std::unique_lock<std::shared_mutex> lock;
+    std::unique_lock<std::mutex> lock;
+    std::shared_ptr<Indexer::IndexData> data;
 
-    IndexWriteGuard(Indexer& idx) : indexer(idx), lock(idx.indexMutex_) {
-        // Wait for any in-progress indexing to complete
-        idx.indexingCondition_.wait(lock, [&] { return !idx.indexingInProgress_; });
-        idx.indexingInProgress_ = true;
-    }
+    IndexWriteGuard(Indexer& idx) :
+        indexer(idx), lock(idx.writeMutex_),
+        data(std::make_shared<Indexer::IndexData>(*idx.snapshot())) {}
 
     IndexWriteGuard(const IndexWriteGuard&) = delete;
     IndexWriteGuard(IndexWriteGuard&&) = delete;
 
     ~IndexWriteGuard() {
-        indexer.indexingInProgress_ = false;
-        lock.unlock();
-        indexer.indexingCondition_.notify_all();
-    }
-};
-
-// Read guard - acquires shared lock, allows concurrent readers
-struct IndexReadGuard {
-    std::shared_lock<std::shared_mutex> lock;
-
-    IndexReadGuard(const Indexer& idx) : lock(idx.indexMutex_) {
-        // Wait for any in-progress indexing to complete before reading
-        // Note: We need to temporarily release shared lock to wait on condition
-        // Actually, condition_variable_any works with shared_lock
-        idx.indexingCondition_.wait(lock, [&] { return !idx.indexingInProgress_; });
+        std::lock_guard swap(indexer.snapshotMutex_);
+        indexer.snapshot_ = std::move(data);
     }
-
-    IndexReadGuard(const IndexReadGuard&) = delete;
-    IndexReadGuard(IndexReadGuard&&) = default;
 };
 
-// Implementation of forEachSymbol template (needs IndexReadGuard definition)
-template<std::invocable<const std::string&, const Indexer::GlobalSymbolLoc&> Callback>
+// Implementation of forEachSymbol template
+template<std::invocable<std::string_view, const Indexer::GlobalSymbolLoc&> Callback>
 void Indexer::forEachSymbol(Callback&& callback) const {
-    IndexReadGuard guard(*this);
-    for (const auto& [name, entries] : symbolToFiles_) {
-        for (const auto& entry : entries) {
-            callback(name, entry);
+    auto index = snapshot();
+    for (NameId id = 0; id < index->symbolToFiles.size(); id++) {
+        for (const auto& entry : index->symbolToFiles[id]) {
+            callback(index->names[id], GlobalSymbolLoc{.uri = index->files[entry.file],
+                                                       .kind = entry.kind});
         }
     }
 }
@@ -15,8 +15,12 @@
 #include "completions/CompletionDispatch.h"
 #include "document/DefinitionInfo.h"
 #include "lsp/URI.h"
+#include <chrono>
 #include <filesystem>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <unordered_map>
 #include <vector>
 
@@ -43,7 +47,9 @@ public:
                                                 const Config& config,
                                                 std::vector<std::string> buildfiles = {},
                                                 const ServerDriver* oldDriver = nullptr);
-    /// Mapping of URI to SlangDoc, which may hold a shallow analysis of the document
+    /// Mapping of URI to SlangDoc, which may hold a shallow analysis of the document.
+    /// Read-only requests run concurrently and only reach it through findDocument and getDocument,
+    /// which lock it; everything else uses it while no read-only requests are running.
     std::unordered_map<URI, std::shared_ptr<SlangDoc>> docs;
 
     // Owned by the Slang Driver
@@ -79,8 +85,17 @@ public:
     /// @brief Reload a document from disk, used when external tools modify open files
     void reloadDocument(const URI& uri);
 
+    /// @brief Apply edits to a document. Publishing its diagnostics is deferred until the
+    /// `diagnosticsDelay` after the last change; queries in the meantime see the edits.
     void onDocDidChange(const lsp::DidChangeTextDocumentParams& params);
 
+    /// @brief Run the updates deferred by changes whose delay has passed
+    /// @return The time until the next deferred update is due, if any are left
+    std::optional<std::chrono::milliseconds> flushDueUpdates();
+
+    /// @brief Run all deferred updates now
+    void flushUpdates();
+
     /// @brief Checks if a document is open
     bool isDocumentOpen(const URI& uri);
 
@@ -90,10 +105,20 @@ public:
 
     void updateDoc(SlangDoc& doc, FileUpdateType type);
 
+    /// @brief Gets a document by URI, loading it from disk if it isn't known yet. Its analysis
+    /// reflects the latest changes, but publishing diagnostics is left to the deferred update.
+    /// Safe to call from concurrent read-only requests.
     std::shared_ptr<SlangDoc> getDocument(const URI& uri);
 
+    /// @brief Like getDocument, but doesn't look up dependencies again after edits, for callers
+    /// that are about to update the document themselves
+    std::shared_ptr<SlangDoc> findDocument(const URI& uri);
+
     std::vector<std::shared_ptr<SlangDoc>> getDependentDocs(std::shared_ptr<SyntaxTree> tree);
 
+    /// @brief Changes as the workspace index fills in, so dependencies can be looked up again
+    uint64_t getIndexGeneration() const { return m_indexer.getGeneration(); }
+
     std::vector<std::string> getModulesInFile(const std::string& path);
 
     /// @brief Gets definition information for a symbol at an LSP position, used for
@@ -123,14 +148,19 @@ public:
     std::optional<std::vector<lsp::DocumentHighlight>> getDocDocumentHighlight(
         const URI& uri, const lsp::Position& position);
 
+    using LocationsCallback = std::function<void(std::vector<lsp::Location>)>;
+
     /// @brief Gets all references to a symbol in a document
     /// @param uri The URI of the document
     /// @param position The LSP position to query
     /// @param includeDeclaration Whether to include the declaration in results
-    /// @return Optional vector of locations, or nullopt if no symbol found
-    std::optional<std::vector<lsp::Location>> getDocReferences(const URI& uri,
-                                                               const lsp::Position& position,
-                                                               bool includeDeclaration);
+    /// @param onPartial If given, receives the references in the declaring file, then those in
+    /// each referencing file as soon as it's been searched, instead of them being returned
+    /// @return Optional vector of locations, or nullopt if no symbol found. Empty when streaming
+    /// to onPartial.
+    std::optional<std::vector<lsp::Location>> getDocReferences(
+        const URI& uri, const lsp::Position& position, bool includeDeclaration,
+        const LocationsCallback& onPartial = {});
 
     /// @brief Renames a symbol in a document
     /// @param uri The URI of the document
@@ -179,10 +209,26 @@ private:
     /// Set of URIs for documents that are explicitly opened by the client
     flat_hash_set<URI> m_openDocs;
 
-    /// Helper to add member references to the references vector
-    void addMemberReferences(std::vector<lsp::Location>& references,
-                             const ast::Symbol& parentSymbol, const ast::Symbol& targetSymbol,
-                             bool isTypeMember = false);
+    /// Documents with changes that haven't been analyzed yet, and when to do so. Later changes
+    /// push the deadline back, superseding the update scheduled for earlier ones.
+    flat_hash_map<URI, std::chrono::steady_clock::time_point> m_pendingUpdates;
+
+    /// Documents edited since their dependencies were last looked up
+    flat_hash_set<URI> m_staleDependencies;
+
+    /// Guards `docs` and `m_staleDependencies` against concurrent read-only requests
+    std::mutex m_docsMutex;
+
+    /// Run the deferred update for a document, if it has one
+    void flushUpdate(const URI& uri);
+
+    /// Helper to add member references to the references vector. Takes the names and location
+    /// rather than the symbols, so their analysis doesn't have to stay locked while the
+    /// referencing files' analyses are searched.
+    void addMemberReferences(std::vector<lsp::Location>& references, std::string_view parentName,
+                             bool parentIsPackage, SourceLocation targetLocation,
+                             std::string_view targetName, bool isTypeMember = false,
+                             const std::function<void()>& onFileDone = {});
 
     void publishInactiveRegions(SlangDoc& doc);
 };
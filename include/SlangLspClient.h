@@ -9,6 +9,7 @@
 
 #include "Config.h"
 #include "lsp/LspClient.h"
+#include <functional>
 
 class SlangLspClient : public lsp::LspClient {
     /// Helper functions to send things to the client
@@ -27,4 +28,14 @@ public:
                          rfl::to_generic<rfl::UnderlyingEnums>(params));
         return std::monostate{};
     }
+
+    /// Ask the client to create a progress token. Progress can only be reported with it once
+    /// the client has, which is when onCreated is called.
+    virtual void createWorkDoneProgress(const lsp::ProgressToken& token,
+                                        std::function<void()> onCreated) {
+        lsp::sendRequest("window/workDoneProgress/create",
+                         rfl::to_generic<rfl::UnderlyingEnums>(
+                             lsp::WorkDoneProgressCreateParams{token}),
+                         std::move(onCreated));
+    }
 };
@@ -17,7 +17,9 @@
 #include "document/SlangDoc.h"
 #include "lsp/LspServer.h"
 #include "lsp/LspTypes.h"
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <rfl.hpp>
 #include <rfl/Generic.hpp>
 #include <rfl/Variant.hpp>
@@ -59,6 +61,48 @@ protected:
     /// The layered config from server.json files
     Config m_config;
 
+    /// Copied from the config for workspace/symbol, which runs concurrently with config reloads
+    std::atomic<size_t> m_workspaceSymbolLimit = 0;
+
+    /// Work done progress for background indexing. Updated from the indexing thread.
+    struct IndexingProgress {
+        std::mutex mutex;
+        /// The client supports window/workDoneProgress
+        bool supported = false;
+        /// No requests may be sent to the client before it's initialized
+        bool initialized = false;
+        size_t done = 0;
+        size_t total = 0;
+        /// The token of the progress shown in the client, if any
+        std::optional<lsp::ProgressToken> token;
+        /// The client has created the token. Nothing may be sent with it before then.
+        bool created = false;
+        std::optional<lsp::uint> percentage;
+        int nextToken = 0;
+    } m_indexingProgress;
+
+    /// Whether a task to run deferred document updates is waiting on the message loop
+    bool m_updatesScheduled = false;
+
+    /// Run the document updates that are due, and schedule a task for the rest. Without a
+    /// message loop to schedule on, all of them run now.
+    void scheduleDocUpdates();
+
+    /// Report part of a result to the client, for requests with a `partialResultToken`. The
+    /// response to the request is then empty.
+    template<typename T>
+    void sendPartialResult(const lsp::ProgressToken& token, const std::vector<T>& batch) {
+        m_client.onProgress(lsp::ProgressParams{
+            .token = token,
+            .value = rfl::to_generic<rfl::UnderlyingEnums>(batch),
+        });
+    }
+
+    /// Report indexing progress to the client
+    void onIndexingProgress(size_t done, size_t total);
+    void beginIndexingProgress();
+    void onIndexingProgressCreated(const lsp::ProgressToken& token);
+
     /// Indexes the workspace for top symbols and macros
     Indexer m_indexer;
 
@@ -97,6 +141,10 @@ public:
 
     std::monostate setTopLevel(const std::string&);
 
+    /// Latency percentiles, queue wait and allocations per method, and the peak RSS, for the
+    /// `slang/metrics` request
+    lsp::MetricsReport getMetrics(std::monostate);
+
     // Returns the instances indexed by module. If just a single instance, is will have it, else
     // it will require another query
     std::vector<hier::InstanceSet> getScopesByModule(const std::monostate&);
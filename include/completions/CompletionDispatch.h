@@ -14,6 +14,7 @@
 #include "lsp/LspTypes.h"
 #include <filesystem>
 #include <memory>
+#include <mutex>
 #include <optional>
 
 #include "slang/text/SourceLocation.h"
@@ -37,6 +38,11 @@ private:
     // name of last scope
     std::string m_lastScope;
 
+    /// Guards the last scope, since completions and resolves can run concurrently
+    std::mutex m_lastMutex;
+
+    void setLastScope(std::shared_ptr<SlangDoc> doc, std::string scope);
+
 public:
     CompletionDispatch(ServerDriver& driver, const Indexer& indexer, SourceManager& sourceManager,
                        slang::Bag& options);
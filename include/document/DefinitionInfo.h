@@ -65,6 +65,7 @@ struct DefinitionInfo {
     struct SymbolTarget {
         SyntaxTarget syntax;
         const slang::ast::Symbol* symbol;
+        // The analysis the symbol belongs to
         std::shared_ptr<ShallowAnalysis> analysis;
 
         const slang::parsing::Token& nameToken() const { return syntax.nameToken; }
@@ -0,0 +1,93 @@
+//------------------------------------------------------------------------------
+// DocumentText.h
+// Edit buffer for the text of an open document
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace server {
+
+/// The text of a document as edits arrive, without rebuilding it per edit. It's a piece table
+/// over the text it started from and the text inserted since, plus the offset of each line,
+/// which an edit updates by scanning only the lines it touches. The full text is only written
+/// out when it's needed, e.g. to reparse, so a burst of edits costs one copy of the document.
+///
+/// Lines break at \n, \r, \r\n and \n\r, like slang's SourceManager, so positions map to the same
+/// offsets as they do in a source buffer.
+class DocumentText {
+public:
+    /// Starts from text, which has to stay alive until the next rebase
+    explicit DocumentText(std::string_view text);
+
+    size_t size() const { return m_size; }
+    size_t lineCount() const { return m_lineStarts.size(); }
+    const std::vector<size_t>& lineStarts() const { return m_lineStarts; }
+
+    /// Whether there are edits since the last rebase
+    bool isModified() const { return m_modified; }
+
+    /// The offset of a line and character, or nullopt if there's no such line. Characters past
+    /// the end of the text are clamped to it.
+    std::optional<size_t> offsetOf(size_t line, size_t character) const;
+
+    /// Replace length characters at offset with text
+    void replace(size_t offset, size_t length, std::string_view text);
+
+    /// Replace all of the text
+    void assign(std::string_view text);
+
+    /// Append the current text to a buffer, e.g. a SmallVector<char>
+    template<typename Buffer>
+    void appendTo(Buffer& buffer) const {
+        for (auto& piece : m_pieces) {
+            auto data = pieceData(piece);
+            buffer.append(data, data + piece.length);
+        }
+    }
+
+    std::string str() const;
+
+    /// Start over from text equal to the current text, e.g. once it's been written to a new
+    /// buffer. Line offsets are kept, since the text is the same.
+    void rebase(std::string_view text);
+
+private:
+    struct Piece {
+        /// Whether the text is in m_added, rather than m_original
+        bool added;
+        size_t start;
+        size_t length;
+    };
+
+    /// Reads the current text forward from an offset
+    class Reader;
+
+    const char* pieceData(const Piece& piece) const {
+        return (piece.added ? m_added.data() : m_original.data()) + piece.start;
+    }
+
+    /// Split the piece containing offset so that a piece starts there
+    /// @return The index of the piece starting at offset
+    size_t split(size_t offset);
+
+    /// Update the line offsets after replacing length characters at offset with inserted ones
+    void updateLines(size_t offset, size_t length, size_t inserted);
+
+    std::string_view m_original;
+    std::string m_added;
+    std::vector<Piece> m_pieces;
+    size_t m_size = 0;
+    bool m_modified = false;
+
+    std::vector<size_t> m_lineStarts;
+};
+
+} // namespace server
@@ -14,6 +14,7 @@
 #include "lsp/LspTypes.h"
 #include "util/Markdown.h"
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string_view>
 #include <vector>
@@ -43,6 +44,11 @@ public:
     /// An instance is created on every document open and change.
     /// It's designed to provide index structures for performing lookups, and all the data that's
     /// immediately queried by the client following an open or change.
+    ///
+    /// Construction does no work. The analysis is built in stages the first time a query needs
+    /// them: syntax index -> macro index -> compilation -> symbol index -> driver analysis, so
+    /// that e.g. document symbols and links never elaborate anything. Each stage is recorded in
+    /// the time trace.
     /// @param sourceManager Reference to the source manager for file operations
     /// @param buffer The source buffer containing the document to analyze
     /// @param tree The syntax tree for the document
@@ -74,7 +80,7 @@ public:
     /// @param loc The source location to query
     /// @return Pointer to the word token at the location, or nullptr if none found
     const slang::parsing::Token* getWordTokenAt(slang::SourceLocation loc) const {
-        return syntaxes.getWordTokenAt(loc);
+        return getSyntaxes().getWordTokenAt(loc);
     }
 
     // @brief Gets the AST symbol at a specific source location
@@ -99,7 +105,22 @@ public:
     /// @brief Return true if shallow compilation has the latest buffers in all it's syntax trees
     bool hasValidBuffers();
 
-    const std::unique_ptr<slang::ast::Compilation>& getCompilation() const { return m_compilation; }
+    /// @brief Return true if the shallow compilation was built from exactly these syntax trees,
+    /// in which case rebuilding it would give the same result
+    bool isBuiltFrom(const std::vector<std::shared_ptr<slang::syntax::SyntaxTree>>& trees) const {
+        return trees == m_allTrees;
+    }
+
+    /// @brief Gets the shallow compilation, creating it if needed
+    const std::unique_ptr<slang::ast::Compilation>& getCompilation() const;
+
+    /// @brief Locks the compilation against queries on other threads. Slang elaborates lazily,
+    /// so even lookups write to it. Methods here that use it take the lock themselves; callers
+    /// hold it too while using the compilation, symbols or scopes they get back. Only hold one
+    /// analysis's lock at a time, so requests looking at several analyses can't deadlock.
+    std::unique_lock<std::recursive_mutex> lockQueries() const {
+        return std::unique_lock(m_queryMutex);
+    }
 
     /// @brief Ensures the shallow compilation has been analyzed and returns the slang
     /// `AnalysisManager`. Returns nullptr if analysis could not be run, for example no top
@@ -120,16 +141,19 @@ public:
     /// @brief Gets the AST symbol that a declared token refers to, if any
     const slang::ast::Symbol* getSymbolAtToken(const slang::parsing::Token* node) const;
 
+    using MacroMap =
+        slang::flat_hash_map<std::string_view, const slang::syntax::DefineDirectiveSyntax*>;
+    using MacroUsageMap = slang::flat_hash_map<const slang::syntax::SyntaxNode*,
+                                               const slang::syntax::DefineDirectiveSyntax*>;
+
     /// Syntax finder for location->syntax mapping
-    SyntaxIndexer syntaxes;
+    const SyntaxIndexer& getSyntaxes() const;
 
     /// Map from macro name to macro definition (last active definition)
-    slang::flat_hash_map<std::string_view, const slang::syntax::DefineDirectiveSyntax*> macros;
+    const MacroMap& getMacros() const;
 
     /// Map from macro usage syntax to the definition that was active at expansion time
-    slang::flat_hash_map<const slang::syntax::SyntaxNode*,
-                         const slang::syntax::DefineDirectiveSyntax*>
-        macroUsageDefinitions;
+    const MacroUsageMap& getMacroUsageDefinitions() const;
 
     friend class DocumentHandle;
     friend class InlayHintCollector;
@@ -167,8 +191,27 @@ private:
     /// All syntax trees needed for the shallow compilation
     std::vector<std::shared_ptr<slang::syntax::SyntaxTree>> m_allTrees;
 
+    /// Options for the shallow compilation
+    slang::Bag m_options;
+
+    /// Held while the compilation is built or used, see lockQueries
+    mutable std::recursive_mutex m_queryMutex;
+
+    // Stages, each built once by the first query that needs it. Read-only requests run
+    // concurrently, so they're guarded by once flags. The syntax stages only read their trees and
+    // need nothing more; the compilation and symbol stages are also built under the query lock,
+    // which callers keep holding while they use them.
+
+    mutable std::once_flag m_syntaxesBuilt;
+    mutable std::optional<SyntaxIndexer> m_syntaxes;
+
+    mutable std::once_flag m_macrosBuilt;
+    mutable MacroMap m_macros;
+    mutable MacroUsageMap m_macroUsageDefinitions;
+
     /// Compilation context for symbol resolution
-    std::unique_ptr<slang::ast::Compilation> m_compilation;
+    mutable std::once_flag m_compilationBuilt;
+    mutable std::unique_ptr<slang::ast::Compilation> m_compilation;
 
     /// Analysis manager for running driver analysis (multi-driven, unused, etc)
     std::unique_ptr<slang::analysis::AnalysisManager> m_driverAnalysis = nullptr;
@@ -185,7 +228,11 @@ private:
     SymbolTreeVisitor m_symbolTreeVisitor;
 
     /// Symbol indexer for syntax->symbol mappings of definitions; Used for lookups
-    SymbolIndexer m_symbolIndexer;
+    mutable std::once_flag m_symbolsIndexed;
+    mutable SymbolIndexer m_symbolIndexer;
+
+    /// Symbol index for the document, visiting the compilation if needed
+    const SymbolIndexer& getSymbolIndex() const;
 
     /// @brief Helper method to check if a token is positioned over a selector
     bool isOverSelector(const slang::parsing::Token* node,
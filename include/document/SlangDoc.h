@@ -8,10 +8,12 @@
 
 #pragma once
 
+#include "document/DocumentText.h"
 #include "document/ShallowAnalysis.h"
 #include "lsp/LspTypes.h"
 #include "lsp/URI.h"
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <sys/types.h>
 #include <vector>
@@ -50,6 +52,9 @@ private:
     /// The buffer of the actual source text (no expansions)
     slang::SourceBuffer m_buffer;
 
+    /// Edits not yet written to m_buffer, created on the first edit
+    std::unique_ptr<DocumentText> m_edits;
+
     /// The syntax tree for this document
     std::shared_ptr<slang::syntax::SyntaxTree> m_tree;
 
@@ -60,9 +65,26 @@ private:
     /// Shared so that callers can hold the analysis alive even if getAnalysis() recreates it.
     std::shared_ptr<ShallowAnalysis> m_analysis;
 
+    /// Index generation the dependencies were resolved against. Lookups made while the workspace
+    /// was still being indexed are redone when it changes.
+    uint64_t m_indexGeneration = 0;
+
+    /// Read-only requests build the tree and analysis lazily from several threads at once.
+    /// The text lock guards the buffer, edits and tree, and is never held while taking another
+    /// lock. The analysis lock guards the analysis and dependencies, and may take the text locks
+    /// of this document and its dependencies.
+    mutable std::mutex m_textMutex;
+    mutable std::mutex m_analysisMutex;
+
     // For testing
     friend class DocumentHandle;
 
+    /// The buffer's text without its null terminator
+    std::string_view bufferText() const;
+
+    /// Replace the buffer with the edited text, if there are edits. Needs the text lock.
+    void applyEdits();
+
 public:
     SlangDoc(ServerDriver& driver, URI uri, slang::SourceBuffer buffer);
 
@@ -78,8 +100,9 @@ public:
     static std::shared_ptr<SlangDoc> open(ServerDriver& driver, const URI& uri);
 
     SourceManager& getSourceManager() const { return m_sourceManager; }
-    const slang::BufferID getBuffer() const { return m_buffer.id; }
-    const std::string_view getText() const;
+    /// The buffer and text include edits, which are written to a new buffer if needed
+    const slang::BufferID getBuffer();
+    const std::string_view getText();
     const URI& getURI() { return m_uri; }
     std::string_view getPath() const { return m_uri.getPath(); }
 
@@ -87,7 +110,10 @@ public:
     std::shared_ptr<slang::syntax::SyntaxTree> getSyntaxTree();
 
     /// @brief Check if analysis exists without creating it
-    bool hasAnalysis() const { return m_analysis != nullptr && m_analysis->hasValidBuffers(); }
+    bool hasAnalysis() const {
+        std::lock_guard lock(m_analysisMutex);
+        return m_analysis != nullptr && m_analysis->hasValidBuffers();
+    }
 
     /// @brief Get the analysis, creating it if necessary.
     /// Returns a shared_ptr so callers can hold the analysis alive independently of this document.
@@ -123,6 +149,7 @@ public:
     ////////////////////////////////////////////////
     /// @brief Set dependent documents for this document, updated by driver after document changes
     void setDependentDocuments(const std::vector<std::shared_ptr<SlangDoc>>& dependentDocs) {
+        std::lock_guard lock(m_analysisMutex);
         m_dependentDocuments = dependentDocs;
     }
 
@@ -8,6 +8,7 @@
 #pragma once
 
 #include "completions/CompletionContext.h"
+#include <cstdint>
 #include <vector>
 
 #include "slang/parsing/Token.h"
@@ -37,12 +38,14 @@ public:
     /// Collected disabled regions from preprocessor conditionals in the file
     std::vector<slang::SourceRange> disabledRegions;
 
-    /// Mapping of tokens to their parent syntax node
-    slang::flat_hash_map<const slang::parsing::Token*, const slang::syntax::SyntaxNode*>
-        tokenToParent;
+    /// A syntax node potentially used in inlay hints
+    struct Hint {
+        uint32_t offset;
+        const slang::syntax::SyntaxNode* node;
+    };
 
-    /// Map from offset to syntax nodes collected for inlay hints
-    std::map<uint32_t, slang::not_null<const slang::syntax::SyntaxNode*>> collectedHints;
+    /// Syntax nodes collected for inlay hints, sorted by offset with one node per offset
+    std::vector<Hint> collectedHints;
 
     /// Tokens from a macro expansion, stored as pointers into the syntax tree
     struct MacroExpansionTokens {
@@ -75,10 +78,19 @@ public:
     const slang::syntax::SyntaxNode* getSyntaxAt(slang::SourceLocation loc) const;
 
 private:
-    /// Whether the editor considers this location to be inside the given range
-    bool editorContains(slang::SourceRange range, slang::SourceLocation loc) const;
+    // For each token in collected, in the same order: where it starts and ends, its kind and its
+    // parent syntax. Lookups binary search these instead of dereferencing tokens.
+    std::vector<uint32_t> m_starts;
+    std::vector<uint32_t> m_ends;
+    std::vector<slang::parsing::TokenKind> m_kinds;
+    std::vector<const slang::syntax::SyntaxNode*> m_parents;
+
+    /// Whether the editor considers this location to be inside the token at the index
+    bool editorContains(size_t index, slang::SourceLocation loc) const;
     /// Get the index of the token before the given location, or -1 if before the first token
     int tokenIndexBefore(slang::SourceLocation loc) const;
+    /// Get the index of a collected token, or -1 if it wasn't collected
+    int tokenIndexOf(const slang::parsing::Token* tok) const;
     /// Whether this token kind is considered as some sort of identifier
     bool isIdToken(const slang::parsing::TokenKind kind) const;
     /// Recursively visit syntax nodes, called in constructor.
@@ -8,11 +8,24 @@
 
 #pragma once
 
+#include "lsp/MessageReader.h"
+#include "lsp/MessageWriter.h"
+#include "lsp/SessionRecorder.h"
 #include "rfl/Generic.hpp"
+#include "util/Logging.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <rfl/json.hpp> // IWYU pragma: keep
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
 
 namespace lsp {
 
@@ -27,6 +40,30 @@ struct RpcRequest {
     Params_t params;
 };
 
+/// An incoming request or notification. The message is parsed once; params stay in the parsed
+/// document until the handler reads them into its own type, without an rfl::Generic in between.
+struct IncomingMessage {
+    ID_t id;
+    std::string method;
+    std::shared_ptr<yyjson_doc> doc;
+    /// Null if the message has no params
+    yyjson_val* params = nullptr;
+    /// When the message was read, for measuring how long it waits to be handled
+    std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
+};
+
+/// Read a message's params straight into P
+template<typename P>
+P readParams(yyjson_val* params) {
+    if (!params)
+        throw std::runtime_error("Missing params");
+    rfl::Result<P> result = rfl::json::read<P, rfl::UnderlyingEnums>(
+        rfl::json::Reader::InputVarType(params));
+    if (!result)
+        throw std::runtime_error(result.error().what());
+    return std::move(result.value());
+}
+
 struct RpcNotification {
     std::string jsonrpc;
     std::string method;
@@ -51,78 +88,205 @@ struct RpcErrorResponse {
     RpcError error;
 };
 
+/// Thrown by handlers that notice the request they're handling was cancelled
+struct RequestCancelledError : std::runtime_error {
+    RequestCancelledError() : std::runtime_error("Request cancelled") {}
+};
+
+/// While a request is being handled, points to the flag `$/cancelRequest` sets for it
+inline thread_local const std::atomic<bool>* currentRequestCancelled = nullptr;
+
+/// Whether the client cancelled the request being handled on this thread. Long running handlers
+/// should check between units of work, so stale work is abandoned early.
+inline bool isRequestCancelled() {
+    return currentRequestCancelled && currentRequestCancelled->load(std::memory_order_relaxed);
+}
+
+inline void throwIfCancelled() {
+    if (isRequestCancelled())
+        throw RequestCancelledError();
+}
+
+/// Queue a serialized message for the writer thread. Messages may be sent from any thread
+/// (e.g. indexing progress) while a request is being handled. A queued message is dropped if
+/// another with the same key is queued before it's written; the session recording, which the
+/// writer keeps, leaves it out too.
+inline void writeMessage(std::string message, std::string key = {}) {
+    outputWriter().push(std::move(message), std::move(key));
+}
+
 template<typename T>
-void sendMessage(const T& message) {
-    auto message_str = rfl::json::write<rfl::UnderlyingEnums>(message);
-    std::cout << "Content-Length: " << message_str.length() << "\r\n\r\n";
-    std::cout << message_str;
-    std::cout.flush();
+void sendMessage(const T& message, std::string key = {}) {
+    writeMessage(rfl::json::write<rfl::UnderlyingEnums>(message), std::move(key));
+}
+
+/// Send a response whose result is already serialized
+inline void sendResult(const ID_t& id, std::string_view result) {
+    std::string message = R"({"jsonrpc":"2.0","id":)";
+    message += rfl::json::write(id);
+    message += R"(,"result":)";
+    message += result;
+    message += '}';
+    writeMessage(std::move(message));
 }
 
-inline void sendNotification(const std::string& method, const rfl::Generic& params) {
+/// A key makes this notification supersede queued ones with the same key, e.g. diagnostics for
+/// the same document
+inline void sendNotification(const std::string& method, const rfl::Generic& params,
+                             std::string key = {}) {
     sendMessage(RpcNotification{
-        .jsonrpc = "2.0",
-        .method = method,
-        .params = params,
-    });
-    std::cerr << "---> " << method;
-    // std::cerr << ": " << rfl::json::write(params) << std::endl;
-    std::cerr << std::endl;
+                    .jsonrpc = "2.0",
+                    .method = method,
+                    .params = params,
+                },
+                std::move(key));
+    LOG_DEBUG("---> {}", method);
+}
+
+/// A response to a request we sent
+struct IncomingResponse {
+    /// Only integer ids are ours
+    std::optional<int> id;
+    /// The response has an error rather than a result
+    bool isError = false;
+};
+
+/// Callbacks waiting for the responses to requests we sent, by request id
+class PendingRequests {
+public:
+    /// Returns the id to send the request with. The callback runs on the thread reading
+    /// messages once the request succeeds, and is dropped if it fails.
+    int add(std::function<void()> onResult) {
+        std::lock_guard lock(m_mutex);
+        int id = m_nextId++;
+        if (onResult)
+            m_callbacks.emplace(id, std::move(onResult));
+        return id;
+    }
+
+    void resolve(const IncomingResponse& response) {
+        if (!response.id)
+            return;
+        std::function<void()> onResult;
+        {
+            std::lock_guard lock(m_mutex);
+            auto it = m_callbacks.find(*response.id);
+            if (it == m_callbacks.end())
+                return;
+            onResult = std::move(it->second);
+            m_callbacks.erase(it);
+        }
+        if (response.isError) {
+            WARN("Client request {} failed", *response.id);
+            return;
+        }
+        onResult();
+    }
+
+private:
+    std::mutex m_mutex;
+    int m_nextId = 0;
+    std::unordered_map<int, std::function<void()>> m_callbacks;
+};
+
+inline PendingRequests& pendingRequests() {
+    static PendingRequests requests;
+    return requests;
 }
 
-inline void sendRequest(const std::string& method, const rfl::Generic& params) {
+/// Send a request to the client, calling onResult if it succeeds
+inline void sendRequest(const std::string& method, const rfl::Generic& params,
+                        std::function<void()> onResult = {}) {
     sendMessage(RpcRequest{
         .jsonrpc = "2.0",
-        .id = 0,
+        .id = pendingRequests().add(std::move(onResult)),
         .method = method,
         .params = params,
     });
-    std::cerr << "---> " << method;
-    // std::cerr << ": " << rfl::json::write(params) << std::endl;
-    std::cerr << std::endl;
+    LOG_DEBUG("---> {}", method);
 }
 
-template<typename T>
-T readJson(std::string& line, std::string& content) {
-    while (std::getline(std::cin, line)) {
-        if (line.find("Content-Length: ") != 0) {
-            std::cerr << "<-/- " << "Invalid Line: " << line << std::endl;
-            continue;
-        }
+/// A message that's neither a request, a notification nor a response, to be answered with an
+/// error
+struct InvalidMessage {
+    /// The message's id, or null if it has none or couldn't be parsed
+    ID_t id;
+    RpcError error;
+};
 
-        int contentLength = std::stoi(line.substr(16));
-        content.resize(contentLength);
-
-        do {
-            // Read maybe charset and empty line. Neovim and Vscode both don't
-            // have this header row.
-            std::getline(std::cin, line);
-        } while (line.size() > 1);
-
-        std::cin.read(&content[0], contentLength);
-
-        rfl::Result<T> request = rfl::json::read<T>(content);
-        if (!request) {
-            auto response = rfl::json::read<RpcResponse>(content);
-            if (response) {
-                continue;
-            }
-            std::cerr << "Error parsing JSON: " << content << std::endl;
-            std::cerr << "Rfl Error: " << request.error().what() << std::endl;
-            sendMessage(
-                RpcErrorResponse{.jsonrpc = "2.0",
-                                 .id = 0,
-                                 .error = RpcError{
-                                     .code = 1,
-                                     .message = "Error parsing JSON: " + request.error().what() +
-                                                " for content: " + content,
-                                 }});
-            continue;
-        }
+using ParsedMessage = std::variant<IncomingMessage, IncomingResponse, InvalidMessage>;
+
+/// Parse a message body and classify it by its members: requests and notifications have a
+/// method, responses have a result or an error instead.
+inline ParsedMessage parseMessage(std::string_view content) {
+    std::shared_ptr<yyjson_doc> doc(yyjson_read(content.data(), content.size(), 0),
+                                    yyjson_doc_free);
+    if (!doc)
+        return InvalidMessage{.id = std::nullopt,
+                              .error = RpcError{.code = -32700, .message = "Parse error"}};
 
-        return std::move(request.value());
+    yyjson_val* root = yyjson_doc_get_root(doc.get());
+    ID_t id;
+    yyjson_val* idVal = yyjson_obj_get(root, "id");
+    if (yyjson_is_int(idVal))
+        id = int(yyjson_get_int(idVal));
+    else if (yyjson_is_str(idVal))
+        id = std::string(yyjson_get_str(idVal), yyjson_get_len(idVal));
+
+    yyjson_val* method = yyjson_obj_get(root, "method");
+    yyjson_val* error = yyjson_obj_get(root, "error");
+    if (!method && (yyjson_obj_get(root, "result") || error)) {
+        IncomingResponse response{.isError = error != nullptr};
+        if (yyjson_is_int(idVal))
+            response.id = yyjson_get_int(idVal);
+        return response;
+    }
+
+    if (!yyjson_is_str(method)) {
+        return InvalidMessage{.id = std::move(id),
+                              .error = RpcError{.code = -32600,
+                                                .message = "Invalid request: expected a "
+                                                           "method, result or error"}};
+    }
+
+    return IncomingMessage{.id = std::move(id),
+                           .method = std::string(yyjson_get_str(method),
+                                                 yyjson_get_len(method)),
+                           .doc = std::move(doc),
+                           .params = yyjson_obj_get(root, "params")};
+}
+
+/// Send an error response. Unlike RpcErrorResponse, a missing id is written as null, which is
+/// what JSON-RPC expects when the request's id couldn't be read.
+inline void sendError(const ID_t& id, const RpcError& error) {
+    std::string message = R"({"jsonrpc":"2.0","id":)";
+    message += id ? rfl::json::write(*id) : "null";
+    message += R"(,"error":)";
+    message += rfl::json::write(error);
+    message += '}';
+    writeMessage(std::move(message));
+}
+
+/// Read messages until the next request or notification. Responses to our requests are passed to
+/// their callbacks, and anything else is answered with an error. Returns nullopt at the end of
+/// input.
+inline std::optional<IncomingMessage> readMessage(MessageReader& reader) {
+    while (auto content = reader.next()) {
+        sessionRecorder().record(SessionRecorder::Direction::In, *content);
+
+        auto parsed = parseMessage(*content);
+        if (auto message = std::get_if<IncomingMessage>(&parsed))
+            return std::move(*message);
+
+        if (auto response = std::get_if<IncomingResponse>(&parsed))
+            pendingRequests().resolve(*response);
+
+        if (auto invalid = std::get_if<InvalidMessage>(&parsed)) {
+            ERROR("Error parsing JSON: {}", *content);
+            sendError(invalid->id, invalid->error);
+        }
     }
-    return T{};
+    return std::nullopt;
 }
 
 } // namespace lsp
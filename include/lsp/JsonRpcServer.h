@@ -10,55 +10,214 @@
 
 #include "JsonRpc.h"
 #include "lsp/LspTypes.h"
+#include "lsp/ServerMetrics.h"
 #include "rfl/Generic.hpp"
+#include "util/Logging.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <concepts>
+#include <condition_variable>
+#include <deque>
 #include <functional>
-#include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <rfl/json/write.hpp>
 #include <rfl/visit.hpp>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <variant>
+#include <vector>
+
+#include "slang/util/TimeTrace.h"
 
 namespace lsp {
 
+/// Tasks run by a fixed set of threads. With a single thread, tasks run in the order they were
+/// pushed.
+class WorkQueue {
+public:
+    explicit WorkQueue(size_t numThreads) {
+        for (size_t i = 0; i < numThreads; i++)
+            threads.emplace_back([this] { work(); });
+    }
+
+    WorkQueue(const WorkQueue&) = delete;
+    WorkQueue& operator=(const WorkQueue&) = delete;
+
+    ~WorkQueue() { close(); }
+
+    void push(std::function<void()> task) {
+        {
+            std::lock_guard lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        ready.notify_one();
+    }
+
+    /// Finish the tasks pushed so far, then stop the threads
+    void close() {
+        {
+            std::lock_guard lock(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+        threads.clear();
+    }
+
+private:
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock lock(mutex);
+                ready.wait(lock, [&] { return closed || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> tasks;
+    bool closed = false;
+    std::vector<std::jthread> threads;
+};
+
+/// Tasks pushed to a WorkQueue once their delay has passed. Tasks still waiting when the queue is
+/// closed are dropped.
+class DelayQueue {
+public:
+    explicit DelayQueue(WorkQueue& target) : target(target), thread([this] { work(); }) {}
+
+    DelayQueue(const DelayQueue&) = delete;
+    DelayQueue& operator=(const DelayQueue&) = delete;
+
+    ~DelayQueue() { close(); }
+
+    /// @return False if the queue has been closed, in which case the task is dropped
+    bool push(std::chrono::milliseconds delay, std::function<void()> task) {
+        {
+            std::lock_guard lock(mutex);
+            if (closed)
+                return false;
+            tasks.emplace(std::chrono::steady_clock::now() + delay, std::move(task));
+        }
+        ready.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard lock(mutex);
+            closed = true;
+            tasks.clear();
+        }
+        ready.notify_one();
+        if (thread.joinable())
+            thread.join();
+    }
+
+private:
+    void work() {
+        std::unique_lock lock(mutex);
+        while (!closed) {
+            if (tasks.empty()) {
+                ready.wait(lock);
+                continue;
+            }
+            auto first = tasks.begin();
+            if (first->first > std::chrono::steady_clock::now()) {
+                // A copy, since close() may free the task while this waits
+                auto deadline = first->first;
+                ready.wait_until(lock, deadline);
+                continue;
+            }
+            target.push(std::move(first->second));
+            tasks.erase(first);
+        }
+    }
+
+    WorkQueue& target;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::multimap<std::chrono::steady_clock::time_point, std::function<void()>> tasks;
+    bool closed = false;
+    std::thread thread;
+};
+
 template<typename Impl>
 class JsonRpcServer {
 protected:
-    /// method name -> request handler
-    std::unordered_map<std::string, std::function<rfl::Generic(rfl::Generic)>> requests;
+    /// method name -> request handler, which reads the params from the parsed message and
+    /// returns the serialized result
+    std::unordered_map<std::string, std::function<std::string(yyjson_val*)>> requests;
 
     /// method name -> notification handler
-    std::unordered_map<std::string, std::function<void(rfl::Generic)>> notifications;
+    std::unordered_map<std::string, std::function<void(yyjson_val*)>> notifications;
+
+    /// Requests that run on the worker pool, concurrently with each other and with the ordered
+    /// message loop. Their handlers may only use thread-safe state, like the index.
+    std::unordered_set<std::string> concurrentRequests;
+
+    void markConcurrent(const std::string& method) { concurrentRequests.insert(method); }
+
+    /// Requests that only read documents. They take their turn on the ordered queue, so they see
+    /// every edit sent before them, then run on the worker pool alongside each other. Messages
+    /// after them on the ordered queue wait for them to finish before running, so they never see
+    /// a document change under them. Their handlers must lock what they build lazily, like
+    /// syntax trees and analyses.
+    std::unordered_set<std::string> readOnlyRequests;
+
+    void markReadOnly(const std::string& method) { readOnlyRequests.insert(method); }
+
+    /// Latency, queue wait and allocations of each handled message, by method
+    ServerMetrics metrics;
+
+    static std::string idToString(const rfl::Variant<int, std::string>& id) {
+        return rfl::visit(
+            [&](auto&& id_) -> std::string {
+                using T = typename std::decay_t<decltype(id_)>;
+                if constexpr (std::is_same_v<T, int>) {
+                    return std::to_string(id_);
+                }
+                else if constexpr (std::is_same_v<T, std::string>) {
+                    return id_;
+                }
+                else {
+                    static_assert(rfl::always_false_v<T>, "Not all cases were covered.");
+                }
+            },
+            id);
+    }
 
     /// Register an rpc method with the given Params, Return, and Method (name)
     template<typename P, typename R, auto Method>
     void registerMethod(const std::string& name) {
         if constexpr (std::is_same_v<R, std::monostate>) {
-            requests[name] = [](std::optional<rfl::Generic>) -> rfl::Generic {
-                return std::nullopt;
-            };
+            requests[name] = [](yyjson_val*) -> std::string { return "null"; };
         }
         else {
-            requests[name] = [this](std::optional<rfl::Generic> paramsJson) -> rfl::Generic {
-                // Deserialize params
-
+            requests[name] = [this](yyjson_val* paramsJson) -> std::string {
+                // Deserialize params straight from the message, and serialize the result
+                // straight to JSON
                 auto getResult = [&]() {
                     if constexpr (!std::is_same_v<P, std::nullopt_t>) {
-                        rfl::Result<P> params = rfl::from_generic<P, rfl::UnderlyingEnums>(
-                            paramsJson.value());
-                        if (!params) {
-                            throw std::runtime_error(params.error().what());
-                        }
-                        return (static_cast<Impl*>(this)->*Method)(params.value());
+                        return (static_cast<Impl*>(this)->*Method)(readParams<P>(paramsJson));
                     }
                     else {
                         return (static_cast<Impl*>(this)->*Method)(std::monostate{});
                     }
                 };
-                return rfl::to_generic<rfl::UnderlyingEnums>(getResult());
+                return rfl::json::write<rfl::UnderlyingEnums>(getResult());
             };
         }
     }
@@ -66,16 +225,10 @@ protected:
     /// Register an rpc notification with the given Params and Method (name)
     template<typename P, auto Method>
     void registerNotification(const std::string& name) {
-        notifications[name] = [this](std::optional<rfl::Generic> paramsJson) {
+        notifications[name] = [this](yyjson_val* paramsJson) {
             // Call Notification
             if constexpr (!std::is_same_v<P, std::nullopt_t>) {
-                // Deserialize params
-                rfl::Result<P> params = rfl::from_generic<P, rfl::UnderlyingEnums>(
-                    paramsJson.value());
-                if (!params) {
-                    throw std::runtime_error(params.error().what());
-                }
-                (static_cast<Impl*>(this)->*Method)(params.value());
+                (static_cast<Impl*>(this)->*Method)(readParams<P>(paramsJson));
             }
             else {
                 (static_cast<Impl*>(this)->*Method)(std::nullopt);
@@ -83,93 +236,135 @@ protected:
         };
     }
 
-    std::variant<rfl::Generic, RpcError, std::nullopt_t> processMessage(RpcRequest request) {
+    /// Returns the serialized result of a request
+    std::variant<std::string, RpcError, std::nullopt_t> processMessage(
+        const IncomingMessage& request) {
         if (!request.id) {
             // Notification
             auto it = notifications.find(request.method);
             if (it != notifications.end()) {
-                std::cerr << "<--- " << request.method << std::endl;
-                // std::cerr << rfl::json::write(request.params, rfl::json::pretty) <<
-                // std::endl;
+                LOG_DEBUG("<--- {}", request.method);
+                auto measured = metrics.measure(request.method, request.received);
+                slang::TimeTraceScope timeScope(request.method, "");
                 try {
-                    if (request.params.has_value()) {
-                        it->second(request.params.value());
-                    }
-                    else {
-                        it->second(std::nullopt);
-                    }
-                    std::cerr << "---- " << request.method << " (notification finished)"
-                              << std::endl;
+                    it->second(request.params);
+                    LOG_DEBUG("---- {} (notification finished)", request.method);
                 }
                 catch (const std::exception& e) {
-                    std::cerr << "-/-> " << request.method << " Error: " << e.what() << '\n';
+                    measured.fail();
+                    ERROR("-/-> {} Error: {}", request.method, e.what());
                 }
             }
             else if (request.method.find("$/") == 0) {
-                std::cerr << "<-/- " << request.method << " (ignoring threaded req)" << '\n';
+                LOG_DEBUG("<-/- {} (ignoring threaded req)", request.method);
             }
             else {
-                std::cerr << "<-/- " << request.method << " (method not found)" << '\n';
+                WARN("<-/- {} (method not found)", request.method);
             }
             return std::nullopt;
         }
 
         // Request
-        std::string id = rfl::visit(
-            [&](auto&& id_) -> std::string {
-                using T = typename std::decay_t<decltype(id_)>;
-                if constexpr (std::is_same_v<T, int>) {
-                    return std::to_string(id_);
-                }
-                else if constexpr (std::is_same_v<T, std::string>) {
-                    return id_;
-                }
-                else {
-                    static_assert(rfl::always_false_v<T>, "Not all cases were covered.");
-                }
-            },
-            request.id.value());
+        std::string id = idToString(request.id.value());
 
         auto it = requests.find(request.method);
 
         if (it != requests.end()) {
+            auto measured = metrics.measure(request.method, request.received);
+            slang::TimeTraceScope timeScope(request.method, id);
             try {
-                std::cerr << "<--- " << request.method << " " << id << '\n';
-                rfl::Generic req_response;
-                if (request.params.has_value()) {
-                    req_response = it->second(request.params.value());
-                }
-                else {
-                    req_response = it->second(rfl::Generic{});
-                }
-                std::cerr << "---> " << request.method << " " << id << '\n';
+                LOG_DEBUG("<--- {} {}", request.method, id);
+                auto req_response = it->second(request.params);
+                LOG_DEBUG("---> {} {}", request.method, id);
                 return req_response;
             }
+            catch (const RequestCancelledError&) {
+                measured.fail();
+                LOG_DEBUG("-/-> {} {} (cancelled)", request.method, id);
+                return RpcError{.code = int(LSPErrorCodes::RequestCancelled),
+                                .message = "Request cancelled"};
+            }
             catch (const std::exception& e) {
-                std::cerr << "-/-> " << request.method << " " << id << " Error: " << e.what()
-                          << "\n\n";
+                measured.fail();
+                ERROR("-/-> {} {} Error: {}", request.method, id, e.what());
                 return RpcError{.code = 1, .message = e.what()};
             }
         }
         else {
-            std::cerr << "<-/- " << request.method << " (not found)" << '\n';
+            WARN("<-/- {} (not found)", request.method);
         }
 
         return std::nullopt;
     }
 
-    void handleMessage(RpcRequest req) {
-        std::lock_guard<std::mutex> lock(mutex);
-        auto result = processMessage(req);
+    void handleMessage(IncomingMessage req) {
+        auto lock = lockExclusive();
+        respond(req);
+    }
+
+    /// Read-only requests handed to the worker pool that haven't finished yet
+    std::mutex readersMutex;
+    std::condition_variable readersDone;
+    size_t readers = 0;
+
+    /// Lock the server mutex for a message that may change documents, once the read-only requests
+    /// before it have finished
+    std::unique_lock<std::mutex> lockExclusive() {
+        {
+            std::unique_lock lock(readersMutex);
+            readersDone.wait(lock, [&] { return readers == 0; });
+        }
+        return std::unique_lock(mutex);
+    }
+
+    /// Called on the ordered queue: run a read-only request on the worker pool. Nothing after it
+    /// on the ordered queue can change documents until it's done.
+    void startReader(IncomingMessage req, WorkQueue& concurrent) {
+        {
+            std::lock_guard lock(readersMutex);
+            readers++;
+        }
+        concurrent.push([this, req = std::move(req)]() mutable {
+            respond(req);
+            {
+                std::lock_guard lock(readersMutex);
+                readers--;
+            }
+            readersDone.notify_all();
+        });
+    }
+
+    /// Handle a message and send the response, unless the request was cancelled before it started
+    void respond(IncomingMessage& req) {
+        std::shared_ptr<std::atomic<bool>> cancelled;
+        if (req.id) {
+            std::lock_guard lock(pendingMutex);
+            if (auto it = pending.find(idToString(*req.id)); it != pending.end())
+                cancelled = it->second;
+        }
+
+        std::variant<std::string, RpcError, std::nullopt_t> result = std::nullopt;
+        if (cancelled && *cancelled) {
+            LOG_DEBUG("-/-> {} (cancelled before starting)", req.method);
+            result = RpcError{.code = int(LSPErrorCodes::RequestCancelled),
+                              .message = "Request cancelled"};
+        }
+        else {
+            currentRequestCancelled = cancelled.get();
+            result = processMessage(req);
+            currentRequestCancelled = nullptr;
+        }
+
+        if (req.id) {
+            std::lock_guard lock(pendingMutex);
+            pending.erase(idToString(*req.id));
+        }
+
         std::visit(
-            [req](auto&& value) {
+            [&req](auto&& value) {
                 using T = std::decay_t<decltype(value)>;
-                if constexpr (std::is_same_v<T, rfl::Generic>) {
-                    sendMessage(RpcResponse{
-                        .jsonrpc = "2.0",
-                        .id = req.id,
-                        .result = value,
-                    });
+                if constexpr (std::is_same_v<T, std::string>) {
+                    sendResult(req.id, value);
                 }
                 else if constexpr (std::is_same_v<T, RpcError>) {
                     sendMessage(RpcErrorResponse{
@@ -180,19 +375,85 @@ protected:
                 }
             },
             result);
-        std::cerr << '\n';
     }
 
-    std::string line;
-    std::string content;
+    /// Flags for requests that haven't been answered yet, by id, so `$/cancelRequest` can reach
+    /// them while they wait or run
+    std::mutex pendingMutex;
+    std::unordered_map<std::string, std::shared_ptr<std::atomic<bool>>> pending;
+
+    void cancel(const IncomingMessage& req) {
+        std::optional<CancelParams> params;
+        try {
+            params = readParams<CancelParams>(req.params);
+        }
+        catch (const std::exception& e) {
+            ERROR("-/-> $/cancelRequest Error: {}", e.what());
+            return;
+        }
+
+        std::lock_guard lock(pendingMutex);
+        if (auto it = pending.find(idToString(params->id)); it != pending.end()) {
+            LOG_DEBUG("<--- $/cancelRequest {}", it->first);
+            *it->second = true;
+        }
+    }
+
+    /// Called on the reading thread. Everything but concurrent requests goes through one ordered
+    /// queue, so edits and the requests around them see documents as they would if handled one
+    /// at a time. Read-only requests only pass through it on their way to the worker pool.
+    void dispatch(IncomingMessage req, WorkQueue& ordered, WorkQueue& concurrent) {
+        if (!req.id && req.method == "$/cancelRequest") {
+            cancel(req);
+            return;
+        }
+
+        if (req.id) {
+            std::lock_guard lock(pendingMutex);
+            pending[idToString(*req.id)] = std::make_shared<std::atomic<bool>>(false);
+        }
+
+        if (req.id && concurrentRequests.contains(req.method)) {
+            concurrent.push([this, req = std::move(req)]() mutable { respond(req); });
+        }
+        else if (req.id && readOnlyRequests.contains(req.method)) {
+            ordered.push([this, &concurrent, req = std::move(req)]() mutable {
+                startReader(std::move(req), concurrent);
+            });
+        }
+        else {
+            ordered.push([this, req = std::move(req)]() mutable { handleMessage(std::move(req)); });
+        }
+    }
+
+    MessageReader reader;
     std::mutex mutex;
 
+    /// Delays tasks for the ordered queue while the message loop is running
+    DelayQueue* delayed = nullptr;
+
+    /// Run a task on the ordered queue after a delay, holding the server mutex like a message
+    /// handler. Only called from handlers on the ordered queue.
+    /// @return False if there's no message loop to run it, e.g. when handlers are called directly
+    /// or the loop is shutting down, so the caller should do the work now instead
+    bool postDelayed(std::chrono::milliseconds delay, std::function<void()> task) {
+        if (!delayed)
+            return false;
+        return delayed->push(delay, [this, task = std::move(task)] {
+            auto lock = lockExclusive();
+            task();
+        });
+    }
+
 public:
     void run() {
         // Handle initialize first
-        RpcRequest req;
+        IncomingMessage req;
         while (true) {
-            req = readJson<RpcRequest>(line, content);
+            auto next = readMessage(reader);
+            if (!next)
+                return;
+            req = std::move(*next);
             if (req.method.compare("initialize") != 0) {
                 sendMessage(RpcErrorResponse{.jsonrpc = "2.0",
                                              .id = req.id,
@@ -206,17 +467,39 @@ public:
             break;
         }
 
-        // Run until shutdown
-        do {
-            req = readJson<RpcRequest>(line, content);
-            handleMessage(req);
-        } while (req.method.compare("shutdown") != 0);
+        // Run until shutdown. Messages keep being read while earlier ones are handled, so a
+        // `$/cancelRequest` can reach the request it's for.
+        {
+            WorkQueue ordered(1);
+            WorkQueue concurrent(std::clamp(std::thread::hardware_concurrency(), 2u, 4u));
+            DelayQueue delayedTasks(ordered);
+            delayed = &delayedTasks;
+            auto stop = [&] {
+                delayedTasks.close();
+                ordered.close();
+                concurrent.close();
+                delayed = nullptr;
+            };
+            do {
+                auto next = readMessage(reader);
+                if (!next) {
+                    stop();
+                    return;
+                }
+                req = std::move(*next);
+                dispatch(req, ordered, concurrent);
+            } while (req.method.compare("shutdown") != 0);
+
+            // Answer everything up to and including the shutdown request
+            stop();
+        }
 
         while (true) {
-            req = readJson<RpcRequest>(line, content);
-            if (req.method.compare("exit") == 0) {
+            auto next = readMessage(reader);
+            if (!next || next->method.compare("exit") == 0) {
                 break;
             }
+            req = std::move(*next);
             sendMessage(RpcErrorResponse{.jsonrpc = "2.0",
                                          .id = req.id,
                                          .error = lsp::RpcError{
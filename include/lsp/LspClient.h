@@ -22,7 +22,7 @@ namespace lsp {
 class LspClient {
 public:
     void showInfo(const std::string& message) {
-        std::cerr << "Info Notif: " << message << '\n';
+        INFO("Info Notif: {}", message);
         onWindowShowMessage(lsp::ShowMessageParams{
             .type = lsp::MessageType::Info,
             .message = message,
@@ -30,7 +30,7 @@ public:
     }
 
     virtual void showWarning(const std::string& message) {
-        std::cerr << "Warning Notif: " << message << '\n';
+        WARN("Warning Notif: {}", message);
         onWindowShowMessage(lsp::ShowMessageParams{
             .type = lsp::MessageType::Warning,
             .message = message,
@@ -38,7 +38,7 @@ public:
     }
 
     virtual void showError(const std::string& message) {
-        std::cerr << "Error Notif: " << message << '\n';
+        ERROR("Error Notif: {}", message);
         onWindowShowMessage(lsp::ShowMessageParams{
             .type = lsp::MessageType::Error,
             .message = message,
@@ -154,8 +154,10 @@ public:
     /// Diagnostics notification are sent from the server to the client to signal
     /// results of validation runs.
     virtual void onDocPublishDiagnostics(const PublishDiagnosticsParams& params) {
+        // Only the latest diagnostics for a document matter if the client falls behind
         sendNotification("textDocument/publishDiagnostics",
-                         rfl::to_generic<rfl::UnderlyingEnums>(params));
+                         rfl::to_generic<rfl::UnderlyingEnums>(params),
+                         "textDocument/publishDiagnostics " + params.uri.str());
     };
 
     virtual void onTextDocumentInactiveRegions(const InactiveRegionsParams& params) {
@@ -181,7 +183,7 @@ public:
         return std::monostate{};
     }
 
-    void onProgress(const ProgressParams& params) {
+    virtual void onProgress(const ProgressParams& params) {
         sendNotification("$/progress", rfl::to_generic<rfl::UnderlyingEnums>(params));
     };
 
@@ -54,18 +54,16 @@ protected:
                 return rfl::to_generic(result);
             }
         };
-        std::cerr << "Registered command: " << name << "\n";
+        LOG_DEBUG("Registered command: {}", name);
     }
 
     /// A request send from the client to the server to execute a command. The request might return
     /// a workspace edit which the client will apply to the workspace.
     std::optional<lsp::LSPAny> getWorkspaceExecuteCommand(const lsp::ExecuteCommandParams& params) {
-        std::cerr << " <---" << params.command << "(" << rfl::json::write(params.arguments)
-                  << ")\n";
+        LOG_DEBUG("<--- {}({})", params.command, rfl::json::write(params.arguments));
         auto command = m_commands.find(params.command);
         if (command == m_commands.end()) {
-            std::cerr << "Unknown command: " << params.command << "\n";
-            std::cerr << " -/-> \n";
+            WARN("-/-> Unknown command: {}", params.command);
             return std::nullopt;
         }
         // returns are rearely used
@@ -85,7 +83,7 @@ protected:
         }
         auto x = command->second(args);
 
-        std::cerr << " ---> " << params.command << "\n";
+        LOG_DEBUG("---> {}", params.command);
 
         // INFO("Command {} returned: {}", params.command, rfl::json::write(x));
         return x;
@@ -0,0 +1,48 @@
+//------------------------------------------------------------------------------
+// MessageReader.h
+// Buffered reader for LSP base protocol framing
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+namespace lsp {
+
+/// Splits the bytes read from a file descriptor into LSP messages. Reads go straight into one
+/// large buffer, headers are scanned in place, and message bodies are handed out as views into
+/// the buffer, so a message is never copied on its way to the JSON parser.
+class MessageReader {
+public:
+    /// Initial buffer size; grows for messages that don't fit
+    static constexpr size_t InitialCapacity = 1 << 20;
+
+    explicit MessageReader(int fd = 0, size_t capacity = InitialCapacity);
+
+    MessageReader(const MessageReader&) = delete;
+    MessageReader& operator=(const MessageReader&) = delete;
+
+    /// @brief Read the next message
+    /// @return The message body, valid until the next call, or nullopt at the end of input
+    std::optional<std::string_view> next();
+
+private:
+    /// Read more input after what's buffered, making room first. False at the end of input.
+    bool fill();
+
+    int m_fd;
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_capacity;
+
+    /// Unconsumed input is [m_begin, m_end)
+    size_t m_begin = 0;
+    size_t m_end = 0;
+};
+
+} // namespace lsp
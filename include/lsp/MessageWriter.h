@@ -0,0 +1,82 @@
+//------------------------------------------------------------------------------
+// MessageWriter.h
+// Background writer for outgoing LSP messages
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace lsp {
+
+class SessionRecorder;
+
+/// Writes framed messages to a file descriptor from its own thread, so senders never wait on a
+/// slow client. Senders push onto a lock-free list; the writer takes everything queued at once
+/// and writes it with as few system calls as it can.
+///
+/// Messages may have a key, like a document URI for its diagnostics. When several queued
+/// messages share a key only the last one is written, since it supersedes the others. A
+/// recorder, if given, sees exactly the messages written.
+class MessageWriter {
+public:
+    explicit MessageWriter(int fd = 1, SessionRecorder* recorder = nullptr);
+    ~MessageWriter();
+
+    MessageWriter(const MessageWriter&) = delete;
+    MessageWriter& operator=(const MessageWriter&) = delete;
+
+    /// Queue a serialized message. Safe to call from any thread.
+    void push(std::string body, std::string key = {});
+
+    /// Wait until everything pushed so far has been written
+    void flush();
+
+private:
+    struct Node {
+        std::string body;
+        std::string key;
+        Node* next = nullptr;
+    };
+
+    void run();
+
+    /// Write a batch, oldest first, dropping messages superseded by a later one with its key
+    void write(std::vector<Node*>& batch);
+    void writeAll(std::vector<std::string_view>& pieces);
+
+    int m_fd;
+    SessionRecorder* m_recorder;
+
+    /// Most recently pushed first
+    std::atomic<Node*> m_head = nullptr;
+
+    /// Only used to sleep and wake the writer when there's nothing to write
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::atomic<bool> m_sleeping = false;
+    bool m_stopping = false;
+
+    /// Counts of messages pushed and written, for flush. A message is counted before it's
+    /// published, so the writer can never have written more than flush sees as pushed.
+    std::atomic<size_t> m_pushed = 0;
+    size_t m_written = 0;
+    std::condition_variable m_flushed;
+
+    std::thread m_thread;
+};
+
+/// The writer for stdout, which all outgoing messages go through
+MessageWriter& outputWriter();
+
+} // namespace lsp
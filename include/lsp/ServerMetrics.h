@@ -0,0 +1,137 @@
+//------------------------------------------------------------------------------
+// ServerMetrics.h
+// Per-method latency histograms and process statistics for the JSON-RPC server
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lsp {
+
+/// Counts of durations in log-linear buckets: each power of two is split into 8 buckets, so a
+/// percentile is off by at most 12.5% in a fixed amount of memory.
+class LatencyHistogram {
+public:
+    using Duration = std::chrono::microseconds;
+
+    void record(Duration duration);
+
+    /// The duration below which the given fraction (0-1) of recorded durations fall, reported
+    /// as the upper bound of its bucket but no more than the largest duration recorded
+    Duration percentile(double fraction) const;
+
+    uint64_t count() const { return m_count; }
+    Duration max() const { return Duration(m_max); }
+
+    static constexpr size_t SubBucketBits = 3;
+    static constexpr size_t NumBuckets = (64 - SubBucketBits + 1) << SubBucketBits;
+
+    static size_t bucketFor(uint64_t value);
+    /// The largest value in a bucket
+    static uint64_t bucketUpperBound(size_t bucket);
+
+private:
+    std::array<uint64_t, NumBuckets> m_buckets{};
+    uint64_t m_count = 0;
+    uint64_t m_max = 0;
+};
+
+/// Statistics for one method, in milliseconds
+struct MethodMetrics {
+    std::string method;
+    uint64_t count = 0;
+    /// Handlers that threw, including cancelled requests
+    uint64_t errors = 0;
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+    double max = 0;
+    /// Time between reading the message and starting to handle it
+    double queueP50 = 0;
+    double queueP95 = 0;
+    double queueP99 = 0;
+    /// Heap allocations made on the handling thread, if allocations are counted
+    std::optional<uint64_t> allocations;
+};
+
+/// The result of a `slang/metrics` request
+struct MetricsReport {
+    double uptimeSeconds = 0;
+    std::optional<uint64_t> peakRssBytes;
+    std::vector<MethodMetrics> methods;
+};
+
+/// Whether heap allocations are counted, which takes building with SLANG_SERVER_COUNT_ALLOCATIONS
+/// to replace the global operator new
+bool allocationsCounted();
+
+/// Heap allocations made by the calling thread so far, or zero if they aren't counted. Counts are
+/// per thread so that counting doesn't contend between threads.
+uint64_t threadAllocationCount();
+
+/// The peak resident set size of the process, if the platform reports it
+std::optional<uint64_t> peakRssBytes();
+
+/// Latency, queue wait and allocation statistics for each method the server handles. Recording
+/// is thread-safe, since requests are handled on more than one thread.
+class ServerMetrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Measures one message from when its handler starts until the scope ends
+    class Scope {
+    public:
+        Scope(ServerMetrics& metrics, std::string_view method, Clock::time_point received);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        /// Count the message as an error
+        void fail() { m_failed = true; }
+
+    private:
+        ServerMetrics& m_metrics;
+        std::string_view m_method;
+        Clock::time_point m_received;
+        Clock::time_point m_start;
+        uint64_t m_allocations;
+        bool m_failed = false;
+    };
+
+    /// Start measuring a message that was read at received
+    Scope measure(std::string_view method, Clock::time_point received) {
+        return Scope(*this, method, received);
+    }
+
+    void record(std::string_view method, LatencyHistogram::Duration queueWait,
+                LatencyHistogram::Duration latency, uint64_t allocations, bool failed);
+
+    MetricsReport report() const;
+
+private:
+    struct MethodStats {
+        LatencyHistogram latency;
+        LatencyHistogram queueWait;
+        uint64_t errors = 0;
+        uint64_t allocations = 0;
+    };
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, MethodStats, std::less<>> m_methods;
+    Clock::time_point m_started = Clock::now();
+};
+
+} // namespace lsp
@@ -0,0 +1,54 @@
+//------------------------------------------------------------------------------
+// SessionRecorder.h
+// Records the messages of an LSP session for replaying later
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace lsp {
+
+/// Appends each message the server reads or sends to a file, one JSON object per line:
+///
+///     {"t":<microseconds since recording started>,"dir":"in"|"out","msg":<message body>}
+///
+/// Bodies are copied as they are, except that line breaks, which can only be whitespace between
+/// JSON tokens, become spaces. `slang_server_replay` plays the incoming half back to a server.
+class SessionRecorder {
+public:
+    enum class Direction { In, Out };
+
+    SessionRecorder() = default;
+    ~SessionRecorder();
+
+    SessionRecorder(const SessionRecorder&) = delete;
+    SessionRecorder& operator=(const SessionRecorder&) = delete;
+
+    /// Start recording to path, replacing the file. False if it can't be opened.
+    bool open(const std::string& path);
+
+    bool isOpen() const { return m_file.load(std::memory_order_relaxed) != nullptr; }
+
+    /// Append a message body. Safe to call from any thread; does nothing unless open.
+    void record(Direction direction, std::string_view body);
+
+private:
+    std::atomic<FILE*> m_file = nullptr;
+    std::mutex m_mutex;
+    std::chrono::steady_clock::time_point m_started;
+    std::string m_line;
+};
+
+/// The recorder for the server's stdin and stdout, enabled by `--record`
+SessionRecorder& sessionRecorder();
+
+} // namespace lsp
@@ -0,0 +1,202 @@
+//------------------------------------------------------------------------------
+// ChunkedVector.h
+// Copy-on-write containers that share unchanged chunks between copies.
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace server {
+
+/// @brief A vector stored in fixed size chunks that copies share. Copying only copies the chunk
+/// pointers, and writing through a copy duplicates just the chunk written to, so a copy that's
+/// changed in a few places costs a few chunks rather than the whole vector. Elements that own
+/// memory, like posting lists, are shared the same way, so duplicating a chunk copies pointers
+/// to them and only the element written to is copied.
+///
+/// Elements are read with operator[] and written with edit(), so reads never duplicate a chunk.
+/// A chunk or element is never modified while another copy shares it, whichever copy writes, so
+/// a const copy can be read from one thread while another thread writes to a copy of it.
+template<typename T, size_t ChunkSize = 256>
+class ChunkedVector {
+    static constexpr bool SharedElements = !std::is_trivially_copyable_v<T>;
+    using Slot = std::conditional_t<SharedElements, std::shared_ptr<T>, T>;
+    using Chunk = std::vector<Slot>;
+
+public:
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const T& operator[](size_t i) const {
+        const auto& slot = (*m_chunks[i / ChunkSize])[i % ChunkSize];
+        if constexpr (SharedElements) {
+            static const T empty{};
+            return slot ? *slot : empty;
+        }
+        else {
+            return slot;
+        }
+    }
+
+    /// @brief A writable element, duplicating its chunk and the element first if another copy
+    /// shares them
+    T& edit(size_t i) {
+        auto& slot = own(i / ChunkSize)[i % ChunkSize];
+        if constexpr (SharedElements) {
+            if (!slot)
+                slot = std::make_shared<T>();
+            else if (!isUnique(slot))
+                slot = std::make_shared<T>(*slot);
+            return *slot;
+        }
+        else {
+            return slot;
+        }
+    }
+
+    void resize(size_t size) {
+        size_t chunks = (size + ChunkSize - 1) / ChunkSize;
+        if (size < m_size) {
+            // Reset the dropped tail of the last kept chunk, so growing again starts from T()
+            for (size_t i = size; i < std::min(m_size, chunks * ChunkSize); i++)
+                own(i / ChunkSize)[i % ChunkSize] = Slot();
+        }
+        size_t oldChunks = m_chunks.size();
+        m_chunks.resize(chunks);
+        for (size_t i = oldChunks; i < chunks; i++)
+            m_chunks[i] = std::make_shared<Chunk>(ChunkSize);
+        m_size = size;
+    }
+
+    void push_back(T value) {
+        resize(m_size + 1);
+        edit(m_size - 1) = std::move(value);
+    }
+
+    class const_iterator {
+    public:
+        using iterator_concept = std::forward_iterator_tag;
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+        const_iterator(const ChunkedVector* vec, size_t index) : m_vec(vec), m_index(index) {}
+
+        const T& operator*() const { return (*m_vec)[m_index]; }
+        const T* operator->() const { return &(*m_vec)[m_index]; }
+
+        const_iterator& operator++() {
+            m_index++;
+            return *this;
+        }
+        const_iterator operator++(int) {
+            auto result = *this;
+            m_index++;
+            return result;
+        }
+
+        bool operator==(const const_iterator& other) const { return m_index == other.m_index; }
+
+    private:
+        const ChunkedVector* m_vec = nullptr;
+        size_t m_index = 0;
+    };
+
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, m_size}; }
+
+private:
+    // Whether no other copy holds this chunk or element. Another copy can only let go of it
+    // concurrently, never take it, and the fence orders its last reads before our writes.
+    template<typename U>
+    static bool isUnique(const std::shared_ptr<U>& ptr) {
+        if (ptr.use_count() != 1)
+            return false;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+    Chunk& own(size_t chunk) {
+        if (!isUnique(m_chunks[chunk]))
+            m_chunks[chunk] = std::make_shared<Chunk>(*m_chunks[chunk]);
+        return *m_chunks[chunk];
+    }
+
+    std::vector<std::shared_ptr<Chunk>> m_chunks;
+    size_t m_size = 0;
+};
+
+/// @brief A hash map with the same sharing as ChunkedVector: its buckets are stored in one, so
+/// inserting into or editing a copy duplicates only the bucket the key hashes to, and the
+/// pointers in its chunk.
+/// Growing rehashes every entry, which keeps the cost of an insert amortized constant.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ChunkedMap {
+    using Bucket = std::vector<std::pair<Key, Value>>;
+
+public:
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    /// @brief The value for a key, or nullptr if there's none
+    const Value* find(const Key& key) const {
+        if (m_buckets.empty())
+            return nullptr;
+        for (const auto& [k, v] : m_buckets[bucketOf(key)]) {
+            if (k == key)
+                return &v;
+        }
+        return nullptr;
+    }
+
+    /// @brief A writable value for a key, inserting a default one if there's none
+    Value& edit(const Key& key) {
+        // Only an insert can grow the table; editing an existing key leaves the buckets in place
+        if (find(key)) {
+            for (auto& [k, v] : m_buckets.edit(bucketOf(key))) {
+                if (k == key)
+                    return v;
+            }
+        }
+
+        if (m_size >= m_buckets.size())
+            rehash(std::max(m_buckets.size() * 2, MinBuckets));
+        m_size++;
+        return m_buckets.edit(bucketOf(key)).emplace_back(key, Value()).second;
+    }
+
+private:
+    static constexpr size_t MinBuckets = 256;
+
+    size_t bucketOf(const Key& key) const { return Hash()(key) & (m_buckets.size() - 1); }
+
+    void rehash(size_t buckets) {
+        ChunkedVector<Bucket> old = std::move(m_buckets);
+        m_buckets = {};
+        m_buckets.resize(buckets);
+        for (const auto& bucket : old) {
+            for (const auto& entry : bucket)
+                m_buckets.edit(bucketOf(entry.first)).push_back(entry);
+        }
+    }
+
+    // A power of two in size, so a bucket is the low bits of the hash
+    ChunkedVector<Bucket> m_buckets;
+    size_t m_size = 0;
+};
+
+} // namespace server
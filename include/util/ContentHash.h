@@ -0,0 +1,22 @@
+//------------------------------------------------------------------------------
+// ContentHash.h
+// Fast, stable hashing of file contents.
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace server {
+
+/// @brief Hash a block of bytes with XXH64. Unlike std::hash, the result is stable across
+/// processes and builds, so it can be persisted (e.g. in the index cache).
+/// @param data The bytes to hash
+/// @param seed Optional seed
+/// @return The 64-bit hash
+uint64_t contentHash(std::string_view data, uint64_t seed = 0);
+
+} // namespace server
@@ -0,0 +1,65 @@
+//------------------------------------------------------------------------------
+// FileReader.h
+// Reads source files with as little copying as possible.
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+#include <system_error>
+
+namespace server {
+
+/// @brief Reads files for bulk processing like indexing. Large files are memory mapped, so the
+/// lexer scans the page cache directly; smaller ones are read with a single call into a buffer
+/// that's reused across files, since mapping them costs more than the copy saves. Either way the
+/// text ends with a null terminator (included in its size), as slang's lexer expects, and stays
+/// valid until the next read. One reader per thread.
+///
+/// A mapped file that's truncated by another process while its text is in use raises SIGBUS on
+/// the next access past the new end, which would take down the server. Files that are being
+/// written, e.g. by a checkout or a generator, are the ones likely to be truncated, so files
+/// modified in the last MapMinAge are always read, and a file whose size or modification time
+/// changes while it's being mapped is read instead. This narrows the window rather than closing
+/// it: a file that sat unchanged for MapMinAge and is then truncated mid-lex still faults.
+class FileReader {
+public:
+    /// Files at least this large are mapped, where supported
+    static constexpr size_t MapThreshold = 64 * 1024;
+
+    /// Files modified more recently than this are read rather than mapped
+    static constexpr std::chrono::seconds MapMinAge{10};
+
+    FileReader() = default;
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+    ~FileReader();
+
+    /// @brief Read a file, replacing the previous one
+    /// @return An error if the file couldn't be opened or read
+    std::error_code read(const std::filesystem::path& path);
+
+    /// @brief The contents of the last file read, followed by a null terminator
+    std::string_view getText() const { return m_text; }
+
+    /// @brief Whether the last file read was memory mapped (for testing)
+    bool isMapped() const { return m_mapping != nullptr; }
+
+private:
+    void unmap();
+    char* reserve(size_t size);
+
+    std::string_view m_text;
+    void* m_mapping = nullptr;
+    size_t m_mappingSize = 0;
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_capacity = 0;
+};
+
+} // namespace server
@@ -7,26 +7,98 @@
 //------------------------------------------------------------------------------
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <fmt/color.h>
 #include <fmt/format.h>
+#include <functional>
+#include <optional>
 #include <string>
+#include <string_view>
 
 #include "slang/text/SourceLocation.h"
 
+namespace server::logging {
+
+enum class Level : uint8_t { Debug, Info, Warn, Error, Off };
+
+/// Levels below this are compiled out entirely, e.g. -DSLANG_SERVER_MIN_LOG_LEVEL=1 for Info
+#ifndef SLANG_SERVER_MIN_LOG_LEVEL
+#    define SLANG_SERVER_MIN_LOG_LEVEL 0
+#endif
+inline constexpr Level MinCompiledLevel = Level(SLANG_SERVER_MIN_LOG_LEVEL);
+
+namespace detail {
+inline std::atomic<Level> level = Level::Info;
+} // namespace detail
+
+/// Whether messages at a level are written. The macros check this before formatting anything,
+/// so a disabled message costs one relaxed load.
+inline bool enabled(Level level) {
+    return level >= MinCompiledLevel && level >= detail::level.load(std::memory_order_relaxed);
+}
+
+inline void setLevel(Level level) {
+    detail::level.store(level, std::memory_order_relaxed);
+}
+
+inline Level getLevel() {
+    return detail::level.load(std::memory_order_relaxed);
+}
+
+/// Parse a level name: debug, info, warn, error or off
+std::optional<Level> parseLevel(std::string_view name);
+
+/// Queue a formatted message for the sink thread, which writes it to the output with its level
+/// prefix. Past the rate limit, messages below Error are dropped and counted, and the count is
+/// written when the second they were dropped in is over. Errors are never dropped, and don't
+/// return until they're written.
+void write(Level level, std::string_view message);
+
+/// Wait until everything queued so far has been written
+void flush();
+
+/// Write queued messages from std::terminate, before the previous handler ends the process
+void flushOnTerminate();
+
+/// Where messages are written; stderr by default. The file must outlive its use.
+void setOutput(FILE* file);
+
+/// Messages allowed per second before they're dropped; zero for no limit
+void setRateLimit(size_t messagesPerSecond);
+
+/// The clock the rate limit is measured with, so tests can step time; steady_clock if empty.
+/// Switching clocks starts a new second.
+void setClock(std::function<std::chrono::steady_clock::time_point()> now);
+
+} // namespace server::logging
+
+#define SLANG_LOG(level, format_string, ...)                                                 \
+    do {                                                                                     \
+        if (::server::logging::enabled(level)) {                                             \
+            ::server::logging::write(level,                                                  \
+                                     fmt::format(format_string __VA_OPT__(, ) __VA_ARGS__)); \
+        }                                                                                    \
+    } while (false)
+
+/// For messages on every request or keystroke, which are off unless asked for
+#define LOG_DEBUG(format_string, ...) \
+    SLANG_LOG(::server::logging::Level::Debug, format_string __VA_OPT__(, ) __VA_ARGS__)
+
 #define INFO(format_string, ...) \
-    fmt::print(stderr, "INFO: {}\n", fmt::format(format_string __VA_OPT__(, ) __VA_ARGS__));
+    SLANG_LOG(::server::logging::Level::Info, format_string __VA_OPT__(, ) __VA_ARGS__)
 
 #define WARN(format_string, ...) \
-    fmt::print(stderr, "WARN: {}\n", fmt::format(format_string __VA_OPT__(, ) __VA_ARGS__));
+    SLANG_LOG(::server::logging::Level::Warn, format_string __VA_OPT__(, ) __VA_ARGS__)
 
 #define ERROR(format_string, ...) \
-    fmt::print(stderr, "ERROR: {}\n", fmt::format(format_string __VA_OPT__(, ) __VA_ARGS__));
+    SLANG_LOG(::server::logging::Level::Error, format_string __VA_OPT__(, ) __VA_ARGS__)
 
-#define RFL_INFO(some_struct)                                      \
-    fmt::print(stderr, "{}\n",                                     \
-               rfl::json::write<rfl::UnderlyingEnums>(some_struct, \
-                                                      YYJSON_WRITE_PRETTY_TWO_SPACES));
+#define RFL_INFO(some_struct)                                                                   \
+    SLANG_LOG(::server::logging::Level::Info, "{}",                                             \
+              rfl::json::write<rfl::UnderlyingEnums>(some_struct, YYJSON_WRITE_PRETTY_TWO_SPACES))
 
 class ScopedTimer {
 public:
@@ -0,0 +1,42 @@
+//------------------------------------------------------------------------------
+// StringPool.h
+// Append-only arena for interned strings.
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace server {
+
+/// @brief Owns copies of strings in large chunks, so many small strings don't each pay for a
+/// heap allocation. Strings are never freed or moved, so views handed out stay valid for the
+/// lifetime of the pool. Deduplication is up to the caller.
+class StringPool {
+public:
+    StringPool() = default;
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    /// @brief Copy a string into the pool
+    /// @return A view of the copy, valid for the lifetime of the pool
+    std::string_view add(std::string_view str);
+
+    /// @brief Bytes allocated for string storage
+    size_t getMemoryUsage() const { return m_allocated; }
+
+private:
+    static constexpr size_t ChunkSize = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    char* m_cur = nullptr;
+    char* m_end = nullptr;
+    size_t m_allocated = 0;
+};
+
+} // namespace server
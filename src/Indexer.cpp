@@ -9,13 +9,28 @@
 #include "Indexer.h"
 
 #include "Config.h"
+#include "util/ContentHash.h"
+#include "util/FileReader.h"
 #include "util/Logging.h"
 #include <BS_thread_pool.hpp>
+#include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <filesystem>
 #include <fmt/format.h>
+#include <rfl/json.hpp>
 #include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+
+#ifndef _WIN32
+#    include <dirent.h>
+#    include <sys/stat.h>
+#endif
 
 #include "slang/driver/SourceLoader.h"
 #include "slang/parsing/Parser.h"
@@ -30,10 +45,271 @@
 #include "slang/util/Bag.h"
 #include "slang/util/OS.h"
 #include "slang/util/SmallMap.h"
+#include "slang/util/TimeTrace.h"
 #include "slang/util/Util.h"
+#include "slang/util/VersionInfo.h"
 
 namespace fs = std::filesystem;
 
+namespace {
+
+// Bump when the cache layout or the extraction rules change
+constexpr int IndexCacheFormat = 1;
+
+// On-disk representation of the index cache; kinds are stored as their integer value
+struct CachedSymbol {
+    std::string name;
+    int kind;
+};
+
+struct CachedFile {
+    std::string path;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+    std::vector<CachedSymbol> symbols;
+    std::vector<std::string> macros;
+    std::vector<std::string> references;
+};
+
+struct IndexCache {
+    std::string version;
+    std::vector<CachedFile> files;
+};
+
+// Entries depend on how they were extracted, so the mode is part of the version
+std::string indexCacheVersion(Indexer::ExtractMode mode) {
+    return fmt::format("{}+{}+{}", IndexCacheFormat, slang::VersionInfo::getHash(),
+                       mode == Indexer::ExtractMode::Scan ? "scan" : "parse");
+}
+
+struct FileStat {
+    uint64_t size;
+    int64_t mtime;
+};
+
+std::optional<FileStat> statFile(const fs::path& path) {
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (ec)
+        return std::nullopt;
+    auto mtime = fs::last_write_time(path, ec);
+    if (ec)
+        return std::nullopt;
+    return FileStat{.size = size, .mtime = int64_t(mtime.time_since_epoch().count())};
+}
+
+using slang::parsing::Token;
+using slang::parsing::TokenKind;
+
+std::optional<slang::syntax::SyntaxKind> designUnitKind(TokenKind kind) {
+    using slang::syntax::SyntaxKind;
+    switch (kind) {
+        case TokenKind::ModuleKeyword:
+        case TokenKind::MacromoduleKeyword:
+            return SyntaxKind::ModuleDeclaration;
+        case TokenKind::InterfaceKeyword:
+            return SyntaxKind::InterfaceDeclaration;
+        case TokenKind::ProgramKeyword:
+            return SyntaxKind::ProgramDeclaration;
+        case TokenKind::PackageKeyword:
+            return SyntaxKind::PackageDeclaration;
+        default:
+            return std::nullopt;
+    }
+}
+
+bool isDesignUnitEnd(TokenKind kind) {
+    return kind == TokenKind::EndModuleKeyword || kind == TokenKind::EndInterfaceKeyword ||
+           kind == TokenKind::EndProgramKeyword || kind == TokenKind::EndPackageKeyword;
+}
+
+// Returns the index just past the bracketed group opening at tokens[i]
+size_t skipGroup(std::span<const Token> tokens, size_t i) {
+    auto open = tokens[i].kind;
+    auto close = open == TokenKind::OpenParenthesis ? TokenKind::CloseParenthesis
+                 : open == TokenKind::OpenBracket   ? TokenKind::CloseBracket
+                                                    : TokenKind::CloseBrace;
+    size_t depth = 0;
+    for (; i < tokens.size(); i++) {
+        if (tokens[i].kind == open)
+            depth++;
+        else if (tokens[i].kind == close && --depth == 0)
+            return i + 1;
+    }
+    return i;
+}
+
+TokenKind kindAt(std::span<const Token> tokens, size_t i) {
+    return i < tokens.size() ? tokens[i].kind : TokenKind::EndOfFile;
+}
+
+// Matches `type [#(params)] name [dims] (` starting at the type identifier
+bool isInstantiation(std::span<const Token> tokens, size_t i) {
+    if (i > 0) {
+        switch (tokens[i - 1].kind) {
+            // Return types of functions and tasks, and scoped or hierarchical names
+            case TokenKind::FunctionKeyword:
+            case TokenKind::TaskKeyword:
+            case TokenKind::StaticKeyword:
+            case TokenKind::AutomaticKeyword:
+            case TokenKind::DoubleColon:
+            case TokenKind::Dot:
+                return false;
+            default:
+                break;
+        }
+    }
+
+    size_t j = i + 1;
+    if (kindAt(tokens, j) == TokenKind::Hash) {
+        j++;
+        j = kindAt(tokens, j) == TokenKind::OpenParenthesis ? skipGroup(tokens, j) : j + 1;
+    }
+    if (kindAt(tokens, j) != TokenKind::Identifier)
+        return false;
+    j++;
+    while (kindAt(tokens, j) == TokenKind::OpenBracket)
+        j = skipGroup(tokens, j);
+    return kindAt(tokens, j) == TokenKind::OpenParenthesis;
+}
+
+// Walks a design unit header (package imports, parameter ports, then ports) and reports the
+// interface types of interface ports, i.e. ANSI ports written as `intf name` or `intf.mp name`
+template<typename F>
+void visitInterfacePorts(std::span<const Token> tokens, size_t i, F&& visit) {
+    for (; i < tokens.size(); i++) {
+        switch (tokens[i].kind) {
+            case TokenKind::ImportKeyword:
+                while (kindAt(tokens, i) != TokenKind::Semicolon &&
+                       kindAt(tokens, i) != TokenKind::EndOfFile)
+                    i++;
+                break;
+            case TokenKind::Hash:
+                if (kindAt(tokens, i + 1) == TokenKind::OpenParenthesis)
+                    i = skipGroup(tokens, i + 1) - 1;
+                break;
+            case TokenKind::OpenParenthesis: {
+                size_t end = skipGroup(tokens, i);
+                size_t depth = 0;
+                bool portStart = true;
+                for (size_t k = i + 1; k + 1 < end; k++) {
+                    auto kind = tokens[k].kind;
+                    if (depth == 0 && portStart) {
+                        if (kind == TokenKind::OpenParenthesisStar) {
+                            while (k + 1 < end && tokens[k].kind != TokenKind::StarCloseParenthesis)
+                                k++;
+                            continue;
+                        }
+                        portStart = false;
+                        auto next = kindAt(tokens, k + 1);
+                        if (kind == TokenKind::Identifier &&
+                            (next == TokenKind::Dot || next == TokenKind::Identifier))
+                            visit(tokens[k].valueText());
+                    }
+
+                    if (kind == TokenKind::OpenParenthesis || kind == TokenKind::OpenBracket ||
+                        kind == TokenKind::OpenBrace)
+                        depth++;
+                    else if (kind == TokenKind::CloseParenthesis ||
+                             kind == TokenKind::CloseBracket || kind == TokenKind::CloseBrace)
+                        depth--;
+                    else if (depth == 0 && kind == TokenKind::Comma)
+                        portStart = true;
+                }
+                return;
+            }
+            case TokenKind::Semicolon:
+            case TokenKind::EndOfFile:
+                return;
+            default:
+                break;
+        }
+    }
+}
+
+char foldCase(char c) {
+    return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+
+// One bit per letter (ignoring case), digit, '_' and '$'; anything else shares a bit
+uint64_t charMask(std::string_view str) {
+    uint64_t mask = 0;
+    for (char c : str) {
+        c = foldCase(c);
+        if (c >= 'a' && c <= 'z')
+            mask |= 1ull << (c - 'a');
+        else if (c >= '0' && c <= '9')
+            mask |= 1ull << (26 + c - '0');
+        else if (c == '_')
+            mask |= 1ull << 36;
+        else if (c == '$')
+            mask |= 1ull << 37;
+        else
+            mask |= 1ull << 38;
+    }
+    return mask;
+}
+
+uint32_t trigramKey(const char* p) {
+    return uint32_t(static_cast<unsigned char>(foldCase(p[0]))) << 16 |
+           uint32_t(static_cast<unsigned char>(foldCase(p[1]))) << 8 |
+           uint32_t(static_cast<unsigned char>(foldCase(p[2])));
+}
+
+// Whether the query's characters appear in the candidate in order, ignoring case
+bool fuzzyMatch(std::string_view query, std::string_view candidate) {
+    auto qi = query.begin();
+    for (auto ci = candidate.begin(); qi != query.end() && ci != candidate.end(); ++ci) {
+        if (foldCase(*qi) == foldCase(*ci))
+            ++qi;
+    }
+    return qi == query.end();
+}
+
+// Where the query first occurs in the name, ignoring case
+size_t findIgnoreCase(std::string_view name, std::string_view query) {
+    if (query.empty())
+        return 0;
+    auto found = std::ranges::search(name, query,
+                                     [](char a, char b) { return foldCase(a) == foldCase(b); });
+    return found.empty() ? std::string_view::npos : size_t(found.begin() - name.begin());
+}
+
+// Sort key for symbol search results, best first
+struct RankedName {
+    // 0: exact, 1: prefix, 2: contains the query, 3: contains its characters in order
+    uint32_t tier;
+    size_t position;
+    size_t length;
+    std::string_view name;
+    uint32_t id;
+
+    auto operator<=>(const RankedName&) const = default;
+};
+
+RankedName rankName(std::string_view name, std::string_view query, uint32_t id) {
+    RankedName result{.tier = 3, .position = 0, .length = name.size(), .name = name, .id = id};
+    auto pos = findIgnoreCase(name, query);
+    if (pos == 0)
+        result.tier = name.size() == query.size() ? 0 : 1;
+    else if (pos != std::string_view::npos) {
+        result.tier = 2;
+        result.position = pos;
+    }
+    return result;
+}
+
+// The postings for a name id, growing the table to fit it
+template<typename T>
+T& postingsFor(server::ChunkedVector<T>& postings, uint32_t id) {
+    if (postings.size() <= id)
+        postings.resize(id + 1);
+    return postings.edit(id);
+}
+
+} // namespace
+
 void Indexer::extractFromRoot(const slang::syntax::CompilationUnitSyntax& root,
                               const slang::parsing::ParserMetadata& meta, IndexedPath& dest) {
     using namespace slang::syntax;
@@ -50,13 +326,108 @@ void Indexer::extractFromRoot(const slang::syntax::CompilationUnitSyntax& root,
     }
 
     // Extract referenced symbols from metadata
+    // A generic `interface` port is reported by its keyword, but doesn't name anything
     slang::SmallSet<std::string_view, 8> seenDeps;
     meta.visitReferencedSymbols([&](std::string_view name) {
-        if (seenDeps.insert(name).second)
+        if (name != "interface" && seenDeps.insert(name).second)
             dest.referencedSymbols.push_back(std::string{name});
     });
 }
 
+Indexer::ScanResult Indexer::extractFromTokens(std::span<const Token> tokens, IndexedPath& dest) {
+    ScanResult result;
+
+    // References are the same set the parser's metadata reports: instantiated design units,
+    // interface port types, and the leftmost name of any `a::b` scope
+    slang::SmallSet<std::string_view, 8> seenDeps;
+    auto addReference = [&](std::string_view name) {
+        if (!name.empty() && seenDeps.insert(name).second)
+            dest.referencedSymbols.push_back(std::string{name});
+    };
+
+    // Names of nested design units visible from each open unit; instantiating one of those isn't
+    // a reference to a global symbol
+    std::vector<std::vector<std::string_view>> nestedUnits;
+    auto isNestedUnit = [&](std::string_view name) {
+        return std::ranges::any_of(nestedUnits, [&](const auto& names) {
+            return std::ranges::find(names, name) != names.end();
+        });
+    };
+
+    size_t parenDepth = 0;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        const auto& token = tokens[i];
+        auto prev = i > 0 ? tokens[i - 1].kind : TokenKind::Unknown;
+        switch (token.kind) {
+            case TokenKind::OpenParenthesis:
+                parenDepth++;
+                break;
+            case TokenKind::CloseParenthesis:
+                if (parenDepth > 0)
+                    parenDepth--;
+                break;
+            case TokenKind::ClassKeyword:
+                if (prev != TokenKind::TypedefKeyword)
+                    result.hasClasses = true;
+                break;
+            case TokenKind::Identifier:
+                if (kindAt(tokens, i + 1) == TokenKind::DoubleColon) {
+                    if (prev != TokenKind::DoubleColon)
+                        addReference(token.valueText());
+                }
+                else if (isInstantiation(tokens, i) && !isNestedUnit(token.valueText())) {
+                    addReference(token.valueText());
+                }
+                break;
+            default:
+                if (isDesignUnitEnd(token.kind)) {
+                    if (!nestedUnits.empty())
+                        nestedUnits.pop_back();
+                    break;
+                }
+
+                auto unitKind = designUnitKind(token.kind);
+                if (!unitKind || parenDepth > 0)
+                    break;
+                // Not declarations: `virtual interface` types and interface classes
+                if (token.kind == TokenKind::InterfaceKeyword &&
+                    (prev == TokenKind::VirtualKeyword ||
+                     kindAt(tokens, i + 1) == TokenKind::ClassKeyword))
+                    break;
+
+                size_t nameIndex = i + 1;
+                if (kindAt(tokens, nameIndex) == TokenKind::StaticKeyword ||
+                    kindAt(tokens, nameIndex) == TokenKind::AutomaticKeyword)
+                    nameIndex++;
+                std::string_view name = kindAt(tokens, nameIndex) == TokenKind::Identifier
+                                            ? tokens[nameIndex].valueText()
+                                            : std::string_view{};
+
+                visitInterfacePorts(tokens, nameIndex, addReference);
+
+                // Extern declarations have no body and don't define anything
+                if (prev == TokenKind::ExternKeyword)
+                    break;
+
+                result.hasDesignUnits = true;
+                if (nestedUnits.empty()) {
+                    if (!name.empty())
+                        dest.symbols.push_back(GlobalSymbol{.name = std::string(name),
+                                                            .kind = *unitKind});
+                }
+                else if (!name.empty()) {
+                    nestedUnits.back().push_back(name);
+                }
+                nestedUnits.emplace_back();
+                break;
+        }
+    }
+
+    if (!result.hasDesignUnits)
+        dest.referencedSymbols.clear();
+    return result;
+}
+
 template<typename MacroRange>
 void Indexer::extractMacros(const MacroRange& macros, IndexedPath& dest) {
     for (const auto* macro : macros) {
@@ -71,10 +442,13 @@ void Indexer::extractMacros(const MacroRange& macros, IndexedPath& dest) {
     }
 }
 
-std::vector<Indexer::IndexedPath> Indexer::indexPaths(const std::vector<fs::path>& paths) const {
+std::vector<Indexer::IndexedPath> Indexer::indexPaths(const std::vector<fs::path>& paths,
+                                                      std::span<const uint64_t> knownHashes) const {
     using namespace slang;
     using namespace parsing;
 
+    TimeTraceScope timeScope("indexFiles", std::to_string(paths.size()));
+
     uint32_t numThreads = numThreads_;
     if (paths.size() < MinFilesForThreading) {
         numThreads = 1;
@@ -85,26 +459,56 @@ std::vector<Indexer::IndexedPath> Indexer::indexPaths(const std::vector<fs::path
 
     // Lambda that processes a range of files
     // Creates its own SourceManager and options to avoid contention when threaded
-    auto processRange = [&loadResults, &paths](size_t start, size_t end) {
+    auto processRange = [&loadResults, &paths, &knownHashes, mode = extractMode_](size_t start,
+                                                                                 size_t end) {
         SourceManager sourceManager;
         Bag options;
         options.set(PreprocessorOptions{.maxIncludeDepth = 0});
 
-        SmallVector<char> bufferData;
+        // Large files are mapped and lexed in place rather than copied
+        server::FileReader reader;
         for (size_t i = start; i < end; i++) {
             auto& dest = loadResults[i];
-            bufferData.clear();
-            if (std::error_code ec = OS::readFile(paths[i], bufferData)) {
+            // Stat before reading, so a write racing with us makes the entry look stale
+            if (auto stat = statFile(paths[i])) {
+                dest.fileSize = stat->size;
+                dest.mtime = stat->mtime;
+            }
+
+            if (std::error_code ec = reader.read(paths[i])) {
+                continue;
+            }
+
+            auto text = reader.getText();
+            dest.contentHash = server::contentHash(text);
+            if (i < knownHashes.size() && knownHashes[i] == dest.contentHash) {
+                dest.unchanged = true;
                 continue;
             }
 
-            SourceBuffer buffer{.data = std::string_view(bufferData.data(), bufferData.size()),
-                                .id = BufferID::getPlaceholder()};
+            SourceBuffer buffer{.data = text, .id = BufferID::getPlaceholder()};
 
             BumpAllocator alloc;
             Diagnostics diagnostics;
             Preprocessor preprocessor(sourceManager, alloc, diagnostics, options, {});
             preprocessor.pushSource(buffer);
+
+            if (mode == ExtractMode::Scan) {
+                // The preprocessor still handles conditional directives and macro expansion, so
+                // the scanner sees exactly the tokens the parser would
+                SmallVector<Token> tokens;
+                while (true) {
+                    tokens.push_back(preprocessor.next());
+                    if (tokens.back().kind == TokenKind::EndOfFile)
+                        break;
+                }
+
+                auto scan = extractFromTokens(tokens, dest);
+                if (!scan.hasDesignUnits && !scan.hasClasses)
+                    extractMacros(preprocessor.getDefinedMacros(), dest);
+                continue;
+            }
+
             Parser parser(preprocessor, options);
 
             auto& root = parser.parseCompilationUnit();
@@ -135,60 +539,64 @@ std::vector<Indexer::IndexedPath> Indexer::indexPaths(const std::vector<fs::path
 
 Indexer::Indexer() = default;
 
-const fs::path* Indexer::internUri(const fs::path& path) {
-    auto [it, inserted] = uniqueUris_.insert(path);
-    return &(*it);
+std::shared_ptr<const Indexer::IndexData> Indexer::snapshot() const {
+    std::lock_guard lock(snapshotMutex_);
+    return snapshot_;
 }
 
-void Indexer::updateDocument(const fs::path& path, const slang::syntax::SyntaxTree& tree) {
-    IndexWriteGuard guard(*this);
+Indexer::FileId Indexer::internFile(IndexData& data, const fs::path& path) {
+    auto [it, inserted] = fileIds_.try_emplace(path, FileId(fileIds_.size()));
+    FileId file = it->second;
+    if (data.files.size() <= file) {
+        data.files.resize(file + 1);
+        data.indexedFiles.resize(file + 1);
+    }
+    data.files.edit(file) = &it->first;
+    return file;
+}
 
-    // Intern the URI once for all operations
-    const fs::path* uriPtr = internUri(path);
-
-    // Remove old entries if this file was previously indexed
-    auto it = indexedFiles.find(uriPtr);
-    if (it != indexedFiles.end()) {
-        const IndexedPath& oldPath = it->second;
-
-        for (const auto& oldItem : oldPath.symbols) {
-            auto mapIt = symbolToFiles_.find(oldItem.name);
-            if (mapIt != symbolToFiles_.end()) {
-                auto& vec = mapIt->second;
-                vec.erase(std::remove_if(vec.begin(), vec.end(),
-                                         [&](const GlobalSymbolLoc& loc) {
-                                             return loc.uri == uriPtr && loc.kind == oldItem.kind;
-                                         }),
-                          vec.end());
-                if (vec.empty())
-                    symbolToFiles_.erase(mapIt);
-            }
-        }
+Indexer::NameId Indexer::internName(IndexData& data, std::string_view name) {
+    if (auto id = data.nameIds.find(name))
+        return *id;
 
-        for (const auto& oldMacro : oldPath.macros) {
-            auto mapIt = macroToFiles_.find(oldMacro);
-            if (mapIt != macroToFiles_.end()) {
-                auto& vec = mapIt->second;
-                vec.erase(std::remove(vec.begin(), vec.end(), uriPtr), vec.end());
-                if (vec.empty())
-                    macroToFiles_.erase(mapIt);
-            }
-        }
+    auto stored = namePool_.add(name);
+    NameId id = NameId(data.names.size());
+    data.names.push_back(stored);
+    data.nameIds.edit(stored) = id;
+    return id;
+}
 
-        for (const auto& oldRef : oldPath.referencedSymbols) {
-            auto mapIt = symbolReferences_.find(oldRef);
-            if (mapIt != symbolReferences_.end()) {
-                auto& vec = mapIt->second;
-                vec.erase(std::remove(vec.begin(), vec.end(), uriPtr), vec.end());
-                if (vec.empty())
-                    symbolReferences_.erase(mapIt);
-            }
-        }
-    }
+void Indexer::addSymbolName(IndexData& data, NameId id) {
+    auto name = data.names[id];
+    postingsFor(data.symbolCharMasks, id) = charMask(name);
+
+    std::vector<uint32_t> keys;
+    for (size_t i = 0; i + 3 <= name.size(); i++)
+        keys.push_back(trigramKey(name.data() + i));
+    std::ranges::sort(keys);
+    keys.erase(std::ranges::unique(keys).begin(), keys.end());
+    for (auto key : keys)
+        data.symbolTrigrams.edit(key).push_back(id);
+}
+
+Indexer::IndexedPath Indexer::toIndexedPath(const IndexData& data, const IndexedFile& file) {
+    IndexedPath result;
+    result.fileSize = file.fileSize;
+    result.mtime = file.mtime;
+    result.contentHash = file.contentHash;
+    for (const auto& sym : file.symbols)
+        result.symbols.push_back(GlobalSymbol{.name = std::string(data.names[sym.name]),
+                                              .kind = sym.kind});
+    for (auto name : file.macros)
+        result.macros.emplace_back(data.names[name]);
+    for (auto name : file.referencedSymbols)
+        result.referencedSymbols.emplace_back(data.names[name]);
+    return result;
+}
 
+void Indexer::updateDocument(const fs::path& path, const slang::syntax::SyntaxTree& tree) {
     // Extract new data
     IndexedPath newPath;
-    newPath.path = uriPtr;
     extractFromRoot(tree.root().as<slang::syntax::CompilationUnitSyntax>(), tree.getMetadata(),
                     newPath);
 
@@ -197,93 +605,374 @@ void Indexer::updateDocument(const fs::path& path, const slang::syntax::SyntaxTr
         extractMacros(tree.getDefinedMacros(), newPath);
     }
 
-    // Add all new entries to the global index
-    for (const auto& newItem : newPath.symbols)
-        symbolToFiles_[newItem.name].push_back(
-            GlobalSymbolLoc{.uri = uriPtr, .kind = newItem.kind});
+    // The document was just saved, so its buffer is what's on disk. Recording the stats and hash
+    // lets the cache trust this entry on the next startup, and lets a later change event that
+    // doesn't change the contents skip parsing.
+    if (auto stat = statFile(path)) {
+        newPath.fileSize = stat->size;
+        newPath.mtime = stat->mtime;
+    }
+    if (auto buffers = tree.getSourceBufferIds(); !buffers.empty())
+        newPath.contentHash = server::contentHash(tree.sourceManager().getSourceText(buffers[0]));
+
+    // Replaces any old entries if this file was previously indexed
+    IndexWriteGuard guard(*this);
+    indexPath(*guard.data, path, newPath);
+}
+
+void Indexer::indexPath(IndexData& data, const fs::path& path, const IndexedPath& indexedPath) {
+    FileId file = internFile(data, path);
+
+    // Drop entries from a previous index of this path (e.g. on config reload)
+    removePathFromIndex(data, file);
 
-    for (const auto& newMacro : newPath.macros)
-        macroToFiles_[newMacro].push_back(uriPtr);
+    auto entry = std::make_shared<IndexedFile>();
+    entry->fileSize = indexedPath.fileSize;
+    entry->mtime = indexedPath.mtime;
+    entry->contentHash = indexedPath.contentHash;
 
-    for (const auto& newRef : newPath.referencedSymbols)
-        symbolReferences_[newRef].push_back(uriPtr);
+    entry->symbols.reserve(indexedPath.symbols.size());
+    for (const auto& item : indexedPath.symbols) {
+        NameId name = internName(data, item.name);
+        entry->symbols.push_back({name, item.kind});
+        postingsFor(data.symbolToFiles, name).push_back(SymbolPosting{file, item.kind});
+        if (name >= data.symbolCharMasks.size() || !data.symbolCharMasks[name])
+            addSymbolName(data, name);
+    }
+
+    entry->macros.reserve(indexedPath.macros.size());
+    for (const auto& macro : indexedPath.macros) {
+        NameId name = internName(data, macro);
+        entry->macros.push_back(name);
+        postingsFor(data.macroToFiles, name).push_back(file);
+    }
 
-    // Store the new indexed path
-    indexedFiles[uriPtr] = std::move(newPath);
+    entry->referencedSymbols.reserve(indexedPath.referencedSymbols.size());
+    for (const auto& ref : indexedPath.referencedSymbols) {
+        NameId name = internName(data, ref);
+        entry->referencedSymbols.push_back(name);
+        postingsFor(data.symbolReferences, name).push_back(file);
+    }
+
+    // Store the interned entry for efficient removal later
+    data.indexedFiles.edit(file) = std::move(entry);
 }
 
-void Indexer::indexPath(const fs::path& path, IndexedPath& indexedFile) {
-    const fs::path* uriPtr = internUri(path);
-    indexedFile.path = uriPtr;
+void Indexer::addDocuments(IndexData& data, const std::vector<fs::path>& paths) {
+    auto indexedPaths = indexPaths(paths);
+    for (size_t i = 0; i < indexedPaths.size(); ++i)
+        indexPath(data, paths[i], indexedPaths[i]);
+}
 
-    for (const auto& item : indexedFile.symbols)
-        symbolToFiles_[item.name].push_back(GlobalSymbolLoc{.uri = uriPtr, .kind = item.kind});
+size_t Indexer::updateDocuments(IndexData& data, const std::vector<FileId>& files) {
+    std::vector<fs::path> paths;
+    std::vector<uint64_t> knownHashes;
+    paths.reserve(files.size());
+    knownHashes.reserve(files.size());
+    for (auto file : files) {
+        paths.push_back(*data.files[file]);
+        knownHashes.push_back(data.indexedFiles[file]->contentHash);
+    }
 
-    for (const auto& name : indexedFile.macros)
-        macroToFiles_[name].push_back(uriPtr);
+    size_t skipped = 0;
+    auto indexedPaths = indexPaths(paths, knownHashes);
+    for (size_t i = 0; i < indexedPaths.size(); ++i) {
+        const auto& indexed = indexedPaths[i];
+        const auto& previous = *data.indexedFiles[files[i]];
+        if (indexed.unchanged) {
+            updateStats_.unchangedContent++;
+        }
+        else if (hasSameNames(data, previous, indexed)) {
+            updateStats_.unchangedNames++;
+        }
+        else {
+            updateStats_.reindexed++;
+            indexPath(data, paths[i], indexed);
+            continue;
+        }
 
-    for (const auto& ref : indexedFile.referencedSymbols)
-        symbolReferences_[ref].push_back(uriPtr);
+        // Only the stats (and maybe the hash) moved, so the postings stay as they are
+        auto entry = std::make_shared<IndexedFile>(previous);
+        entry->fileSize = indexed.fileSize;
+        entry->mtime = indexed.mtime;
+        entry->contentHash = indexed.contentHash;
+        data.indexedFiles.edit(files[i]) = std::move(entry);
+        skipped++;
+    }
+    return skipped;
+}
 
-    // Store the indexed path for efficient removal later
-    indexedFiles[uriPtr] = std::move(indexedFile);
+bool Indexer::hasSameNames(const IndexData& data, const IndexedFile& file,
+                           const IndexedPath& indexedPath) {
+    auto sameIds = [&](const std::vector<NameId>& ids, const auto& names) {
+        return std::ranges::equal(ids, names, [&](NameId id, const std::string& name) {
+            return data.names[id] == name;
+        });
+    };
+    return std::ranges::equal(file.symbols, indexedPath.symbols,
+                              [&](const IndexedFile::Symbol& symbol, const GlobalSymbol& other) {
+                                  return symbol.kind == other.kind &&
+                                         data.names[symbol.name] == other.name;
+                              }) &&
+           sameIds(file.macros, indexedPath.macros) &&
+           sameIds(file.referencedSymbols, indexedPath.referencedSymbols);
 }
 
 void Indexer::addDocuments(const std::vector<fs::path>& paths) {
     IndexWriteGuard guard(*this);
+    addDocuments(*guard.data, paths);
+}
 
-    auto indexedPaths = indexPaths(paths);
-    for (size_t i = 0; i < indexedPaths.size(); ++i)
-        indexPath(paths[i], indexedPaths[i]);
+std::unordered_map<std::string, Indexer::IndexedPath> Indexer::loadCache() const {
+    std::unordered_map<std::string, IndexedPath> result;
+    if (!cacheFile_ || !fs::exists(*cacheFile_))
+        return result;
+
+    ScopedTimer t_load(fmt::format("Loading index cache {}", cacheFile_->string()));
+
+    slang::SmallVector<char> data;
+    if (std::error_code ec = slang::OS::readFile(*cacheFile_, data)) {
+        WARN("Failed to read index cache {}: {}", cacheFile_->string(), ec.message());
+        return result;
+    }
+
+    // readFile null terminates the buffer
+    auto json = std::string_view(data.data(), data.size());
+    if (!json.empty() && json.back() == '\0')
+        json.remove_suffix(1);
+
+    auto cache = rfl::json::read<IndexCache>(json);
+    if (!cache) {
+        WARN("Ignoring unreadable index cache {}: {}", cacheFile_->string(),
+             cache.error().what());
+        return result;
+    }
+    if (cache->version != indexCacheVersion(extractMode_)) {
+        INFO("Ignoring index cache from version {}", cache->version);
+        return result;
+    }
+
+    result.reserve(cache->files.size());
+    for (auto& file : cache->files) {
+        IndexedPath entry;
+        entry.fileSize = file.size;
+        entry.mtime = file.mtime;
+        entry.contentHash = file.hash;
+        for (auto& sym : file.symbols)
+            entry.symbols.push_back(GlobalSymbol{.name = std::move(sym.name),
+                                                 .kind = slang::syntax::SyntaxKind(sym.kind)});
+        for (auto& macro : file.macros)
+            entry.macros.push_back(std::move(macro));
+        for (auto& ref : file.references)
+            entry.referencedSymbols.push_back(std::move(ref));
+        result.emplace(std::move(file.path), std::move(entry));
+    }
+    return result;
 }
 
-void Indexer::removePathFromIndex(const fs::path* pathPtr) {
-    // Look up the stored IndexedPath for targeted removal of symbols
-    auto it = indexedFiles.find(pathPtr);
-    if (it == indexedFiles.end())
+void Indexer::saveCache() const {
+    if (!cacheFile_)
         return;
 
-    const IndexedPath& entry = it->second;
+    ScopedTimer t_save(fmt::format("Saving index cache {}", cacheFile_->string()));
+
+    IndexCache cache{.version = indexCacheVersion(extractMode_), .files = {}};
+    {
+        auto index = snapshot();
+        cache.files.reserve(index->indexedFiles.size());
+        for (FileId id = 0; id < index->indexedFiles.size(); id++) {
+            if (!index->indexedFiles[id])
+                continue;
+            auto entry = toIndexedPath(*index, *index->indexedFiles[id]);
+            CachedFile file{.path = index->files[id]->string(),
+                            .size = entry.fileSize,
+                            .mtime = entry.mtime,
+                            .hash = entry.contentHash,
+                            .symbols = {},
+                            .macros = std::vector<std::string>(entry.macros.begin(),
+                                                               entry.macros.end()),
+                            .references = std::vector<std::string>(
+                                entry.referencedSymbols.begin(), entry.referencedSymbols.end())};
+            file.symbols.reserve(entry.symbols.size());
+            for (const auto& sym : entry.symbols)
+                file.symbols.push_back(CachedSymbol{.name = sym.name, .kind = int(sym.kind)});
+            cache.files.push_back(std::move(file));
+        }
+    }
+
+    // Write to a temporary file and rename, so a crash never leaves a truncated cache behind
+    std::error_code ec;
+    fs::create_directories(cacheFile_->parent_path(), ec);
+    auto tmpFile = *cacheFile_;
+    tmpFile += ".tmp";
+    slang::OS::writeFile(tmpFile, rfl::json::write(cache));
+    fs::rename(tmpFile, *cacheFile_, ec);
+    if (ec) {
+        WARN("Failed to write index cache {}: {}", cacheFile_->string(), ec.message());
+        fs::remove(tmpFile, ec);
+    }
+}
+
+void Indexer::indexInBatches(std::vector<fs::path> paths, const ProgressCallback& onProgress,
+                             std::stop_token stop) {
+    const size_t total = paths.size();
+    size_t done = 0;
+    auto cached = loadCache();
+
+    // Files whose size and mtime match the cache are taken from it as-is and published up front
+    size_t statHits = 0;
+    if (!cached.empty()) {
+        IndexWriteGuard guard(*this);
+        std::erase_if(paths, [&](const fs::path& path) {
+            auto it = cached.find(path.string());
+            if (it == cached.end())
+                return false;
+
+            auto stat = statFile(path);
+            if (!stat || stat->size != it->second.fileSize || stat->mtime != it->second.mtime)
+                return false;
+
+            indexPath(*guard.data, path, it->second);
+            cached.erase(it);
+            statHits++;
+            return true;
+        });
+        done = statHits;
+        if (onProgress && done)
+            onProgress(done, total);
+    }
+
+    // The rest are parsed in batches, each published as soon as it's done. Batches grow with the
+    // index so that copying it for each write stays linear overall. Files whose cache entry still
+    // has the same content hash aren't parsed.
+    size_t hashHits = 0;
+    size_t next = 0;
+    auto indexBatch = [&](std::vector<fs::path> batch, bool prioritized) {
+        std::vector<uint64_t> knownHashes;
+        knownHashes.reserve(batch.size());
+        for (const auto& path : batch) {
+            auto it = cached.find(path.string());
+            knownHashes.push_back(it == cached.end() ? 0 : it->second.contentHash);
+        }
+
+        auto indexedPaths = indexPaths(batch, knownHashes);
+
+        std::vector<std::string> referenced;
+        IndexWriteGuard guard(*this);
+        for (size_t i = 0; i < indexedPaths.size(); ++i) {
+            auto& indexed = indexedPaths[i];
+            auto it = indexed.unchanged ? cached.find(batch[i].string()) : cached.end();
+            if (prioritized) {
+                const auto& source = it != cached.end() ? it->second : indexed;
+                referenced.insert(referenced.end(), source.referencedSymbols.begin(),
+                                  source.referencedSymbols.end());
+            }
+
+            if (it != cached.end()) {
+                // Same content, new stats (e.g. touched by a checkout)
+                auto& entry = it->second;
+                entry.fileSize = indexed.fileSize;
+                entry.mtime = indexed.mtime;
+                indexPath(*guard.data, batch[i], entry);
+                hashHits++;
+            }
+            else {
+                indexPath(*guard.data, batch[i], indexed);
+            }
+        }
+        done += batch.size();
+
+        // What prioritized files reference (packages, instantiated modules) is likely needed too
+        if (!referenced.empty())
+            prioritize(referenced);
+    };
+
+    while (next < paths.size()) {
+        if (stop.stop_requested()) {
+            INFO("Indexing cancelled after {} of {} files", done, total);
+            return;
+        }
+
+        // Files wanted by open documents go first, on their own
+        auto priority = takePriorityPaths(paths, next);
+        if (!priority.empty()) {
+            INFO("Indexing {} prioritized files", priority.size());
+            indexBatch(std::move(priority), true);
+            generation_++;
+        }
+        else {
+            std::vector<fs::path> batch;
+            size_t batchSize = std::max(MinBatchSize, done / 4);
+            for (; next < paths.size() && batch.size() < batchSize; next++) {
+                if (!paths[next].empty())
+                    batch.push_back(std::move(paths[next]));
+            }
+            indexBatch(std::move(batch), false);
+        }
+
+        if (onProgress)
+            onProgress(done, total);
+    }
+
+    if (!cached.empty() || statHits) {
+        INFO("Index cache: {} files unchanged, {} revalidated by hash, {} parsed", statHits,
+             hashHits, total - statHits - hashHits);
+    }
+    if (onProgress && total == 0)
+        onProgress(0, 0);
+}
+
+std::vector<fs::path> Indexer::takePriorityPaths(std::vector<fs::path>& paths, size_t start) {
+    std::unordered_set<std::string> names;
+    {
+        std::lock_guard lock(priorityMutex_);
+        names.swap(priorityNames_);
+    }
+    if (names.empty())
+        return {};
+
+    // Files are matched by name, following the one-unit-per-file convention. Taken entries are
+    // left empty rather than erased to keep this linear.
+    std::vector<fs::path> result;
+    for (size_t i = start; i < paths.size(); i++) {
+        if (!paths[i].empty() && names.contains(paths[i].stem().string()))
+            result.push_back(std::move(paths[i]));
+    }
+
+    return result;
+}
+
+void Indexer::removePathFromIndex(IndexData& data, FileId file) {
+    // Look up the stored entry for targeted removal of symbols
+    if (file >= data.indexedFiles.size() || !data.indexedFiles[file])
+        return;
+
+    const IndexedFile& entry = *data.indexedFiles[file];
 
     // Remove symbols
     for (const auto& item : entry.symbols) {
-        auto mapIt = symbolToFiles_.find(item.name);
-        if (mapIt != symbolToFiles_.end()) {
-            auto& vec = mapIt->second;
-            vec.erase(std::remove_if(vec.begin(), vec.end(),
-                                     [&](const GlobalSymbolLoc& loc) {
-                                         return loc.uri == pathPtr && loc.kind == item.kind;
-                                     }),
-                      vec.end());
-            if (vec.empty())
-                symbolToFiles_.erase(mapIt);
-        }
+        auto& vec = data.symbolToFiles.edit(item.name);
+        vec.erase(std::remove_if(vec.begin(), vec.end(),
+                                 [&](const SymbolPosting& posting) {
+                                     return posting.file == file && posting.kind == item.kind;
+                                 }),
+                  vec.end());
     }
 
     // Remove macros
-    for (const auto& name : entry.macros) {
-        auto mapIt = macroToFiles_.find(name);
-        if (mapIt != macroToFiles_.end()) {
-            auto& vec = mapIt->second;
-            vec.erase(std::remove(vec.begin(), vec.end(), pathPtr), vec.end());
-            if (vec.empty())
-                macroToFiles_.erase(mapIt);
-        }
+    for (auto name : entry.macros) {
+        auto& vec = data.macroToFiles.edit(name);
+        vec.erase(std::remove(vec.begin(), vec.end(), file), vec.end());
     }
 
     // Remove references
-    for (const auto& ref : entry.referencedSymbols) {
-        auto mapIt = symbolReferences_.find(ref);
-        if (mapIt != symbolReferences_.end()) {
-            auto& vec = mapIt->second;
-            vec.erase(std::remove(vec.begin(), vec.end(), pathPtr), vec.end());
-            if (vec.empty())
-                symbolReferences_.erase(mapIt);
-        }
+    for (auto name : entry.referencedSymbols) {
+        auto& vec = data.symbolReferences.edit(name);
+        vec.erase(std::remove(vec.begin(), vec.end(), file), vec.end());
     }
 
     // Remove from indexedFiles
-    indexedFiles.erase(it);
+    data.indexedFiles.edit(file).reset();
 }
 
 bool isExcluded(const std::string& path, const std::vector<std::string>& excludeDirs) {
@@ -296,71 +985,318 @@ bool isExcluded(const std::string& path, const std::vector<std::string>& exclude
 }
 
 std::vector<fs::path> Indexer::getFilesForSymbol(std::string_view name) const {
-    IndexReadGuard guard(*this);
-
-    auto it = symbolToFiles_.find(std::string(name));
+    auto index = snapshot();
 
     std::vector<fs::path> result;
-    if (it != symbolToFiles_.end()) {
-        for (const auto& entry : it->second)
-            result.push_back(*entry.uri);
+    if (auto postings = index->find(index->symbolToFiles, name)) {
+        for (const auto& entry : *postings)
+            result.push_back(*index->files[entry.file]);
     }
 
     return result;
 }
 
 std::vector<fs::path> Indexer::getFilesForMacro(std::string_view name) const {
-    IndexReadGuard guard(*this);
-
-    auto it = macroToFiles_.find(std::string(name));
+    auto index = snapshot();
 
     std::vector<fs::path> result;
-    if (it != macroToFiles_.end()) {
-        for (const auto& path : it->second)
-            result.push_back(*path);
+    if (auto postings = index->find(index->macroToFiles, name)) {
+        for (auto file : *postings)
+            result.push_back(*index->files[file]);
     }
 
     return result;
 }
 
 std::vector<fs::path> Indexer::getFilesReferencingSymbol(std::string_view name) const {
-    IndexReadGuard guard(*this);
+    auto index = snapshot();
+
+    std::vector<fs::path> result;
+    if (auto postings = index->find(index->symbolReferences, name)) {
+        for (auto file : *postings)
+            result.push_back(*index->files[file]);
+    }
+
+    return result;
+}
+
+std::vector<fs::path> Indexer::getDependencies(std::string_view name) const {
+    auto index = snapshot();
+    auto start = index->nameIds.find(name);
+    if (!start)
+        return {};
+
+    std::vector<bool> seenNames(index->names.size());
+    std::vector<bool> seenFiles(index->files.size());
+    std::vector<NameId> queue{*start};
+    seenNames[*start] = true;
+
+    std::vector<fs::path> result;
+    for (size_t head = 0; head < queue.size(); head++) {
+        NameId id = queue[head];
+        if (id >= index->symbolToFiles.size())
+            continue;
+
+        for (const auto& posting : index->symbolToFiles[id]) {
+            if (seenFiles[posting.file])
+                continue;
+            seenFiles[posting.file] = true;
+            if (head != 0)
+                result.push_back(*index->files[posting.file]);
+
+            for (auto ref : index->indexedFiles[posting.file]->referencedSymbols) {
+                if (!seenNames[ref]) {
+                    seenNames[ref] = true;
+                    queue.push_back(ref);
+                }
+            }
+        }
+    }
+    return result;
+}
 
-    auto it = symbolReferences_.find(std::string(name));
+std::vector<fs::path> Indexer::getDependents(std::string_view name) const {
+    auto index = snapshot();
+    auto start = index->nameIds.find(name);
+    if (!start)
+        return {};
+
+    std::vector<bool> seenNames(index->names.size());
+    std::vector<bool> seenFiles(index->files.size());
+    std::vector<NameId> queue{*start};
+    seenNames[*start] = true;
+
+    // Files defining the symbol itself aren't its dependents, unless they also reference it
+    if (*start < index->symbolToFiles.size()) {
+        for (const auto& posting : index->symbolToFiles[*start])
+            seenFiles[posting.file] = true;
+    }
 
     std::vector<fs::path> result;
-    if (it != symbolReferences_.end()) {
-        for (const auto& path : it->second)
-            result.push_back(*path);
+    for (size_t head = 0; head < queue.size(); head++) {
+        NameId id = queue[head];
+        if (id >= index->symbolReferences.size())
+            continue;
+
+        for (auto file : index->symbolReferences[id]) {
+            if (seenFiles[file])
+                continue;
+            seenFiles[file] = true;
+            result.push_back(*index->files[file]);
+
+            for (const auto& sym : index->indexedFiles[file]->symbols) {
+                if (!seenNames[sym.name]) {
+                    seenNames[sym.name] = true;
+                    queue.push_back(sym.name);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<fs::path> Indexer::getAnalysisDependencies(
+    std::span<const std::string_view> referenced,
+    std::span<const std::string_view> declared) const {
+    auto index = snapshot();
+
+    std::vector<bool> seenNames(index->names.size());
+    std::vector<bool> seenFiles(index->files.size());
+    for (auto name : declared) {
+        if (auto id = index->nameIds.find(name))
+            seenNames[*id] = true;
+    }
+
+    std::vector<NameId> queue;
+    for (auto name : referenced) {
+        auto id = index->nameIds.find(name);
+        if (id && !seenNames[*id]) {
+            seenNames[*id] = true;
+            queue.push_back(*id);
+        }
     }
 
+    std::vector<fs::path> result;
+    for (size_t head = 0; head < queue.size(); head++) {
+        NameId id = queue[head];
+        if (id >= index->symbolToFiles.size() || index->symbolToFiles[id].empty())
+            continue;
+
+        FileId file = index->symbolToFiles[id][0].file;
+        if (seenFiles[file])
+            continue;
+        seenFiles[file] = true;
+        result.push_back(*index->files[file]);
+
+        // Recurse into packages and interfaces, since they may contain types from other packages
+        // that are referenced by the analyzed module
+        const auto& entry = *index->indexedFiles[file];
+        bool providesTypes = std::ranges::any_of(entry.symbols, [](const auto& sym) {
+            return sym.kind == slang::syntax::SyntaxKind::PackageDeclaration ||
+                   sym.kind == slang::syntax::SyntaxKind::InterfaceDeclaration;
+        });
+        if (!providesTypes)
+            continue;
+
+        for (const auto& sym : entry.symbols)
+            seenNames[sym.name] = true;
+        for (auto ref : entry.referencedSymbols) {
+            if (!seenNames[ref]) {
+                seenNames[ref] = true;
+                queue.push_back(ref);
+            }
+        }
+    }
     return result;
 }
 
 std::optional<Indexer::GlobalSymbolLoc> Indexer::getFirstSymbolLoc(std::string_view name) const {
-    IndexReadGuard guard(*this);
+    auto index = snapshot();
 
-    auto it = symbolToFiles_.find(std::string(name));
-    if (it == symbolToFiles_.end() || it->second.empty()) {
+    auto postings = index->find(index->symbolToFiles, name);
+    if (!postings || postings->empty()) {
         return std::nullopt;
     }
-    return it->second[0];
+    const auto& entry = (*postings)[0];
+    return GlobalSymbolLoc{.uri = index->files[entry.file], .kind = entry.kind};
+}
+
+std::vector<Indexer::SymbolMatch> Indexer::findSymbols(std::string_view query, size_t limit,
+                                                       const SymbolBatchCallback& onBatch) const {
+    auto index = snapshot();
+
+    auto isDefined = [&](NameId id) {
+        return id < index->symbolToFiles.size() && !index->symbolToFiles[id].empty();
+    };
+
+    // Add the best of a batch of names to the result, best first. Every name in a batch ranks
+    // above the names in later ones.
+    std::vector<SymbolMatch> result;
+    auto addBatch = [&](std::vector<RankedName>& ranked) {
+        size_t start = result.size();
+        size_t room = limit - start;
+        if (ranked.size() > room) {
+            std::ranges::nth_element(ranked, ranked.begin() + ptrdiff_t(room));
+            ranked.resize(room);
+        }
+        std::ranges::sort(ranked);
+
+        for (const auto& match : ranked) {
+            for (const auto& entry : index->symbolToFiles[match.id]) {
+                if (result.size() >= limit)
+                    break;
+                result.push_back(SymbolMatch{
+                    .name = match.name,
+                    .loc = GlobalSymbolLoc{.uri = index->files[entry.file], .kind = entry.kind}});
+            }
+        }
+        if (onBatch && result.size() > start)
+            onBatch(std::span(result).subspan(start));
+    };
+
+    // Names containing the query are all in the posting list of each of its trigrams, so the
+    // shortest list holds every candidate. These outrank anything else, so if there are enough
+    // of them nothing else needs to be looked at.
+    std::vector<RankedName> ranked;
+    bool haveTrigrams = query.size() >= 3;
+    if (haveTrigrams) {
+        const std::vector<NameId>* shortest = nullptr;
+        for (size_t i = 0; i + 3 <= query.size(); i++) {
+            auto ids = index->symbolTrigrams.find(trigramKey(query.data() + i));
+            if (!ids) {
+                shortest = nullptr;
+                break;
+            }
+            if (!shortest || ids->size() < shortest->size())
+                shortest = ids;
+        }
+
+        if (shortest) {
+            for (auto id : *shortest) {
+                if (isDefined(id) && findIgnoreCase(index->names[id], query) != std::string::npos)
+                    ranked.push_back(rankName(index->names[id], query, id));
+            }
+        }
+    }
+
+    addBatch(ranked);
+
+    // Otherwise look for names with the query's characters in order, first ruling names out by
+    // the characters they contain
+    if (result.size() < limit) {
+        ranked.clear();
+        uint64_t queryMask = charMask(query);
+        for (NameId id = 0; id < index->symbolCharMasks.size(); id++) {
+            uint64_t mask = index->symbolCharMasks[id];
+            if (!mask || (mask & queryMask) != queryMask || !isDefined(id))
+                continue;
+
+            auto name = index->names[id];
+            if (haveTrigrams && findIgnoreCase(name, query) != std::string::npos)
+                continue; // Already found above
+            if (fuzzyMatch(query, name))
+                ranked.push_back(rankName(name, query, id));
+        }
+        addBatch(ranked);
+    }
+    return result;
 }
 
 std::vector<std::string> Indexer::getAllMacroNames() const {
-    IndexReadGuard guard(*this);
+    auto index = snapshot();
 
     std::vector<std::string> result;
-    result.reserve(macroToFiles_.size());
-    for (const auto& [name, _] : macroToFiles_) {
-        result.push_back(name);
+    for (NameId id = 0; id < index->macroToFiles.size(); id++) {
+        if (!index->macroToFiles[id].empty())
+            result.emplace_back(index->names[id]);
     }
     return result;
 }
 
 size_t Indexer::getSymbolCount() const {
-    IndexReadGuard guard(*this);
-    return symbolToFiles_.size();
+    auto index = snapshot();
+    return size_t(std::ranges::count_if(index->symbolToFiles,
+                                        [](const auto& entries) { return !entries.empty(); }));
+}
+
+Indexer::UpdateStats Indexer::getUpdateStats() {
+    std::lock_guard lock(writeMutex_);
+    return updateStats_;
+}
+
+std::string Indexer::dumpIndex() const {
+    auto index = snapshot();
+
+    std::vector<FileId> files;
+    for (FileId id = 0; id < index->indexedFiles.size(); id++) {
+        if (index->indexedFiles[id])
+            files.push_back(id);
+    }
+    std::ranges::sort(files, {}, [&](FileId id) -> const fs::path& { return *index->files[id]; });
+
+    auto sorted = [](auto names) {
+        std::ranges::sort(names);
+        return names;
+    };
+
+    std::string result;
+    for (auto id : files) {
+        result += fmt::format("{}\n", index->files[id]->string());
+        auto entry = toIndexedPath(*index, *index->indexedFiles[id]);
+
+        std::vector<std::string> symbols;
+        for (const auto& sym : entry.symbols)
+            symbols.push_back(fmt::format("{} {}", toString(sym.kind), sym.name));
+        for (const auto& sym : sorted(symbols))
+            result += fmt::format("  symbol {}\n", sym);
+        for (const auto& macro : sorted(std::vector<std::string>(entry.macros.begin(),
+                                                                 entry.macros.end())))
+            result += fmt::format("  macro {}\n", macro);
+        for (const auto& ref : sorted(std::vector<std::string>(entry.referencedSymbols.begin(),
+                                                               entry.referencedSymbols.end())))
+            result += fmt::format("  ref {}\n", ref);
+    }
+    return result;
 }
 
 bool isSystemVerilogFile(const fs::path& path) {
@@ -372,6 +1308,7 @@ void Indexer::onWorkspaceDidChangeWatchedFiles(const lsp::DidChangeWatchedFilesP
     IndexWriteGuard guard(*this);
 
     std::vector<fs::path> pathsToAdd;
+    std::vector<FileId> filesToUpdate;
 
     for (const auto& change : params.changes) {
         fs::path path = change.uri.getPath();
@@ -383,79 +1320,333 @@ void Indexer::onWorkspaceDidChangeWatchedFiles(const lsp::DidChangeWatchedFilesP
                 break;
             }
             case lsp::FileChangeType::Changed: {
-                // Re-index the file: remove old entries, add new ones
-                auto it = uniqueUris_.find(path);
-                if (it != uniqueUris_.end()) {
-                    removePathFromIndex(&(*it));
+                // Branch switches and builds touch many files without changing them, so indexed
+                // files are checked against their content hash before being reindexed
+                auto it = fileIds_.find(path);
+                bool indexed = it != fileIds_.end() &&
+                               guard.data->indexedFiles[it->second] != nullptr;
+                if (!fs::exists(path)) {
+                    if (indexed) {
+                        removePathFromIndex(*guard.data, it->second);
+                        std::erase(filesToUpdate, it->second);
+                    }
                 }
-
-                // Re-add with new content
-                if (fs::exists(path))
+                else if (indexed) {
+                    if (std::ranges::find(filesToUpdate, it->second) == filesToUpdate.end())
+                        filesToUpdate.push_back(it->second);
+                }
+                else {
                     pathsToAdd.push_back(path);
+                }
                 break;
             }
             case lsp::FileChangeType::Deleted: {
                 // Remove all entries for this file
-                auto it = uniqueUris_.find(path);
-                if (it != uniqueUris_.end()) {
-                    removePathFromIndex(&(*it));
+                auto it = fileIds_.find(path);
+                if (it != fileIds_.end()) {
+                    removePathFromIndex(*guard.data, it->second);
+                    std::erase(filesToUpdate, it->second);
                 }
                 break;
             }
         }
     }
 
-    // Parse all new/changed files potentially in thread pool
-    if (!pathsToAdd.empty()) {
-        auto indexedPaths = indexPaths(pathsToAdd);
-        for (size_t i = 0; i < indexedPaths.size(); ++i)
-            indexPath(pathsToAdd[i], indexedPaths[i]);
+    // Parse all new/changed files potentially in thread pool. Readers keep seeing the previous
+    // index until this is published.
+    if (!pathsToAdd.empty())
+        addDocuments(*guard.data, pathsToAdd);
+
+    if (!filesToUpdate.empty()) {
+        size_t skipped = updateDocuments(*guard.data, filesToUpdate);
+        INFO("Changed files: {} reindexed, {} with unchanged symbols",
+             filesToUpdate.size() - skipped, skipped);
     }
 }
 
-void Indexer::collectFilesFromDirectory(const fs::path& dir,
-                                        const std::vector<std::string>& excludeDirs,
-                                        std::vector<fs::path>& outFiles) {
+namespace {
+
+// Excluded directory names, matched exactly at any level. Entries with a path separator aren't
+// names; they keep the older substring match against the full path.
+class ExcludeSet {
+public:
+    explicit ExcludeSet(const std::vector<std::string>& excludeDirs) {
+        for (std::string_view dir : excludeDirs) {
+            while (dir.size() > 1 && (dir.back() == '/' || dir.back() == '\\'))
+                dir.remove_suffix(1);
+            if (dir.find_first_of("/\\") == std::string_view::npos)
+                names.insert(dir);
+            else
+                paths.push_back(dir);
+        }
+    }
 
-    if (!fs::exists(dir) || !fs::is_directory(dir)) {
-        return;
+    bool contains(std::string_view name, const fs::path& path) const {
+        if (names.contains(name))
+            return true;
+        if (paths.empty())
+            return false;
+
+        auto str = path.string();
+        return std::ranges::any_of(paths, [&](std::string_view dir) {
+            return str.find(dir) != std::string::npos;
+        });
     }
-    auto startSize = outFiles.size();
 
-    ScopedTimer t_index(fmt::format("Crawling {}", dir.string()));
+private:
+    // Views into the config, which outlives the crawl
+    std::unordered_set<std::string_view> names;
+    std::vector<std::string_view> paths;
+};
+
+bool hasSystemVerilogExtension(std::string_view name) {
+    for (std::string_view ext : {".sv", ".svh", ".v", ".vh"}) {
+        if (name.size() > ext.size() && name.ends_with(ext))
+            return true;
+    }
+    return false;
+}
+
+enum class EntryType { File, Directory, Link, Unknown, Other };
+
+// List a directory's entries with their types as reported by the listing itself, so most
+// entries don't cost a stat call. Links and entries the filesystem doesn't type are left for the
+// caller to resolve.
+template<typename F>
+void listDirectory(const fs::path& dir, F&& visit) {
+#ifdef _WIN32
+    // The Windows listing fills in the entry types
     std::error_code ec;
-    for (auto it = fs::recursive_directory_iterator(
-             dir, fs::directory_options::skip_permission_denied, ec);
-         it != fs::recursive_directory_iterator(); ++it) {
-
-        // Check for exclude when entering a new directory
-        if (it->is_directory(ec)) {
-            // This map tends to be small; linear search is fine
-            if (isExcluded(it->path().string(), excludeDirs)) {
-                it.disable_recursion_pending();
+    for (auto it = fs::directory_iterator(dir, fs::directory_options::skip_permission_denied, ec);
+         !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        auto type = EntryType::Other;
+        if (it->is_symlink(ec))
+            type = EntryType::Link;
+        else if (it->is_directory(ec))
+            type = EntryType::Directory;
+        else if (it->is_regular_file(ec))
+            type = EntryType::File;
+        visit(it->path().filename().string(), type);
+    }
+    if (ec)
+        WARN("Failed to read directory {}: {}", dir.string(), ec.message());
+#else
+    DIR* handle = opendir(dir.c_str());
+    if (!handle) {
+        if (errno != EACCES)
+            WARN("Failed to read directory {}: {}", dir.string(), std::strerror(errno));
+        return;
+    }
+
+    while (auto entry = readdir(handle)) {
+        std::string_view name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+
+        auto type = EntryType::Other;
+        switch (entry->d_type) {
+            case DT_REG:
+                type = EntryType::File;
+                break;
+            case DT_DIR:
+                type = EntryType::Directory;
+                break;
+            case DT_LNK:
+                type = EntryType::Link;
+                break;
+            case DT_UNKNOWN:
+                type = EntryType::Unknown;
+                break;
+            default:
+                break;
+        }
+        visit(name, type);
+    }
+    closedir(handle);
+#endif
+}
+
+// Crawls a directory tree in parallel. Each worker takes directories from the back of its own
+// queue, and steals from the front of the others' when it runs out, so one deep subtree doesn't
+// leave the rest of the workers idle. Workers with nothing to take sleep until a directory is
+// queued or the crawl is done.
+class DirectoryCrawler {
+public:
+    DirectoryCrawler(const ExcludeSet& excludes, size_t numWorkers) :
+        excludes(excludes), queues(numWorkers), files(numWorkers) {}
+
+    std::vector<fs::path> crawl(const fs::path& root) {
+        pending = 1;
+        queued = 1;
+        queues[0].dirs.push_back(root);
+
+        if (queues.size() == 1) {
+            work(0);
+        }
+        else {
+            BS::thread_pool threadPool(queues.size());
+            for (size_t i = 0; i < queues.size(); i++)
+                threadPool.detach_task([this, i] { work(i); });
+            threadPool.wait();
+        }
+
+        // Sort so the result doesn't depend on which worker got where first
+        std::vector<fs::path> result;
+        for (auto& workerFiles : files)
+            std::ranges::move(workerFiles, std::back_inserter(result));
+        std::ranges::sort(result);
+        return result;
+    }
+
+    size_t getDirectoryCount() const { return directories; }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<fs::path> dirs;
+    };
+
+    std::optional<fs::path> take(size_t worker) {
+        for (size_t i = 0; i < queues.size(); i++) {
+            auto& queue = queues[(worker + i) % queues.size()];
+            std::lock_guard lock(queue.mutex);
+            if (queue.dirs.empty())
                 continue;
+
+            // Newest from our own queue for locality, oldest (likely the biggest subtree) when
+            // stealing
+            fs::path dir;
+            if (i == 0) {
+                dir = std::move(queue.dirs.back());
+                queue.dirs.pop_back();
+            }
+            else {
+                dir = std::move(queue.dirs.front());
+                queue.dirs.pop_front();
             }
+            queued--;
+            return dir;
         }
-        else if (it->is_regular_file(ec) && isSystemVerilogFile(it->path())) {
-            // Add SystemVerilog files
-            outFiles.push_back(it->path());
+        return std::nullopt;
+    }
+
+    void work(size_t worker) {
+        while (pending > 0) {
+            auto dir = take(worker);
+            if (!dir) {
+                // Others are still listing directories that may have subdirectories
+                std::unique_lock lock(wakeMutex);
+                wake.wait(lock, [&] { return queued > 0 || pending == 0; });
+                continue;
+            }
+
+            std::vector<fs::path> subdirs;
+            listDirectory(*dir, [&](std::string_view name, EntryType type) {
+                if (type == EntryType::Unknown) {
+                    std::error_code ec;
+                    auto status = fs::symlink_status(*dir / name, ec);
+                    if (fs::is_directory(status))
+                        type = EntryType::Directory;
+                    else if (fs::is_symlink(status))
+                        type = EntryType::Link;
+                    else if (fs::is_regular_file(status))
+                        type = EntryType::File;
+                }
+
+                switch (type) {
+                    case EntryType::Directory: {
+                        auto path = *dir / name;
+                        if (!excludes.contains(name, path))
+                            subdirs.push_back(std::move(path));
+                        break;
+                    }
+                    case EntryType::File:
+                        if (hasSystemVerilogExtension(name))
+                            files[worker].push_back(*dir / name);
+                        break;
+                    case EntryType::Link: {
+                        // Linked files are indexed, but linked directories aren't followed
+                        if (!hasSystemVerilogExtension(name))
+                            break;
+                        std::error_code ec;
+                        auto path = *dir / name;
+                        if (fs::is_regular_file(path, ec))
+                            files[worker].push_back(std::move(path));
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            });
+            directories++;
+
+            if (!subdirs.empty()) {
+                pending += subdirs.size();
+                {
+                    auto& queue = queues[worker];
+                    std::lock_guard lock(queue.mutex);
+                    queued += subdirs.size();
+                    for (auto& subdir : subdirs)
+                        queue.dirs.push_back(std::move(subdir));
+                }
+                notifyIdle();
+            }
+            if (--pending == 0)
+                notifyIdle();
         }
     }
-    // check ec
-    if (ec) {
-        ERROR("Error while indexing directory {}: {}", dir.string(), ec.message());
+
+    void notifyIdle() {
+        // Holding the mutex orders this after a waiter's check, so the wakeup can't be missed
+        std::lock_guard lock(wakeMutex);
+        wake.notify_all();
     }
-    INFO("Found {} files", outFiles.size() - startSize);
+
+    const ExcludeSet& excludes;
+    std::vector<WorkQueue> queues;
+    std::vector<std::vector<fs::path>> files;
+    // Directories queued or being listed
+    std::atomic<size_t> pending = 0;
+    // Directories queued and not yet taken
+    std::atomic<size_t> queued = 0;
+    std::atomic<size_t> directories = 0;
+    // Idle workers wait on this for `queued` or `pending` to change
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+};
+
+} // namespace
+
+void Indexer::collectFilesFromDirectory(const fs::path& dir,
+                                        const std::vector<std::string>& excludeDirs,
+                                        std::vector<fs::path>& outFiles, uint32_t numThreads) {
+
+    if (!fs::exists(dir) || !fs::is_directory(dir)) {
+        return;
+    }
+
+    ScopedTimer t_index(fmt::format("Crawling {}", dir.string()));
+
+    // Crawling is mostly waiting on the filesystem, so use the indexing threads even on small
+    // trees
+    size_t numWorkers = numThreads ? numThreads : std::max(1u, std::thread::hardware_concurrency());
+    ExcludeSet excludes(excludeDirs);
+    DirectoryCrawler crawler(excludes, numWorkers);
+    auto files = crawler.crawl(dir);
+
+    INFO("Found {} files in {} directories", files.size(), crawler.getDirectoryCount());
+    std::ranges::move(files, std::back_inserter(outFiles));
 }
 
-void Indexer::startIndexing(const std::vector<Config::IndexConfig>& indexConfigs,
-                            std::optional<std::string_view> workspaceFolder) {
+std::vector<fs::path> Indexer::collectPaths(const std::vector<Config::IndexConfig>& indexConfigs,
+                                            std::optional<std::string_view> workspaceFolder,
+                                            uint32_t numThreads) {
     std::vector<fs::path> pathsToIndex;
 
     if (indexConfigs.empty()) {
         // No index configs - index entire workspace
         if (workspaceFolder.has_value()) {
-            collectFilesFromDirectory(fs::path(*workspaceFolder), {}, pathsToIndex);
+            collectFilesFromDirectory(fs::path(*workspaceFolder), {}, pathsToIndex, numThreads);
         }
     }
     else {
@@ -473,16 +1664,16 @@ void Indexer::startIndexing(const std::vector<Config::IndexConfig>& indexConfigs
                 }
                 collectFilesFromDirectory(
                     fullDirPath, cfg.excludeDirs.value().value_or(std::vector<std::string>{}),
-                    pathsToIndex);
+                    pathsToIndex, numThreads);
             }
         }
     }
 
-    indexAndReport(pathsToIndex);
+    return pathsToIndex;
 }
 
-void Indexer::startIndexing(const std::vector<std::string>& globs,
-                            const std::vector<std::string>& excludeDirs) {
+std::vector<fs::path> Indexer::collectPaths(const std::vector<std::string>& globs,
+                                            const std::vector<std::string>& excludeDirs) {
     std::vector<fs::path> pathsToIndex;
     for (const auto& pattern : globs) {
         ScopedTimer t_glob("Globbing " + pattern);
@@ -504,48 +1695,116 @@ void Indexer::startIndexing(const std::vector<std::string>& globs,
         INFO("Found {} files from pattern {}", pathsToIndex.size() - beginCount, pattern);
     }
 
-    indexAndReport(pathsToIndex);
+    return pathsToIndex;
 }
 
-void Indexer::indexAndReport(std::vector<fs::path> pathsToIndex) {
-    INFO("Indexing {} files", pathsToIndex.size());
+void Indexer::startIndexing(const std::vector<Config::IndexConfig>& indexConfigs,
+                            std::optional<std::string_view> workspaceFolder) {
+    cancelIndexing();
+    indexAndReport(collectPaths(indexConfigs, workspaceFolder, numThreads_), {}, {});
+}
 
-    {
-        ScopedTimer t_index("Slang Indexing");
-        addDocuments(pathsToIndex);
-    }
+void Indexer::startIndexing(const std::vector<std::string>& globs,
+                            const std::vector<std::string>& excludeDirs) {
+    cancelIndexing();
+    indexAndReport(collectPaths(globs, excludeDirs), {}, {});
+}
 
-    // Estimate memory usage
-    size_t symbolsSize = 0;
-    for (const auto& [name, entries] : symbolToFiles_) {
-        symbolsSize += sizeof(
-                           std::pair<const std::string, slang::SmallVector<GlobalSymbolLoc, 2>>) +
-                       name.capacity();
-        symbolsSize += entries.size() * sizeof(GlobalSymbolLoc);
-    }
+void Indexer::startBackgroundIndexing(std::vector<Config::IndexConfig> indexConfigs,
+                                      std::optional<std::string> workspaceFolder,
+                                      ProgressCallback onProgress) {
+    cancelIndexing();
+    indexing_ = true;
+    indexingThread_ = std::jthread([this, indexConfigs = std::move(indexConfigs),
+                                    workspaceFolder = std::move(workspaceFolder),
+                                    onProgress = std::move(onProgress)](std::stop_token stop) {
+        indexAndReport(collectPaths(indexConfigs, workspaceFolder, numThreads_), onProgress, stop);
+    });
+}
+
+void Indexer::startBackgroundIndexing(std::vector<std::string> globs,
+                                      std::vector<std::string> excludeDirs,
+                                      ProgressCallback onProgress) {
+    cancelIndexing();
+    indexing_ = true;
+    indexingThread_ = std::jthread([this, globs = std::move(globs),
+                                    excludeDirs = std::move(excludeDirs),
+                                    onProgress = std::move(onProgress)](std::stop_token stop) {
+        indexAndReport(collectPaths(globs, excludeDirs), onProgress, stop);
+    });
+}
 
-    size_t macrosSize = 0;
-    for (const auto& [name, uris] : macroToFiles_) {
-        macrosSize += sizeof(std::pair<const std::string, slang::SmallVector<const fs::path*, 2>>) +
-                      name.capacity();
-        macrosSize += uris.size() * sizeof(const fs::path*);
+void Indexer::cancelIndexing() {
+    if (indexingThread_.joinable()) {
+        indexingThread_.request_stop();
+        indexingThread_.join();
     }
+}
+
+void Indexer::waitForIndexing() {
+    if (indexingThread_.joinable())
+        indexingThread_.join();
+}
+
+void Indexer::prioritize(std::span<const std::string> names) {
+    std::lock_guard lock(priorityMutex_);
+    priorityNames_.insert(names.begin(), names.end());
+}
 
-    size_t refsSize = 0;
-    for (const auto& [name, uris] : symbolReferences_) {
-        refsSize += sizeof(std::pair<const std::string, slang::SmallVector<const fs::path*, 2>>) +
-                    name.capacity();
-        refsSize += uris.size() * sizeof(const fs::path*);
+void Indexer::indexAndReport(std::vector<fs::path> pathsToIndex,
+                             const ProgressCallback& onProgress, std::stop_token stop) {
+    INFO("Indexing {} files", pathsToIndex.size());
+
+    indexing_ = true;
+    {
+        ScopedTimer t_index("Slang Indexing");
+        slang::TimeTraceScope timeScope("indexWorkspace", std::to_string(pathsToIndex.size()));
+        indexInBatches(std::move(pathsToIndex), onProgress, stop);
     }
+    indexing_ = false;
+    generation_++;
+
+    if (stop.stop_requested())
+        return;
 
-    // Count unique URIs storage
-    size_t urisSize = 0;
-    for (const auto& uri : uniqueUris_) {
-        urisSize += sizeof(URI) + uri.string().capacity();
+    // Estimate memory usage
+    auto index = snapshot();
+    auto estimate = [](const auto& postings, size_t& count) {
+        size_t bytes = 0;
+        for (const auto& entries : postings) {
+            if (!entries.empty())
+                count++;
+            bytes += sizeof(entries) + entries.size() * sizeof(entries[0]);
+        }
+        return bytes;
+    };
+    size_t symbolCount = 0, macroCount = 0, refCount = 0;
+    size_t symbolsSize = estimate(index->symbolToFiles, symbolCount);
+    size_t macrosSize = estimate(index->macroToFiles, macroCount);
+    size_t refsSize = estimate(index->symbolReferences, refCount);
+
+    // Each name is stored once, plus its id in the lookup table
+    size_t namesSize = index->names.size() *
+                       (sizeof(std::string_view) + sizeof(std::pair<std::string_view, NameId>));
+    for (auto name : index->names)
+        namesSize += name.size();
+
+    // Per file entries and paths
+    size_t fileCount = 0, filesSize = 0;
+    for (FileId id = 0; id < index->indexedFiles.size(); id++) {
+        const auto& entry = index->indexedFiles[id];
+        if (!entry)
+            continue;
+        fileCount++;
+        filesSize += sizeof(IndexedFile) + index->files[id]->native().size() +
+                     entry->symbols.size() * sizeof(IndexedFile::Symbol) +
+                     (entry->macros.size() + entry->referencedSymbols.size()) * sizeof(NameId);
     }
 
     INFO("Indexing complete: {} symbols (~{} KB), {} macros (~{} KB), {} references (~{} KB), {} "
-         "unique URIs (~{} KB)",
-         symbolToFiles_.size(), symbolsSize / 1024, macroToFiles_.size(), macrosSize / 1024,
-         symbolReferences_.size(), refsSize / 1024, uniqueUris_.size(), urisSize / 1024);
+         "names (~{} KB), {} files (~{} KB)",
+         symbolCount, symbolsSize / 1024, macroCount, macrosSize / 1024, refCount,
+         refsSize / 1024, index->names.size(), namesSize / 1024, fileCount, filesSize / 1024);
+
+    saveCache();
 }
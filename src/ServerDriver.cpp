@@ -14,14 +14,16 @@
 #include "ast/ServerCompilation.h"
 #include "completions/CompletionDispatch.h"
 #include "document/SlangDoc.h"
+#include "lsp/JsonRpc.h"
 #include "lsp/LspTypes.h"
 #include "lsp/URI.h"
 #include "util/Converters.h"
 #include "util/Formatting.h"
 #include "util/Logging.h"
 #include "util/Markdown.h"
+#include <algorithm>
+#include <chrono>
 #include <memory>
-#include <queue>
 #include <string_view>
 
 #include "slang/ast/Compilation.h"
@@ -41,6 +43,7 @@
 #include "slang/syntax/SyntaxTree.h"
 #include "slang/text/SourceLocation.h"
 #include "slang/text/SourceManager.h"
+#include "slang/util/TimeTrace.h"
 
 namespace server {
 using namespace slang;
@@ -127,6 +130,10 @@ void ServerDriver::parseAndLoadSources(const std::vector<std::string>& buildfile
 
 // Doc updates (open, change, save)
 void ServerDriver::updateDoc(SlangDoc& doc, FileUpdateType type) {
+    // Whatever triggered this covers any deferred update
+    m_pendingUpdates.erase(doc.getURI());
+    m_staleDependencies.erase(doc.getURI());
+
     // Grab dependent documents
     doc.setDependentDocuments(getDependentDocs(doc.getSyntaxTree()));
 
@@ -153,7 +160,7 @@ void ServerDriver::updateDoc(SlangDoc& doc, FileUpdateType type) {
         doc.issueDiagnosticsTo(diagEngine);
     }
     diagClient->pushDiags(doc.getURI());
-    INFO("Published diags for {}", doc.getURI().getPath());
+    LOG_DEBUG("Published diags for {}", doc.getURI().getPath());
 
     publishInactiveRegions(doc);
 }
@@ -221,37 +228,105 @@ void ServerDriver::openDocument(const URI& uri, const std::string_view text) {
 }
 
 std::shared_ptr<SlangDoc> ServerDriver::getDocument(const URI& uri) {
-    auto it = docs.find(uri);
-    if (it != docs.end())
-        return it->second;
-
-    auto doc = SlangDoc::open(*this, uri);
-    if (doc) {
-        docs[uri] = doc;
+    auto doc = findDocument(uri);
+    if (!doc)
+        return doc;
+
+    // The tree and analysis rebuild lazily from the edits; only the dependencies an edit may
+    // have added need looking up. Diagnostics wait for the deferred update.
+    {
+        std::lock_guard lock(m_docsMutex);
+        if (!m_staleDependencies.contains(uri))
+            return doc;
     }
+    doc->setDependentDocuments(getDependentDocs(doc->getSyntaxTree()));
+
+    // Only once they're found, in case the request looking them up is cancelled
+    std::lock_guard lock(m_docsMutex);
+    m_staleDependencies.erase(uri);
     return doc;
 }
 
+std::shared_ptr<SlangDoc> ServerDriver::findDocument(const URI& uri) {
+    {
+        std::lock_guard lock(m_docsMutex);
+        auto it = docs.find(uri);
+        if (it != docs.end())
+            return it->second;
+    }
+
+    auto doc = SlangDoc::open(*this, uri);
+    if (!doc)
+        return doc;
+
+    // Another request may have opened it in the meantime
+    std::lock_guard lock(m_docsMutex);
+    return docs.try_emplace(uri, doc).first->second;
+}
+
 bool ServerDriver::isDocumentOpen(const URI& uri) {
     return m_openDocs.find(uri) != m_openDocs.end();
 }
 
 void ServerDriver::onDocDidChange(const lsp::DidChangeTextDocumentParams& params) {
     std::string_view path = params.textDocument.uri.getPath();
-    auto doc = getDocument(params.textDocument.uri);
+    auto doc = findDocument(params.textDocument.uri);
     if (!doc) {
         ERROR("Document {} not found", path);
         return;
     }
 
     doc->onChange(params.contentChanges);
-    // Update Tree and Compilation
-    updateDoc(*doc, FileUpdateType::CHANGE);
+
+    // Update Tree and Compilation once the edits stop coming
+    auto delay = std::chrono::milliseconds(std::max(m_config.diagnosticsDelay.value(), 0));
+    if (delay.count() == 0) {
+        updateDoc(*doc, FileUpdateType::CHANGE);
+        return;
+    }
+    m_pendingUpdates[params.textDocument.uri] = std::chrono::steady_clock::now() + delay;
+    m_staleDependencies.insert(params.textDocument.uri);
+}
+
+void ServerDriver::flushUpdate(const URI& uri) {
+    if (!m_pendingUpdates.erase(uri))
+        return;
+    if (auto doc = findDocument(uri))
+        updateDoc(*doc, FileUpdateType::CHANGE);
+}
+
+std::optional<std::chrono::milliseconds> ServerDriver::flushDueUpdates() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<URI> due;
+    std::optional<std::chrono::steady_clock::time_point> next;
+    for (auto& [uri, deadline] : m_pendingUpdates) {
+        if (deadline <= now)
+            due.push_back(uri);
+        else if (!next || deadline < *next)
+            next = deadline;
+    }
+
+    for (auto& uri : due)
+        flushUpdate(uri);
+
+    if (!next)
+        return std::nullopt;
+    return std::chrono::ceil<std::chrono::milliseconds>(*next - now);
+}
+
+void ServerDriver::flushUpdates() {
+    std::vector<URI> uris;
+    for (auto& [uri, _] : m_pendingUpdates)
+        uris.push_back(uri);
+    for (auto& uri : uris)
+        flushUpdate(uri);
 }
 
 void ServerDriver::closeDocument(const URI& uri) {
     // Remove from open docs set
     m_openDocs.erase(uri);
+    m_pendingUpdates.erase(uri);
+    m_staleDependencies.erase(uri);
     if (!comp) {
         diagClient->clear(uri);
     }
@@ -263,7 +338,7 @@ void ServerDriver::reloadDocument(const URI& uri) {
         return;
     }
 
-    auto doc = getDocument(uri);
+    auto doc = findDocument(uri);
     if (!doc) {
         WARN("Document {} not found for reload", uri.getPath());
         return;
@@ -292,7 +367,7 @@ void ServerDriver::onWorkspaceDidChangeWatchedFiles(
                     continue;
                 }
 
-                auto doc = getDocument(change.uri);
+                auto doc = findDocument(change.uri);
                 if (!doc) {
                     WARN("Document {} not found for reload", change.uri.getPath());
                     continue;
@@ -322,59 +397,27 @@ void ServerDriver::onWorkspaceDidChangeWatchedFiles(
 
 std::vector<std::shared_ptr<SlangDoc>> ServerDriver::getDependentDocs(
     std::shared_ptr<SyntaxTree> tree) {
+    TimeTraceScope timeScope("getDependentDocs", "");
+    auto& meta = tree->getMetadata();
+    std::vector<std::string_view> declared;
+    std::vector<std::string_view> referenced;
+    meta.visitDeclaredSymbols([&](std::string_view name) { declared.push_back(name); });
+    meta.visitReferencedSymbols([&](std::string_view name) { referenced.push_back(name); });
+
+    // The index resolves the rest of the graph, so dependencies don't need to be parsed to find
+    // what they depend on
     std::vector<std::shared_ptr<SlangDoc>> result;
-    std::queue<std::shared_ptr<SyntaxTree>> treesToProcess;
-    flat_hash_set<std::string_view> knownNames;
-    flat_hash_set<std::string> processedFiles;
-
-    treesToProcess.push(tree);
-
-    while (!treesToProcess.empty()) {
-        auto currentTree = treesToProcess.front();
-        treesToProcess.pop();
-
-        auto& meta = currentTree->getMetadata();
-
-        // Collect declared symbols from current tree
-        meta.visitDeclaredSymbols([&](std::string_view name) { knownNames.emplace(name); });
-
-        meta.visitReferencedSymbols([&](std::string_view name) {
-            if (knownNames.find(name) != knownNames.end())
-                return; // already added
-
-            // Don't try multiple times
-            knownNames.emplace(name);
-            auto symbolLoc = m_indexer.getFirstSymbolLoc(name);
-            if (!symbolLoc)
-                return;
-
-            std::string filePath = symbolLoc->uri->string();
-
-            // Check if we've already processed this file to avoid cycles
-            if (processedFiles.find(filePath) != processedFiles.end())
-                return;
-
-            processedFiles.insert(filePath);
-
-            auto newdoc = getDocument(URI::fromFile(filePath));
-            if (newdoc) {
-                result.push_back(newdoc);
-                docs[newdoc->getURI()] = newdoc;
-
-                // Recurse into packages and interfaces, since they may contain types from other
-                // packages that are referenced by the analyzed module.
-                for (auto& [decl, _] : newdoc->getSyntaxTree()->getMetadata().nodeMeta) {
-                    if (decl->kind == syntax::SyntaxKind::PackageDeclaration ||
-                        decl->kind == syntax::SyntaxKind::InterfaceDeclaration) {
-                        treesToProcess.push(newdoc->getSyntaxTree());
-                        break;
-                    }
-                }
-            }
-            else {
-                ERROR("No doc found for {}", filePath);
-            }
-        });
+    for (const auto& path : m_indexer.getAnalysisDependencies(referenced, declared)) {
+        lsp::throwIfCancelled();
+        std::string filePath = path.string();
+        // Only their trees are needed, so their own dependencies aren't looked up again here
+        auto newdoc = findDocument(URI::fromFile(filePath));
+        if (newdoc) {
+            result.push_back(newdoc);
+        }
+        else {
+            ERROR("No doc found for {}", filePath);
+        }
     }
 
     return result;
@@ -498,11 +541,11 @@ std::optional<DefinitionInfo> ServerDriver::getDefinitionInfoAt(const URI& uri,
     if (!loc) {
         return {};
     }
-    const parsing::Token* declTok = analysis->syntaxes.getWordTokenAt(loc.value());
+    const parsing::Token* declTok = analysis->getSyntaxes().getWordTokenAt(loc.value());
     if (!declTok) {
         return {};
     }
-    const syntax::SyntaxNode* declSyntax = analysis->syntaxes.getTokenParent(declTok);
+    const syntax::SyntaxNode* declSyntax = analysis->getSyntaxes().getTokenParent(declTok);
     if (!declSyntax) {
         return {};
     }
@@ -511,6 +554,10 @@ std::optional<DefinitionInfo> ServerDriver::getDefinitionInfoAt(const URI& uri,
     const syntax::SyntaxNode* symSyntax = nullptr;
     const ast::Symbol* symbol = nullptr;
 
+    // The analysis the symbol was found in, locked while the symbol is used
+    std::shared_ptr<ShallowAnalysis> symbolAnalysis;
+    std::unique_lock<std::recursive_mutex> symbolLock;
+
     auto isMacroRef = [&]() {
         // Normal macro usage (`FOO) or usage inside a `define body
         return declTok->kind == parsing::TokenKind::Directive &&
@@ -535,8 +582,8 @@ std::optional<DefinitionInfo> ServerDriver::getDefinitionInfoAt(const URI& uri,
         const syntax::DefineDirectiveSyntax* macroDef = nullptr;
         if (declSyntax->kind == syntax::SyntaxKind::MacroUsage ||
             declSyntax->kind == syntax::SyntaxKind::UndefDirective) {
-            auto it = analysis->macroUsageDefinitions.find(declSyntax);
-            if (it != analysis->macroUsageDefinitions.end())
+            auto it = analysis->getMacroUsageDefinitions().find(declSyntax);
+            if (it != analysis->getMacroUsageDefinitions().end())
                 macroDef = it->second;
         }
 
@@ -548,8 +595,8 @@ std::optional<DefinitionInfo> ServerDriver::getDefinitionInfoAt(const URI& uri,
             auto macroName = declTok->kind == parsing::TokenKind::Directive
                                  ? declTok->rawText().substr(1)
                                  : declTok->valueText();
-            auto macro = analysis->macros.find(macroName);
-            if (macro == analysis->macros.end()) {
+            auto macro = analysis->getMacros().find(macroName);
+            if (macro == analysis->getMacros().end()) {
                 auto files = m_indexer.getFilesForMacro(macroName);
                 if (files.empty())
                     return {};
@@ -557,8 +604,8 @@ std::optional<DefinitionInfo> ServerDriver::getDefinitionInfoAt(const URI& uri,
                 if (!macroDoc)
                     return {};
                 auto macroAnalysis = macroDoc->getAnalysis();
-                macro = macroAnalysis->macros.find(macroName);
-                if (macro == macroAnalysis->macros.end())
+                macro = macroAnalysis->getMacros().find(macroName);
+                if (macro == macroAnalysis->getMacros().end())
                     return {};
             }
             macroDef = macro->second;
@@ -572,6 +619,7 @@ std::optional<DefinitionInfo> ServerDriver::getDefinitionInfoAt(const URI& uri,
         if (knownName == parsing::KnownSystemName::Unknown)
             return {};
 
+        auto lock = analysis->lockQueries();
         auto* sub = analysis->getCompilation()->getSystemSubroutine(knownName);
         auto* sysDoc = getSystemTaskDoc(knownName);
         if (!sub || !sysDoc)
@@ -581,9 +629,13 @@ std::optional<DefinitionInfo> ServerDriver::getDefinitionInfoAt(const URI& uri,
             *declTok, sysDoc, sub->kind == ast::SubroutineKind::Task}};
     }
     else {
+        symbolAnalysis = analysis;
+        symbolLock = analysis->lockQueries();
         symbol = analysis->getSymbolAtToken(declTok);
         if (!symbol) {
             // check the index
+            symbolLock.unlock();
+            lsp::throwIfCancelled();
             auto symbols = m_indexer.getFilesForSymbol(declTok->rawText());
             if (symbols.empty()) {
                 return {};
@@ -592,9 +644,11 @@ std::optional<DefinitionInfo> ServerDriver::getDefinitionInfoAt(const URI& uri,
             if (!symDoc) {
                 return {};
             }
-            auto symAnalysis = symDoc->getAnalysis();
-            auto result = symAnalysis->getCompilation()->tryGetDefinition(
-                declTok->rawText(), symAnalysis->getCompilation()->getRoot());
+            symbolAnalysis = symDoc->getAnalysis();
+            symbolLock = symbolAnalysis->lockQueries();
+            auto& symCompilation = symbolAnalysis->getCompilation();
+            auto result = symCompilation->tryGetDefinition(declTok->rawText(),
+                                                           symCompilation->getRoot());
             if (!result.definition) {
                 return {};
             }
@@ -639,8 +693,8 @@ std::optional<DefinitionInfo> ServerDriver::getDefinitionInfoAt(const URI& uri,
 
     std::string macroExpansionText;
     if (declSyntax->kind == syntax::SyntaxKind::MacroUsage) {
-        auto it = analysis->syntaxes.macroExpansions.find(declSyntax);
-        if (it != analysis->syntaxes.macroExpansions.end())
+        auto it = analysis->getSyntaxes().macroExpansions.find(declSyntax);
+        if (it != analysis->getSyntaxes().macroExpansions.end())
             macroExpansionText = it->second.getText();
     }
 
@@ -650,7 +704,7 @@ std::optional<DefinitionInfo> ServerDriver::getDefinitionInfoAt(const URI& uri,
 
     auto makeTarget = [&]() -> DefinitionInfo::Target {
         if (symbol)
-            return DefinitionInfo::SymbolTarget{makeSyntaxTarget(), symbol, analysis};
+            return DefinitionInfo::SymbolTarget{makeSyntaxTarget(), symbol, symbolAnalysis};
 
         DefinitionInfo::MacroTarget::Definition macroDefinition = makeSyntaxTarget();
 
@@ -708,13 +762,14 @@ std::optional<std::vector<lsp::DocumentHighlight>> ServerDriver::getDocDocumentH
         return std::nullopt;
     }
     auto analysis = doc->getAnalysis();
+    auto lock = analysis->lockQueries();
 
     // Get the symbol at the position
     auto loc = toSourceLocation(doc->getBuffer(), position, sm);
     if (!loc) {
         return std::nullopt;
     }
-    auto declTok = analysis->syntaxes.getWordTokenAt(loc.value());
+    auto declTok = analysis->getSyntaxes().getWordTokenAt(loc.value());
     if (!declTok) {
         return std::nullopt;
     }
@@ -742,18 +797,20 @@ std::optional<std::vector<lsp::DocumentHighlight>> ServerDriver::getDocDocumentH
 }
 
 void ServerDriver::addMemberReferences(std::vector<lsp::Location>& references,
-                                       const ast::Symbol& parentSymbol,
-                                       const ast::Symbol& targetSymbol, bool isTypeMember) {
+                                       std::string_view parentName, bool parentIsPackage,
+                                       SourceLocation targetLocation, std::string_view targetName,
+                                       bool isTypeMember,
+                                       const std::function<void()>& onFileDone) {
 
-    auto targetBuffer = sm.getFullyOriginalLoc(targetSymbol.location).buffer();
+    auto targetBuffer = sm.getFullyOriginalLoc(targetLocation).buffer();
     auto targetDoc = getDocument(URI::fromFile(sm.getFullPath(targetBuffer)));
-    auto targetName = targetSymbol.name;
 
-    auto referencingFiles = m_indexer.getFilesReferencingSymbol(parentSymbol.name);
+    auto referencingFiles = m_indexer.getFilesReferencingSymbol(parentName);
     for (auto& filePath : referencingFiles) {
+        lsp::throwIfCancelled();
         URI fileUri = URI::fromFile(filePath.string());
 
-        // Skip the file where targetSymbol is defined to avoid duplicates
+        // Skip the file where the target is defined to avoid duplicates
         if (fileUri == targetDoc->getURI()) {
             continue;
         }
@@ -765,12 +822,12 @@ void ServerDriver::addMemberReferences(std::vector<lsp::Location>& references,
 
         // if a package, check if we can just use the package ref syntaxes to save on
         // making analysis
-        if (!isTypeMember && parentSymbol.kind == ast::SymbolKind::Package) {
+        if (!isTypeMember && parentIsPackage) {
             auto& meta = fileDoc->getSyntaxTree()->getMetadata();
             bool hasWildcard = [&] {
                 for (auto ref : meta.packageImports) {
                     for (auto item : ref->items) {
-                        if (item->package.valueText() == parentSymbol.name &&
+                        if (item->package.valueText() == parentName &&
                             item->item.kind == parsing::TokenKind::Star) {
                             return true;
                         }
@@ -781,7 +838,7 @@ void ServerDriver::addMemberReferences(std::vector<lsp::Location>& references,
             if (!hasWildcard) {
                 // no wildcard, just check cases of pkg::<targetName>
                 for (auto ref : meta.classPackageNames) {
-                    if (ref->identifier.valueText() != parentSymbol.name) {
+                    if (ref->identifier.valueText() != parentName) {
                         continue;
                     }
                     auto tok = ref->parent->as<ScopedNameSyntax>().right->getFirstToken();
@@ -789,17 +846,22 @@ void ServerDriver::addMemberReferences(std::vector<lsp::Location>& references,
                         references.push_back(toOriginalLocation(tok.range(), sm));
                     }
                 }
+                if (onFileDone)
+                    onFileDone();
                 continue;
             }
         }
 
         auto fileAnalysis = fileDoc->getAnalysis();
-        fileAnalysis->addLocalReferences(references, targetSymbol.location, targetName);
+        fileAnalysis->addLocalReferences(references, targetLocation, targetName);
+        if (onFileDone)
+            onFileDone();
     }
 }
 
 std::optional<std::vector<lsp::Location>> ServerDriver::getDocReferences(
-    const URI& srcUri, const lsp::Position& position, bool includeDeclaration) {
+    const URI& srcUri, const lsp::Position& position, bool includeDeclaration,
+    const LocationsCallback& onPartial) {
     auto doc = getDocument(srcUri);
     if (!doc) {
         return std::nullopt;
@@ -808,12 +870,13 @@ std::optional<std::vector<lsp::Location>> ServerDriver::getDocReferences(
     // Get the symbol at the position. Hold the analysis via shared_ptr so that
     // targetSymbol remains valid even if getAnalysis() is called on this doc again.
     auto analysis = doc->getAnalysis();
+    auto lock = analysis->lockQueries();
     auto loc = toSourceLocation(doc->getBuffer(), position, sm);
     if (!loc) {
         return std::nullopt;
     }
 
-    const parsing::Token* declTok = analysis->syntaxes.getWordTokenAt(loc.value());
+    const parsing::Token* declTok = analysis->getSyntaxes().getWordTokenAt(loc.value());
     if (!declTok) {
         return std::nullopt;
     }
@@ -830,6 +893,14 @@ std::optional<std::vector<lsp::Location>> ServerDriver::getDocReferences(
 
     std::vector<lsp::Location> references;
 
+    // Hand what's been found so far to the caller, if it's streaming them
+    auto flushPartial = [&] {
+        if (onPartial && !references.empty()) {
+            onPartial(std::move(references));
+            references.clear();
+        }
+    };
+
     auto targetName = declTok->rawText();
 
     auto findPkgReferencesInDocument = [&](const parsing::ParserMetadata& meta, const URI&) {
@@ -868,12 +939,12 @@ std::optional<std::vector<lsp::Location>> ServerDriver::getDocReferences(
         }
     };
 
-    auto targetLoc = sm.getFullyOriginalLoc(targetSymbol->location);
-    auto targetDoc = getDocument(URI::fromFile(sm.getFullPath(targetLoc.buffer())));
+    std::shared_ptr<SlangDoc> targetDoc;
 
     // Helper to process referencing files with a given finder function
     auto processReferencingFiles = [&](std::string_view name, auto&& finder) {
         for (const auto& filePath : m_indexer.getFilesReferencingSymbol(name)) {
+            lsp::throwIfCancelled();
             if (filePath == targetDoc->getURI().getPath()) {
                 continue;
             }
@@ -881,6 +952,7 @@ std::optional<std::vector<lsp::Location>> ServerDriver::getDocReferences(
             auto fileDoc = getDocument(fileUri);
             if (fileDoc) {
                 finder(fileDoc->getSyntaxTree()->getMetadata(), fileUri);
+                flushPartial();
             }
             else {
                 ERROR("No doc found for {}", filePath.string());
@@ -888,46 +960,44 @@ std::optional<std::vector<lsp::Location>> ServerDriver::getDocReferences(
         }
     };
 
-    // Add refs in declaration file, and remove declaration if requested
-    if (targetDoc) {
-        auto targetAnalysis = targetDoc->getAnalysis();
-        targetAnalysis->addLocalReferences(references, targetSymbol->location, targetName);
-        if (!includeDeclaration) {
-            auto targetLspLoc = lsp::Location{
-                .uri = URI::fromFile(sm.getFullPath(targetLoc.buffer())),
-                .range = toRange(SourceRange(targetLoc, targetLoc + targetSymbol->name.size()), sm),
-            };
-            references.erase(std::remove_if(references.begin(), references.end(),
-                                            [&](const lsp::Location& loc) {
-                                                return loc.uri == targetLspLoc.uri &&
-                                                       loc.range == targetLspLoc.range;
-                                            }),
-                             references.end());
-        }
-    }
-
-    // Add global references
+    // Work out where else to look while the symbol can be used. Other files' analyses are locked
+    // to search them, so this one is released first; the names point into its compilation,
+    // which the analysis keeps alive.
+    auto targetLocation = targetSymbol->location;
+    auto targetLoc = sm.getFullyOriginalLoc(targetLocation);
+    auto targetSymbolName = targetSymbol->name;
+    std::function<void()> addGlobalReferences = [] {};
     switch (targetSymbol->kind) {
         case ast::SymbolKind::Instance: {
-            processReferencingFiles(targetSymbol->as<ast::InstanceSymbol>().getDefinition().name,
-                                    findModuleReferencesInDocument);
+            auto name = targetSymbol->as<ast::InstanceSymbol>().getDefinition().name;
+            addGlobalReferences = [&, name] {
+                processReferencingFiles(name, findModuleReferencesInDocument);
+            };
         } break;
         case ast::SymbolKind::InstanceBody: {
-            processReferencingFiles(
-                targetSymbol->as<ast::InstanceBodySymbol>().getDefinition().name,
-                findModuleReferencesInDocument);
+            auto name = targetSymbol->as<ast::InstanceBodySymbol>().getDefinition().name;
+            addGlobalReferences = [&, name] {
+                processReferencingFiles(name, findModuleReferencesInDocument);
+            };
         } break;
         case ast::SymbolKind::Definition: {
             const auto& definition = targetSymbol->as<ast::DefinitionSymbol>();
+            auto name = definition.name;
             if (definition.definitionKind == ast::DefinitionKind::Interface) {
-                processReferencingFiles(definition.name, findInterfaceReferencesInDocument);
+                addGlobalReferences = [&, name] {
+                    processReferencingFiles(name, findInterfaceReferencesInDocument);
+                };
             }
             else {
-                processReferencingFiles(definition.name, findModuleReferencesInDocument);
+                addGlobalReferences = [&, name] {
+                    processReferencingFiles(name, findModuleReferencesInDocument);
+                };
             }
         } break;
         case ast::SymbolKind::Package: {
-            processReferencingFiles(targetName, findPkgReferencesInDocument);
+            addGlobalReferences = [&] {
+                processReferencingFiles(targetName, findPkgReferencesInDocument);
+            };
         } break;
         default: {
             if (targetSymbol->getParentScope() == nullptr ||
@@ -941,21 +1011,59 @@ std::optional<std::vector<lsp::Location>> ServerDriver::getDocReferences(
             auto& gParentSymbol = parentSymbol.getParentScope()->asSymbol();
             if (gParentSymbol.kind == ast::SymbolKind::CompilationUnit) {
                 // Package and module members
-                addMemberReferences(references, parentSymbol, *targetSymbol);
+                bool parentIsPackage = parentSymbol.kind == ast::SymbolKind::Package;
+                addGlobalReferences = [&, parentName = parentSymbol.name, parentIsPackage] {
+                    addMemberReferences(references, parentName, parentIsPackage, targetLocation,
+                                        targetSymbolName, false, flushPartial);
+                };
             }
             else if (gParentSymbol.kind == ast::SymbolKind::Package &&
                      ast::Type::isKind(parentSymbol.kind)) {
                 // submembers in the case of structs and enums
-                addMemberReferences(references, gParentSymbol, *targetSymbol, true);
+                addGlobalReferences = [&, parentName = gParentSymbol.name] {
+                    addMemberReferences(references, parentName, true, targetLocation,
+                                        targetSymbolName, true, flushPartial);
+                };
             }
             else {
                 if (targetLoc.buffer() != doc->getBuffer()) {
-                    analysis->addLocalReferences(references, targetSymbol->location, targetName);
+                    addGlobalReferences = [&] {
+                        analysis->addLocalReferences(references, targetLocation, targetName);
+                    };
                 }
             }
         }
     }
+    lock.unlock();
 
+    targetDoc = getDocument(URI::fromFile(sm.getFullPath(targetLoc.buffer())));
+
+    // Add refs in declaration file, and remove declaration if requested
+    if (targetDoc) {
+        auto targetAnalysis = targetDoc->getAnalysis();
+        targetAnalysis->addLocalReferences(references, targetLocation, targetName);
+        if (!includeDeclaration) {
+            auto targetLspLoc = lsp::Location{
+                .uri = URI::fromFile(sm.getFullPath(targetLoc.buffer())),
+                .range = toRange(SourceRange(targetLoc, targetLoc + targetSymbolName.size()), sm),
+            };
+            references.erase(std::remove_if(references.begin(), references.end(),
+                                            [&](const lsp::Location& loc) {
+                                                return loc.uri == targetLspLoc.uri &&
+                                                       loc.range == targetLspLoc.range;
+                                            }),
+                             references.end());
+        }
+        flushPartial();
+    }
+
+    // Add global references
+    addGlobalReferences();
+
+    if (onPartial) {
+        flushPartial();
+        return std::vector<lsp::Location>{};
+    }
     return references.empty() ? std::nullopt : std::make_optional(std::move(references));
 }
 
@@ -23,11 +23,13 @@
 #include <filesystem>
 #include <fmt/base.h>
 #include <fmt/ranges.h>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <ranges>
 #include <rfl/Variant.hpp>
 #include <rfl/from_generic.hpp>
+#include <span>
 #include <string>
 #include <string_view>
 #include <variant>
@@ -48,7 +50,9 @@ namespace fs = std::filesystem;
 
 namespace server {
 
-SlangServer::SlangServer(SlangLspClient& client) : m_client(client), m_config(Config()) {
+SlangServer::SlangServer(SlangLspClient& client) :
+    m_client(client), m_config(Config()),
+    m_workspaceSymbolLimit(size_t(std::max(m_config.workspaceSymbolLimit.value(), 0))) {
 
     /// Keep this short to get server started quickly
     registerInitialize();
@@ -89,6 +93,24 @@ lsp::InitializeResult SlangServer::getInitialize(const lsp::InitializeParams& pa
     registerWorkspaceSymbol();
     registerWorkspaceDidChangeWatchedFiles();
 
+    // Only reads index snapshots, so it doesn't wait behind slow document requests
+    markConcurrent("workspace/symbol");
+
+    // Document requests run alongside each other, after the edits sent before them. Cone
+    // tracing stays ordered, since the full compilation isn't locked for concurrent queries.
+    for (auto method : {"textDocument/definition", "textDocument/hover",
+                        "textDocument/documentSymbol", "textDocument/documentLink",
+                        "textDocument/completion", "completionItem/resolve",
+                        "textDocument/documentHighlight", "textDocument/inlayHint",
+                        "textDocument/references", "textDocument/rename",
+                        "textDocument/codeAction"}) {
+        markReadOnly(method);
+    }
+
+    // Server instrumentation, answered even while other requests are busy
+    registerMethod<std::nullopt_t, lsp::MetricsReport, &SlangServer::getMetrics>("slang/metrics");
+    markConcurrent("slang/metrics");
+
     // LSP Lifecycle
     registerInitialized();
 
@@ -157,6 +179,9 @@ lsp::InitializeResult SlangServer::getInitialize(const lsp::InitializeParams& pa
         WARN("No workspace folder or root provided");
     }
 
+    if (params.capabilities.window && params.capabilities.window->workDoneProgress.value_or(false))
+        m_indexingProgress.supported = true;
+
     loadConfig();
 
     if (params.capabilities.experimental) {
@@ -238,6 +263,14 @@ void SlangServer::onInitialized(const lsp::InitializedParams&) {
     INFO("Server initialized at {}", m_workspaceFolder ? m_workspaceFolder->uri.getPath() : "none");
     m_client.setConfig(m_config);
 
+    {
+        // Indexing may have started during initialize, before progress could be reported
+        std::lock_guard lock(m_indexingProgress.mutex);
+        m_indexingProgress.initialized = true;
+        if (m_indexingProgress.supported && m_indexingProgress.done < m_indexingProgress.total)
+            beginIndexingProgress();
+    }
+
     if (m_workspaceFolder) {
         auto options = lsp::DidChangeWatchedFilesRegistrationOptions{
             .watchers{
@@ -278,6 +311,10 @@ void SlangServer::setExplore() {
     m_driver->diagClient->pushDiags();
 }
 
+lsp::MetricsReport SlangServer::getMetrics(std::monostate) {
+    return metrics.report();
+}
+
 std::monostate SlangServer::setTopLevel(const std::string& path) {
     if (path.empty()) {
         setExplore();
@@ -508,6 +545,7 @@ std::vector<std::string> SlangServer::getLoads(const std::string& path) {
 void SlangServer::loadConfig(const Config& config, bool forceIndexing) {
     auto old_config = m_config;
     m_config = Config(config);
+    m_workspaceSymbolLimit = size_t(std::max(m_config.workspaceSymbolLimit.value(), 0));
 
     if (m_config.build.value().has_value()) {
         m_client.showInfo("Using build file: " + *m_config.build.value());
@@ -517,6 +555,25 @@ void SlangServer::loadConfig(const Config& config, bool forceIndexing) {
         setExplore();
     }
 
+    // Indexing runs in the background; tests expect the index to be complete once loaded
+    const bool isTest = std::getenv("SLANG_SERVER_TESTS") != nullptr;
+    auto onProgress = [this](size_t done, size_t total) { onIndexingProgress(done, total); };
+    auto prepareIndexing = [&] {
+        m_indexer.cancelIndexing();
+
+        // Persist the index between sessions; tests index from scratch
+        if (m_workspaceFolder && m_config.indexCache.value() && !isTest) {
+            m_indexer.setCacheFile(fs::path(m_workspaceFolder->uri.getPath()) / ".slang" /
+                                   "cache" / "index.cache");
+        }
+        else {
+            m_indexer.setCacheFile(std::nullopt);
+        }
+        m_indexer.setExtractMode(m_config.indexWithParser.value() ? Indexer::ExtractMode::Parse
+                                                                  : Indexer::ExtractMode::Scan);
+        m_indexer.setNumThreads(m_config.indexingThreads.value());
+    };
+
     if (!m_config.indexGlobs.get().empty() || !m_config.excludeDirs.get().empty()) {
         // Deprecated config globs
         WARN("Using legacy indexGlobs or excludeDirs from config, please migrate to 'index' "
@@ -535,17 +592,22 @@ void SlangServer::loadConfig(const Config& config, bool forceIndexing) {
                 indexGlobs = std::move(filtered);
             }
             INFO("Indexing with globs: {}", fmt::join(indexGlobs, ", "));
-            m_indexer.setNumThreads(m_config.indexingThreads.value());
-            m_indexer.startIndexing(indexGlobs, m_config.excludeDirs.value());
+            prepareIndexing();
+            m_indexer.startBackgroundIndexing(indexGlobs, m_config.excludeDirs.value(),
+                                              onProgress);
+            if (isTest)
+                m_indexer.waitForIndexing();
         }
     }
     else if (forceIndexing) {
         auto maybePath = m_workspaceFolder.has_value()
-                             ? std::optional<std::string_view>(m_workspaceFolder->uri.getPath())
+                             ? std::optional<std::string>(m_workspaceFolder->uri.getPath())
                              : std::nullopt;
 
-        m_indexer.setNumThreads(m_config.indexingThreads.value());
-        m_indexer.startIndexing(m_config.index.value(), maybePath);
+        prepareIndexing();
+        m_indexer.startBackgroundIndexing(m_config.index.value(), maybePath, onProgress);
+        if (isTest)
+            m_indexer.waitForIndexing();
     }
 
     // Send config to editor client if it needs to parse general configs
@@ -667,15 +729,120 @@ std::optional<std::vector<lsp::DocumentHighlight>> SlangServer::getDocDocumentHi
 
 std::monostate SlangServer::onShutdown(const std::nullopt_t&) {
     INFO("Server shutting down");
+    // A partial index isn't worth saving over the last complete one
+    if (m_indexer.isIndexing()) {
+        m_indexer.cancelIndexing();
+        return std::monostate{};
+    }
+    // Pick up files re-indexed since startup (saves, watched file changes)
+    m_indexer.saveCache();
     return std::monostate{};
 }
 
 void SlangServer::onDocDidOpen(const lsp::DidOpenTextDocumentParams& params) {
     m_driver->openDocument(params.textDocument.uri, params.textDocument.text);
+
+    // Index what this document depends on ahead of the rest of the workspace
+    if (!m_indexer.isIndexing())
+        return;
+    if (auto doc = m_driver->getDocument(params.textDocument.uri)) {
+        std::vector<std::string> names;
+        doc->getSyntaxTree()->getMetadata().visitReferencedSymbols(
+            [&](std::string_view name) { names.emplace_back(name); });
+        m_indexer.prioritize(names);
+    }
+}
+
+void SlangServer::onIndexingProgress(size_t done, size_t total) {
+    std::lock_guard lock(m_indexingProgress.mutex);
+    m_indexingProgress.done = done;
+    m_indexingProgress.total = total;
+    if (!m_indexingProgress.supported || !m_indexingProgress.initialized)
+        return;
+
+    if (!m_indexingProgress.token) {
+        if (done < total)
+            beginIndexingProgress();
+        return;
+    }
+
+    if (done >= total) {
+        // Progress that was never shown doesn't need ending; the token's late creation is ignored
+        if (m_indexingProgress.created) {
+            m_client.onProgress(lsp::ProgressParams{
+                .token = *m_indexingProgress.token,
+                .value = rfl::to_generic<rfl::UnderlyingEnums>(
+                    lsp::WorkDoneProgressEnd{.message = fmt::format("Indexed {} files", total)}),
+            });
+        }
+        m_indexingProgress.token.reset();
+        return;
+    }
+
+    if (!m_indexingProgress.created)
+        return;
+
+    auto percentage = static_cast<lsp::uint>(done * 100 / total);
+    if (percentage == m_indexingProgress.percentage)
+        return;
+    m_indexingProgress.percentage = percentage;
+    m_client.onProgress(lsp::ProgressParams{
+        .token = *m_indexingProgress.token,
+        .value = rfl::to_generic<rfl::UnderlyingEnums>(lsp::WorkDoneProgressReport{
+            .message = fmt::format("{}/{} files", done, total),
+            .percentage = percentage,
+        }),
+    });
+}
+
+void SlangServer::beginIndexingProgress() {
+    auto& progress = m_indexingProgress;
+    progress.token = lsp::ProgressToken(fmt::format("slang-indexing-{}", progress.nextToken++));
+    progress.created = false;
+    // The client calls back once it has the token, on the thread reading messages
+    m_client.createWorkDoneProgress(*progress.token, [this, token = *progress.token] {
+        onIndexingProgressCreated(token);
+    });
+}
+
+void SlangServer::onIndexingProgressCreated(const lsp::ProgressToken& token) {
+    std::lock_guard lock(m_indexingProgress.mutex);
+    auto& progress = m_indexingProgress;
+    // Indexing may have finished, and even started again with a new token, in the meantime
+    if (!progress.token || rfl::json::write(*progress.token) != rfl::json::write(token))
+        return;
+
+    progress.created = true;
+    progress.percentage = static_cast<lsp::uint>(progress.done * 100 / progress.total);
+    m_client.onProgress(lsp::ProgressParams{
+        .token = token,
+        .value = rfl::to_generic<rfl::UnderlyingEnums>(lsp::WorkDoneProgressBegin{
+            .title = "Indexing",
+            .message = fmt::format("{}/{} files", progress.done, progress.total),
+            .percentage = progress.percentage,
+        }),
+    });
 }
 
 void SlangServer::onDocDidChange(const lsp::DidChangeTextDocumentParams& params) {
     m_driver->onDocDidChange(params);
+    scheduleDocUpdates();
+}
+
+void SlangServer::scheduleDocUpdates() {
+    if (m_updatesScheduled)
+        return;
+
+    auto delay = m_driver->flushDueUpdates();
+    if (!delay)
+        return;
+
+    m_updatesScheduled = postDelayed(*delay, [this] {
+        m_updatesScheduled = false;
+        scheduleDocUpdates();
+    });
+    if (!m_updatesScheduled)
+        m_driver->flushUpdates();
 }
 
 void SlangServer::onDocDidSave(const lsp::DidSaveTextDocumentParams& params) {
@@ -684,7 +851,7 @@ void SlangServer::onDocDidSave(const lsp::DidSaveTextDocumentParams& params) {
         return;
     }
 
-    auto doc = m_driver->getDocument(params.textDocument.uri);
+    auto doc = m_driver->findDocument(params.textDocument.uri);
     if (!doc) {
         throw std::runtime_error(
             fmt::format("Document {} not found", params.textDocument.uri.getPath()));
@@ -742,31 +909,29 @@ void SlangServer::onWorkspaceDidChangeWatchedFiles(const lsp::DidChangeWatchedFi
     m_indexer.onWorkspaceDidChangeWatchedFiles(params);
 }
 
-static bool fuzzyMatch(std::string_view query, std::string_view candidate) {
-    auto qi = query.begin();
-    for (auto ci = candidate.begin(); qi != query.end() && ci != candidate.end(); ++ci) {
-        if (static_cast<char>(std::tolower(static_cast<unsigned char>(*qi))) ==
-            static_cast<char>(std::tolower(static_cast<unsigned char>(*ci)))) {
-            ++qi;
-        }
-    }
-    return qi == query.end();
-}
-
 rfl::Variant<std::vector<lsp::SymbolInformation>, std::vector<lsp::WorkspaceSymbol>, std::monostate>
 SlangServer::getWorkspaceSymbol(const lsp::WorkspaceSymbolParams& params) {
     slang::TimeTraceScope _timeScope("getWorkspaceSymbol", "");
 
     std::vector<lsp::WorkspaceSymbol> result;
 
-    m_indexer.forEachSymbol([&](const std::string& name, const Indexer::GlobalSymbolLoc& entry) {
-        if (!params.query.empty() && !fuzzyMatch(params.query, name))
-            return;
-        result.emplace_back(
-            lsp::WorkspaceSymbol{.location = lsp::LocationUriOnly{URI::fromFile(*entry.uri)},
-                                 .name = name,
-                                 .kind = toSymbolKind(entry.kind)});
-    });
+    // Each ranked batch goes out as soon as it's found if the client takes partial results
+    auto onBatch = [&](std::span<const Indexer::SymbolMatch> matches) {
+        for (const auto& match : matches) {
+            result.emplace_back(lsp::WorkspaceSymbol{
+                .location = lsp::LocationUriOnly{URI::fromFile(*match.loc.uri)},
+                .name = std::string(match.name),
+                .kind = toSymbolKind(match.loc.kind)});
+        }
+        if (params.partialResultToken) {
+            sendPartialResult(*params.partialResultToken, result);
+            result.clear();
+        }
+    };
+
+    size_t limit = m_workspaceSymbolLimit;
+    m_indexer.findSymbols(params.query, limit > 0 ? limit : std::numeric_limits<size_t>::max(),
+                          onBatch);
 
     return result;
 }
@@ -791,8 +956,8 @@ rfl::Variant<std::vector<lsp::CompletionItem>, lsp::CompletionList, std::monosta
     auto prevText = doc->getPrevText(params.position);
     auto ctx = CompletionContext::fromLocation(*doc, loc, *params.context, prevText);
 
-    INFO("Completion: kind={} trigger='{}' prev='{}{}'", toString(ctx.lspContext.triggerKind),
-         ctx.triggerChar(), ctx.prev2Char(), ctx.lastChar());
+    LOG_DEBUG("Completion: kind={} trigger='{}' prev='{}{}'", toString(ctx.lspContext.triggerKind),
+              ctx.triggerChar(), ctx.prev2Char(), ctx.lastChar());
 
     m_driver->completions.getCompletions(results, doc, loc, ctx);
 
@@ -821,14 +986,22 @@ std::optional<std::vector<lsp::InlayHint>> SlangServer::getDocInlayHint(
         return {};
     }
     auto hints = doc->getAnalysis()->getInlayHints(params.range, m_config.inlayHints.get());
-    INFO("Providing {} inlay hints for {}", hints.size(), params.textDocument.uri.getPath());
+    LOG_DEBUG("Providing {} inlay hints for {}", hints.size(), params.textDocument.uri.getPath());
     return hints;
 }
 
 std::optional<std::vector<lsp::Location>> SlangServer::getDocReferences(
     const lsp::ReferenceParams& params) {
-    return m_driver->getDocReferences(params.textDocument.uri, params.position,
-                                      params.context.includeDeclaration);
+    if (!params.partialResultToken) {
+        return m_driver->getDocReferences(params.textDocument.uri, params.position,
+                                          params.context.includeDeclaration);
+    }
+
+    // Stream the references in each file as it's searched
+    auto& token = *params.partialResultToken;
+    return m_driver->getDocReferences(
+        params.textDocument.uri, params.position, params.context.includeDeclaration,
+        [&](std::vector<lsp::Location> batch) { sendPartialResult(token, batch); });
 }
 
 std::optional<lsp::WorkspaceEdit> SlangServer::getDocRename(const lsp::RenameParams& params) {
@@ -16,6 +16,7 @@
 
 #include "slang/ast/Compilation.h"
 #include "slang/text/SourceManager.h"
+#include "slang/util/TimeTrace.h"
 
 namespace fs = std::filesystem;
 
@@ -33,6 +34,7 @@ ServerCompilation::ServerCompilation(std::vector<std::shared_ptr<SlangDoc>> docu
 }
 
 void ServerCompilation::refresh() {
+    slang::TimeTraceScope timeScope("refreshCompilation", m_top.value_or(""));
     m_analysis = std::make_unique<ServerCompilationAnalysis>(m_documents, m_options,
                                                              m_sourceManager);
 }
@@ -23,7 +23,7 @@ void addAddDefineAction(std::vector<rfl::Variant<lsp::Command, lsp::CodeAction>>
         return;
 
     // Only show when the macro is not defined in the current file
-    if (ctx.analysis.macros.find(macroName) != ctx.analysis.macros.end())
+    if (ctx.analysis.getMacros().find(macroName) != ctx.analysis.getMacros().end())
         return;
 
     results.push_back(lsp::CodeAction{
@@ -35,9 +35,9 @@ std::vector<rfl::Variant<lsp::Command, lsp::CodeAction>> CodeActionDispatch::get
 
     auto loc = toSourceLocation(doc->getBuffer(), params.range.start, m_sourceManager);
     if (loc) {
-        token = analysis->syntaxes.getWordTokenAt(*loc);
+        token = analysis->getSyntaxes().getWordTokenAt(*loc);
         if (token)
-            syntax = analysis->syntaxes.getTokenParent(token);
+            syntax = analysis->getSyntaxes().getTokenParent(token);
     }
 
     CodeActionContext ctx{
@@ -57,8 +57,8 @@ static std::string reindent(const std::string& text, lsp::uint column) {
 
 void addExpandMacroAction(std::vector<rfl::Variant<lsp::Command, lsp::CodeAction>>& results,
                           const CodeActionContext& ctx) {
-    auto it = ctx.analysis.syntaxes.macroExpansions.find(ctx.syntax);
-    if (it == ctx.analysis.syntaxes.macroExpansions.end())
+    auto it = ctx.analysis.getSyntaxes().macroExpansions.find(ctx.syntax);
+    if (it == ctx.analysis.getSyntaxes().macroExpansions.end())
         return;
 
     auto usageRange = toRange(ctx.syntax->sourceRange(), ctx.sourceManager);
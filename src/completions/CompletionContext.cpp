@@ -112,7 +112,7 @@ CompletionContext CompletionContext::fromLocation(SlangDoc& doc, SourceLocation
     // for the entire lifetime of the CompletionContext.
     ctx.analysis = doc.getAnalysis();
     ctx.scope = ctx.analysis->getScopeAt(loc);
-    ctx.syntax = ctx.analysis->syntaxes.getSyntaxAt(loc);
+    ctx.syntax = ctx.analysis->getSyntaxes().getSyntaxAt(loc);
 
     if (!ctx.syntax) {
         // No syntax node at location - assume module item context if we have a scope
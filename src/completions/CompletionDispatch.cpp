@@ -13,6 +13,7 @@
 #include "completions/Completions.h"
 #include "completions/SystemTaskCompletions.h"
 #include "document/ShallowAnalysis.h"
+#include "lsp/JsonRpc.h"
 #include "lsp/LspTypes.h"
 #include "util/Converters.h"
 #include "util/Formatting.h"
@@ -35,6 +36,12 @@ CompletionDispatch::CompletionDispatch(ServerDriver& driver, const Indexer& inde
     m_driver(driver), m_indexer(indexer), m_sourceManager(sourceManager), m_options(options) {
 }
 
+void CompletionDispatch::setLastScope(std::shared_ptr<SlangDoc> doc, std::string scope) {
+    std::lock_guard lock(m_lastMutex);
+    m_lastDoc = std::move(doc);
+    m_lastScope = std::move(scope);
+}
+
 void CompletionDispatch::getCompletions(std::vector<lsp::CompletionItem>& results,
                                         std::shared_ptr<SlangDoc> doc, slang::SourceLocation loc,
                                         const CompletionContext& ctx) {
@@ -73,6 +80,7 @@ void CompletionDispatch::getCompletions(std::vector<lsp::CompletionItem>& result
             ERROR("No analysis or compilation available for document {}", doc->getPath());
             return;
         }
+        auto lock = analysis->lockQueries();
 
         // The triggerChar is the second ':', so we need to look before the first ':'
         auto packageToken = analysis->getTokenAt(loc - 3);
@@ -82,7 +90,7 @@ void CompletionDispatch::getCompletions(std::vector<lsp::CompletionItem>& result
         }
 
         auto packageName = std::string{packageToken->valueText()};
-        INFO("Looking for package members in package: {}", packageName);
+        LOG_DEBUG("Looking for package members in package: {}", packageName);
 
         auto& compilation = analysis->getCompilation();
         auto pkg = compilation->getPackage(packageName);
@@ -90,8 +98,7 @@ void CompletionDispatch::getCompletions(std::vector<lsp::CompletionItem>& result
             ERROR("No package found for {}", packageName);
             return;
         }
-        m_lastDoc = doc;
-        m_lastScope = pkg->getHierarchicalPath();
+        setLastScope(doc, pkg->getHierarchicalPath());
         auto originalScope = analysis->getScopeAt(loc);
         completions::addMemberCompletions(results, pkg, CompletionContextKind::Expression,
                                           originalScope);
@@ -114,6 +121,7 @@ void CompletionDispatch::getCompletions(std::vector<lsp::CompletionItem>& result
         // Member completions
         // Capture analysis once to avoid invalidation from repeated getAnalysis() calls.
         auto analysis = doc->getAnalysis();
+        auto lock = analysis->lockQueries();
         auto exprToken = analysis->getTokenAt(loc - 2);
         if (!exprToken) {
             WARN("No expression token found before '.'");
@@ -128,11 +136,16 @@ void CompletionDispatch::getCompletions(std::vector<lsp::CompletionItem>& result
                 WARN("No symbol found in index for {}", exprToken->valueText());
                 return;
             }
+            // Only one analysis is locked at a time; the symbol is used under its own
+            lock.unlock();
+            lsp::throwIfCancelled();
             auto doc = m_driver.getDocument(URI::fromFile(*symbolLoc->uri));
             if (!doc) {
                 return;
             }
-            sym = doc->getAnalysis()->getDefinition(exprToken->valueText());
+            analysis = doc->getAnalysis();
+            lock = analysis->lockQueries();
+            sym = analysis->getDefinition(exprToken->valueText());
             if (!sym) {
                 WARN("No symbol found in compilation for {}", exprToken->valueText());
                 return;
@@ -159,10 +172,9 @@ void CompletionDispatch::getCompletions(std::vector<lsp::CompletionItem>& result
             WARN("No scope found for sym {}: {}", sym->getHierarchicalPath(), toString(sym->kind));
             return;
         }
-        m_lastDoc = doc;
-        m_lastScope = scope ? scope->asSymbol().getHierarchicalPath() : "";
-        INFO("Getting hier completions for symbol {} in scope {}", sym->name,
-             sym->getHierarchicalPath());
+        setLastScope(doc, scope ? scope->asSymbol().getHierarchicalPath() : "");
+        LOG_DEBUG("Getting hier completions for symbol {} in scope {}", sym->name,
+                  sym->getHierarchicalPath());
         std::string_view prevLabel;
         for (auto& member : scope->members()) {
             if (member.name.empty() || member.name == prevLabel) {
@@ -174,12 +186,12 @@ void CompletionDispatch::getCompletions(std::vector<lsp::CompletionItem>& result
     }
     else {
         // Generic scope-based completions: members in scope + workspace-indexed symbols.
+        auto lock = ctx.analysis->lockQueries();
         auto scope = ctx.scope;
         if (scope) {
-            m_lastScope = scope->asSymbol().getHierarchicalPath();
-            m_lastDoc = doc;
+            setLastScope(doc, scope->asSymbol().getHierarchicalPath());
         }
-        INFO("General completions with context: {}", toString(ctx.kind));
+        LOG_DEBUG("General completions with context: {}", toString(ctx.kind));
 
         completions::addIndexedCompletions(results, m_indexer, ctx);
         if (scope) {
@@ -191,12 +203,12 @@ void CompletionDispatch::getCompletions(std::vector<lsp::CompletionItem>& result
         // (`int q[$]`), array selectors (`q[$]`), etc. Triggering once the user types `$` lets
         // the editor's client-side filter narrow as they type more.
         if (completions::inSystemTaskIdent(ctx.prevText)) {
-            if (auto analysis = doc->getAnalysis(); analysis && analysis->getCompilation()) {
-                completions::addSystemSubroutineCompletions(results, *analysis->getCompilation());
+            if (auto& compilation = ctx.analysis->getCompilation()) {
+                completions::addSystemSubroutineCompletions(results, *compilation);
             }
         }
 
-        INFO("Returning {} completions in {} context", results.size(), toString(ctx.kind));
+        LOG_DEBUG("Returning {} completions in {} context", results.size(), toString(ctx.kind));
     }
 }
 
@@ -251,7 +263,7 @@ void CompletionDispatch::resolveMacroCompletion(lsp::CompletionItem& item) {
 }
 
 void CompletionDispatch::getCompletionItemResolve(lsp::CompletionItem& item) {
-    INFO("Resolving completion item: {}", item.label);
+    LOG_DEBUG("Resolving completion item: {}", item.label);
     if (!item.label.empty() && item.label[0] == '$')
         return;
 
@@ -265,24 +277,33 @@ void CompletionDispatch::getCompletionItemResolve(lsp::CompletionItem& item) {
             break;
         }
         default: {
-            SLANG_ASSERT(m_lastDoc != nullptr);
-            auto& comp = m_lastDoc->getCompilation();
+            std::shared_ptr<SlangDoc> lastDoc;
+            std::string lastScope;
+            {
+                std::lock_guard lock(m_lastMutex);
+                lastDoc = m_lastDoc;
+                lastScope = m_lastScope;
+            }
+            SLANG_ASSERT(lastDoc != nullptr);
+            auto analysis = lastDoc->getAnalysis();
+            auto lock = analysis->lockQueries();
+            auto& comp = analysis->getCompilation();
             if (!comp) {
                 ERROR("No compilation available for completion resolution");
                 return;
             }
             const ast::Scope* scope = nullptr;
             for (auto member : comp->getRootNoFinalize().topInstances) {
-                if (member->name == m_lastScope) {
+                if (member->name == lastScope) {
                     scope = &(member->body.as<ast::Scope>());
                     break;
                 }
             }
             if (scope == nullptr) {
-                scope = comp->getPackage(m_lastScope);
+                scope = comp->getPackage(lastScope);
             }
             if (scope == nullptr) {
-                ERROR("No scope found for last scope {}", m_lastScope);
+                ERROR("No scope found for last scope {}", lastScope);
                 return;
             }
             completions::resolveMemberCompletion(*scope, item);
@@ -562,7 +562,7 @@ void addMemberCompletions(std::vector<lsp::CompletionItem>& results, const slang
                 for (auto import : importData->wildcardImports) {
                     auto package = import->getPackage();
                     if (package != nullptr) {
-                        INFO("Adding wildcard imports from package {}", package->name);
+                        LOG_DEBUG("Adding wildcard imports from package {}", package->name);
                         addMemberCompletions(results, package, contextKind, originalScope, false);
                     }
                 }
@@ -663,7 +663,7 @@ void addIndexedCompletions(std::vector<lsp::CompletionItem>& results, const Inde
                            const CompletionContext& ctx) {
     std::unordered_set<std::string_view> seenNames;
 
-    indexer.forEachSymbol([&](const std::string& name, const Indexer::GlobalSymbolLoc& entry) {
+    indexer.forEachSymbol([&](std::string_view name, const Indexer::GlobalSymbolLoc& entry) {
         // Only process first entry for each unique name
         if (seenNames.count(name))
             return;
@@ -684,7 +684,7 @@ void addIndexedCompletions(std::vector<lsp::CompletionItem>& results, const Inde
                 detail = " Interface";
                 if (ctx.kind != CompletionContextKind::ModuleMember) {
                     // Designates this completion as a type rather than an instance
-                    insertText = name;
+                    insertText = std::string(name);
                 }
             } break;
             case syntax::SyntaxKind::PackageDeclaration:
@@ -698,13 +698,13 @@ void addIndexedCompletions(std::vector<lsp::CompletionItem>& results, const Inde
                 return;
         }
         results.push_back(lsp::CompletionItem{
-            .label = name,
+            .label = std::string(name),
             .labelDetails =
                 lsp::CompletionItemLabelDetails{
                     .detail = detail,
                 },
             .kind = lsp::CompletionItemKind::Module,
-            .filterText = name,
+            .filterText = std::string(name),
             .insertText = insertText,
         });
     });
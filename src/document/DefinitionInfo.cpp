@@ -269,6 +269,8 @@ void DefinitionInfo::SyntaxTarget::renderMacroExpansion(markup::Document& doc,
 lsp::MarkupContent DefinitionInfo::SymbolTarget::getHover(const SourceManager& sm,
                                                           BufferID /*docBuffer*/,
                                                           const Config::HoverConfig& hovers) const {
+    // Describing the symbol may elaborate more of its compilation
+    auto lock = analysis->lockQueries();
     markup::Document doc;
     renderSymbolHeader(doc.addParagraph(), *symbol, analysis);
     syntax.renderCode(doc, hovers);
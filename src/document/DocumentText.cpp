@@ -0,0 +1,215 @@
+//------------------------------------------------------------------------------
+// DocumentText.cpp
+// Edit buffer for the text of an open document
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#include "document/DocumentText.h"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace server {
+
+namespace {
+
+bool isLineBreak(char c) {
+    return c == '\n' || c == '\r';
+}
+
+/// Same as SourceManager::computeLineOffsets
+void computeLineStarts(std::string_view text, std::vector<size_t>& starts) {
+    starts.clear();
+    starts.push_back(0);
+    for (size_t i = 0; i < text.size(); i++) {
+        if (!isLineBreak(text[i]))
+            continue;
+        if (i + 1 < text.size() && isLineBreak(text[i + 1]) && text[i + 1] != text[i])
+            i++;
+        starts.push_back(i + 1);
+    }
+}
+
+} // namespace
+
+class DocumentText::Reader {
+public:
+    Reader(const DocumentText& text, size_t offset) : m_text(text), m_offset(offset) {
+        size_t start = 0;
+        for (; m_piece < m_text.m_pieces.size(); m_piece++) {
+            size_t length = m_text.m_pieces[m_piece].length;
+            if (offset < start + length) {
+                m_inPiece = offset - start;
+                return;
+            }
+            start += length;
+        }
+    }
+
+    bool atEnd() const { return m_piece == m_text.m_pieces.size(); }
+    size_t offset() const { return m_offset; }
+
+    char get() const {
+        if (atEnd())
+            return '\0';
+        return m_text.pieceData(m_text.m_pieces[m_piece])[m_inPiece];
+    }
+
+    void advance() {
+        m_offset++;
+        if (++m_inPiece == m_text.m_pieces[m_piece].length) {
+            m_piece++;
+            m_inPiece = 0;
+        }
+    }
+
+    /// Move past the line break here, if there is one
+    bool skipLineBreak() {
+        char c = get();
+        if (!isLineBreak(c))
+            return false;
+        advance();
+        if (char next = get(); isLineBreak(next) && next != c)
+            advance();
+        return true;
+    }
+
+private:
+    const DocumentText& m_text;
+    size_t m_offset;
+    size_t m_piece = 0;
+    size_t m_inPiece = 0;
+};
+
+DocumentText::DocumentText(std::string_view text) {
+    rebase(text);
+    computeLineStarts(text, m_lineStarts);
+}
+
+std::optional<size_t> DocumentText::offsetOf(size_t line, size_t character) const {
+    if (line >= m_lineStarts.size())
+        return std::nullopt;
+    return std::min(m_lineStarts[line] + character, m_size);
+}
+
+void DocumentText::replace(size_t offset, size_t length, std::string_view text) {
+    offset = std::min(offset, m_size);
+    length = std::min(length, m_size - offset);
+    if (length == 0 && text.empty())
+        return;
+
+    size_t first = split(offset);
+    size_t last = split(offset + length);
+    m_pieces.erase(m_pieces.begin() + ptrdiff_t(first), m_pieces.begin() + ptrdiff_t(last));
+
+    if (!text.empty()) {
+        // Typing extends the piece added by the previous keystroke
+        if (first > 0 && m_pieces[first - 1].added &&
+            m_pieces[first - 1].start + m_pieces[first - 1].length == m_added.size()) {
+            m_pieces[first - 1].length += text.size();
+        }
+        else {
+            m_pieces.insert(m_pieces.begin() + ptrdiff_t(first),
+                            Piece{.added = true, .start = m_added.size(), .length = text.size()});
+        }
+        m_added += text;
+    }
+
+    m_size = m_size - length + text.size();
+    m_modified = true;
+    updateLines(offset, length, text.size());
+}
+
+void DocumentText::assign(std::string_view text) {
+    m_original = {};
+    m_added.assign(text);
+    m_pieces.clear();
+    if (!text.empty())
+        m_pieces.push_back(Piece{.added = true, .start = 0, .length = text.size()});
+    m_size = text.size();
+    m_modified = true;
+    computeLineStarts(m_added, m_lineStarts);
+}
+
+std::string DocumentText::str() const {
+    std::string result;
+    result.reserve(m_size);
+    appendTo(result);
+    return result;
+}
+
+void DocumentText::rebase(std::string_view text) {
+    m_original = text;
+    m_added.clear();
+    m_pieces.clear();
+    if (!text.empty())
+        m_pieces.push_back(Piece{.added = false, .start = 0, .length = text.size()});
+    m_size = text.size();
+    m_modified = false;
+}
+
+size_t DocumentText::split(size_t offset) {
+    size_t start = 0;
+    for (size_t i = 0; i < m_pieces.size(); i++) {
+        if (offset == start)
+            return i;
+
+        auto& piece = m_pieces[i];
+        if (offset < start + piece.length) {
+            size_t head = offset - start;
+            Piece rest{.added = piece.added,
+                       .start = piece.start + head,
+                       .length = piece.length - head};
+            piece.length = head;
+            m_pieces.insert(m_pieces.begin() + ptrdiff_t(i) + 1, rest);
+            return i + 1;
+        }
+        start += piece.length;
+    }
+    return m_pieces.size();
+}
+
+void DocumentText::updateLines(size_t offset, size_t length, size_t inserted) {
+    auto& starts = m_lineStarts;
+
+    // Lines starting inside the replaced text are gone, and the ones after it move
+    size_t first = size_t(std::ranges::upper_bound(starts, offset) - starts.begin());
+    size_t last = size_t(std::ranges::upper_bound(starts, offset + length) - starts.begin());
+    auto delta = ptrdiff_t(inserted) - ptrdiff_t(length);
+    auto moved = [&](size_t i) { return size_t(ptrdiff_t(starts[i]) + delta); };
+
+    // Rescan from the start of the previous line, since the line break before the edited line
+    // can combine with inserted text (\r then \n). Once past the inserted text, a line starting
+    // where one did before means the rest are unchanged.
+    size_t kept = first >= 2 ? first - 2 : 0;
+    size_t insertedEnd = offset + inserted;
+    std::vector<size_t> rescanned;
+    size_t next = last;
+    bool synced = false;
+    for (Reader reader(*this, starts[kept]); !reader.atEnd();) {
+        if (!reader.skipLineBreak()) {
+            reader.advance();
+            continue;
+        }
+
+        size_t start = reader.offset();
+        while (next < starts.size() && moved(next) < start)
+            next++;
+        if (start >= insertedEnd && next < starts.size() && moved(next) == start) {
+            synced = true;
+            break;
+        }
+        rescanned.push_back(start);
+    }
+    if (!synced)
+        next = starts.size();
+
+    for (size_t i = next; i < starts.size(); i++)
+        starts[i] = moved(i);
+    starts.erase(starts.begin() + ptrdiff_t(kept) + 1, starts.begin() + ptrdiff_t(next));
+    starts.insert(starts.begin() + ptrdiff_t(kept) + 1, rescanned.begin(), rescanned.end());
+}
+
+} // namespace server
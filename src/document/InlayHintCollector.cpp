@@ -8,6 +8,7 @@
 #include "util/Converters.h"
 #include "util/Formatting.h"
 #include "util/Logging.h"
+#include <algorithm>
 
 #include "slang/ast/Symbol.h"
 #include "slang/ast/symbols/ClassSymbols.h"
@@ -259,8 +260,8 @@ void InlayHintCollector::handle(const MacroUsageSyntax& syntax) {
     }
 
     // TODO: maybe we should also use the index for these?
-    auto defInfo = m_analysis.macros.find(syntax.directive.valueText().substr(1));
-    if (defInfo == m_analysis.macros.end()) {
+    auto defInfo = m_analysis.getMacros().find(syntax.directive.valueText().substr(1));
+    if (defInfo == m_analysis.getMacros().end()) {
         return;
     }
     if (!defInfo->second->formalArguments) {
@@ -367,31 +368,33 @@ void InlayHintCollector::collectHints() {
         ERROR("Invalid range for inlay hints");
         return;
     }
-    auto start = m_analysis.syntaxes.collectedHints.lower_bound(slangStart->offset());
-    auto end = m_analysis.syntaxes.collectedHints.upper_bound(slangEnd->offset());
+    auto& hints = m_analysis.getSyntaxes().collectedHints;
+    using Hint = SyntaxIndexer::Hint;
+    auto start = std::ranges::lower_bound(hints, slangStart->offset(), {}, &Hint::offset);
+    auto end = std::ranges::upper_bound(hints, slangEnd->offset(), {}, &Hint::offset);
 
     // Expand start backward to include nodes that begin before the range but extend into it
-    while (start != m_analysis.syntaxes.collectedHints.begin()) {
+    while (start != hints.begin()) {
         auto prev = std::prev(start);
-        if (prev->second->sourceRange().end().offset() <= slangStart->offset()) {
+        if (prev->node->sourceRange().end().offset() <= slangStart->offset()) {
             break;
         }
         start = prev;
     }
 
     for (auto it = start; it != end; ++it) {
-        switch (it->second->kind) {
+        switch (it->node->kind) {
             case syntax::SyntaxKind::HierarchyInstantiation:
-                handle(it->second->as<HierarchyInstantiationSyntax>());
+                handle(it->node->as<HierarchyInstantiationSyntax>());
                 break;
             case syntax::SyntaxKind::MacroUsage:
-                handle(it->second->as<MacroUsageSyntax>());
+                handle(it->node->as<MacroUsageSyntax>());
                 break;
             case syntax::SyntaxKind::InvocationExpression:
-                handle(it->second->as<InvocationExpressionSyntax>());
+                handle(it->node->as<InvocationExpressionSyntax>());
                 break;
             case syntax::SyntaxKind::ClassName:
-                handle(it->second->as<ClassNameSyntax>());
+                handle(it->node->as<ClassNameSyntax>());
             default:
                 break;
         }
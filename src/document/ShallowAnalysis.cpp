@@ -9,12 +9,16 @@
 #include "document/ShallowAnalysis.h"
 
 #include "document/InlayHintCollector.h"
+#include "lsp/JsonRpc.h"
 #include "lsp/LspTypes.h"
 #include "util/Converters.h"
 #include "util/Logging.h"
 #include "util/SlangExtensions.h"
+#include <chrono>
 #include <fmt/format.h>
+#include <fmt/ranges.h>
 #include <memory>
+#include <ranges>
 #include <string_view>
 
 #include "slang/analysis/AnalysisManager.h"
@@ -35,6 +39,7 @@
 #include "slang/syntax/SyntaxTree.h"
 #include "slang/text/SourceLocation.h"
 #include "slang/text/SourceManager.h"
+#include "slang/util/TimeTrace.h"
 #include "slang/util/Util.h"
 namespace server {
 using namespace slang;
@@ -56,56 +61,112 @@ static bool symbolsMatch(const ast::Symbol* a, const ast::Symbol* b) {
     }
     return false;
 }
+
+namespace {
+/// Build one stage of an analysis, recording it in the time trace and debug log
+template<typename F>
+void buildStage(std::string_view stage, std::string_view path, F&& build) {
+    slang::TimeTraceScope timeScope(stage, path);
+    auto start = std::chrono::steady_clock::now();
+    build();
+    LOG_DEBUG("{} of {} took {:.2f}ms", stage, path,
+              std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+                  .count());
+}
+} // namespace
+
 ShallowAnalysis::ShallowAnalysis(SourceManager& sourceManager, slang::BufferID buffer,
                                  std::shared_ptr<SyntaxTree> tree, slang::Bag options,
                                  const std::vector<std::shared_ptr<SyntaxTree>>& allTrees) :
-    syntaxes(*tree), m_sourceManager(sourceManager), m_buffer(buffer), m_tree(tree),
-    m_allTrees(allTrees), m_analysisOptions(options.getOrDefault<analysis::AnalysisOptions>()),
+    m_sourceManager(sourceManager), m_buffer(buffer), m_tree(tree), m_allTrees(allTrees),
+    m_options(options), m_analysisOptions(options.getOrDefault<analysis::AnalysisOptions>()),
     m_symbolTreeVisitor(m_sourceManager), m_symbolIndexer(buffer) {
 
     if (!m_tree) {
         ERROR("DocumentAnalysis initialized with null syntax tree");
-        return;
     }
+}
 
-    // Syntaxes are already indexed in the constructor
-
-    auto path = m_sourceManager.getFullPath(m_buffer).string();
-
-    if (syntaxes.collected.size() == 0) {
-        ERROR("No syntaxes found in document {}", path);
-    }
+const SyntaxIndexer& ShallowAnalysis::getSyntaxes() const {
+    std::call_once(m_syntaxesBuilt, [&] {
+        auto path = m_sourceManager.getFullPath(m_buffer).string();
+        buildStage("ShallowAnalysis::syntaxes", path, [&] { m_syntaxes.emplace(*m_tree); });
+        if (m_syntaxes->collected.size() == 0) {
+            ERROR("No syntaxes found in document {}", path);
+        }
+    });
+    return *m_syntaxes;
+}
 
-    // Index macros — last active definition for each name
-    for (auto& macro : m_tree->getDefinedMacros()) {
-        macros[macro->name.valueText()] = macro;
-    }
+const ShallowAnalysis::MacroMap& ShallowAnalysis::getMacros() const {
+    std::call_once(m_macrosBuilt, [&] {
+        auto path = m_sourceManager.getFullPath(m_buffer).string();
+        buildStage("ShallowAnalysis::macros", path, [&] {
+            // Index macros — last active definition for each name
+            for (auto& macro : m_tree->getDefinedMacros()) {
+                m_macros[macro->name.valueText()] = macro;
+            }
 
-    // Index macro references (usages and undefs) with their active definitions
-    for (auto& ref : m_tree->getPreprocessorMetadata().macroRefs) {
-        macroUsageDefinitions[ref.syntax] = ref.definition;
-    }
+            // Index macro references (usages and undefs) with their active definitions
+            for (auto& ref : m_tree->getPreprocessorMetadata().macroRefs) {
+                m_macroUsageDefinitions[ref.syntax] = ref.definition;
+            }
+        });
+    });
+    return m_macros;
+}
 
-    // Set up options for shallow compilation
-    auto cOptions = options.getOrDefault<ast::CompilationOptions>();
-    cOptions.flags |= ast::CompilationFlags::AllowTopLevelIfacePorts;
-    cOptions.flags |= ast::CompilationFlags::CheckUninstantiated;
-    cOptions.flags |= ast::CompilationFlags::AllowInvalidTop;
+const ShallowAnalysis::MacroUsageMap& ShallowAnalysis::getMacroUsageDefinitions() const {
+    getMacros();
+    return m_macroUsageDefinitions;
+}
 
-    // Add definitions from this tree (even if they aren't valid tops)
-    cOptions.topModules.clear();
-    m_compilation = std::make_unique<ast::Compilation>(cOptions);
-    for (auto& depTree : m_allTrees) {
-        m_compilation->addSyntaxTree(depTree);
-    }
+const std::unique_ptr<ast::Compilation>& ShallowAnalysis::getCompilation() const {
+    auto lock = lockQueries();
+    std::call_once(m_compilationBuilt, [&] {
+        auto path = m_sourceManager.getFullPath(m_buffer).string();
+        buildStage("ShallowAnalysis::compilation", path, [&] {
+            // Set up options for shallow compilation
+            auto cOptions = m_options.getOrDefault<ast::CompilationOptions>();
+            cOptions.flags |= ast::CompilationFlags::AllowTopLevelIfacePorts;
+            cOptions.flags |= ast::CompilationFlags::CheckUninstantiated;
+            cOptions.flags |= ast::CompilationFlags::AllowInvalidTop;
+
+            // Add definitions from this tree (even if they aren't valid tops)
+            cOptions.topModules.clear();
+            m_compilation = std::make_unique<ast::Compilation>(cOptions);
+            for (auto& depTree : m_allTrees) {
+                m_compilation->addSyntaxTree(depTree);
+            }
+            (void)m_compilation->getRoot();
+        });
+        LOG_DEBUG("Analyzed {} with tops: {}", path,
+                  fmt::join(m_compilation->getRoot().topInstances |
+                                std::views::transform([](const auto& top) { return top->name; }),
+                            ", "));
+    });
+    return m_compilation;
+}
 
-    // Elaborate and index
-    // - token -> symbol defs
-    // - syntax -> scopes
-    m_compilation->getRoot().visit(m_symbolIndexer);
+const SymbolIndexer& ShallowAnalysis::getSymbolIndex() const {
+    auto lock = lockQueries();
+    auto& compilation = getCompilation();
+    std::call_once(m_symbolsIndexed, [&] {
+        // Elaborating is the slow part of most queries; don't start it for a cancelled one
+        lsp::throwIfCancelled();
+
+        // Elaborate and index
+        // - token -> symbol defs
+        // - syntax -> scopes
+        auto path = m_sourceManager.getFullPath(m_buffer).string();
+        buildStage("ShallowAnalysis::symbols", path,
+                   [&] { compilation->getRoot().visit(m_symbolIndexer); });
+    });
+    return m_symbolIndexer;
 }
 
 std::vector<lsp::DocumentSymbol> ShallowAnalysis::getDocSymbols() {
+    auto lock = lockQueries();
     if (!m_tree) {
         return {};
     }
@@ -113,7 +174,7 @@ std::vector<lsp::DocumentSymbol> ShallowAnalysis::getDocSymbols() {
 }
 
 const parsing::Token* ShallowAnalysis::getTokenAt(SourceLocation loc) const {
-    return syntaxes.getTokenAt(loc);
+    return getSyntaxes().getTokenAt(loc);
 }
 
 const syntax::NameSyntax* ShallowAnalysis::findNameSyntax(const syntax::SyntaxNode& node) const {
@@ -186,7 +247,7 @@ const ast::Symbol* ShallowAnalysis::handleInterfacePortHeader(const parsing::Tok
                                                               const ast::Scope* scope) const {
 
     auto& header = syntax->parent->as<syntax::InterfacePortHeaderSyntax>();
-    auto iface = m_compilation->tryGetDefinition(header.nameOrKeyword.valueText(), *scope);
+    auto iface = getCompilation()->tryGetDefinition(header.nameOrKeyword.valueText(), *scope);
 
     if (node == &header.nameOrKeyword) {
         return iface.definition;
@@ -197,7 +258,7 @@ const ast::Symbol* ShallowAnalysis::handleInterfacePortHeader(const parsing::Tok
     }
 
     auto& idef = iface.definition->as<ast::DefinitionSymbol>();
-    auto& inst = ast::InstanceSymbol::createDefault(*m_compilation, idef);
+    auto& inst = ast::InstanceSymbol::createDefault(*getCompilation(), idef);
 
     // TODO: avoid creating a default instance each time
     return inst.body.lookupName(header.modport->member.valueText());
@@ -277,8 +338,9 @@ const ast::Symbol* ShallowAnalysis::getSymbolAtToken(const parsing::Token* declT
     if (!declTok) {
         return nullptr;
     }
+    auto lock = lockQueries();
 
-    auto syntax = syntaxes.getTokenParent(declTok);
+    auto syntax = getSyntaxes().getTokenParent(declTok);
     // Note: SuperHandle nodes can cause issues in symbol lookup
     if (!syntax || syntax->kind == syntax::SyntaxKind::SuperHandle) {
         return nullptr;
@@ -319,7 +381,7 @@ const ast::Symbol* ShallowAnalysis::getSymbolAtToken(const parsing::Token* declT
     }
     else if (syntax->kind == syntax::SyntaxKind::PackageExportDeclaration ||
              syntax->kind == syntax::SyntaxKind::PackageImportItem) {
-        auto pkg = m_compilation->getPackage(syntax->getFirstToken().valueText());
+        auto pkg = getCompilation()->getPackage(syntax->getFirstToken().valueText());
         if (!pkg) {
             return {};
         }
@@ -328,7 +390,7 @@ const ast::Symbol* ShallowAnalysis::getSymbolAtToken(const parsing::Token* declT
         }
         return pkg->find(declTok->valueText());
     }
-    else if (auto sym = m_symbolIndexer.getSymbol(declTok)) {
+    else if (auto sym = getSymbolIndex().getSymbol(declTok)) {
         switch (sym->kind) {
             case ast::SymbolKind::InstanceBody:
                 // Module declarations get indexed to their body. We do want to keep the body
@@ -348,10 +410,10 @@ const ast::Symbol* ShallowAnalysis::getSymbolAtToken(const parsing::Token* declT
         }
     }
 
-    auto scope = m_symbolIndexer.getScopeForSyntax(*syntax);
+    auto scope = getSymbolIndex().getScopeForSyntax(*syntax);
     if (!scope) {
-        INFO("No scope found for syntax {}, using root scope", syntax->toString());
-        scope = &m_compilation->getRoot().as<ast::Scope>();
+        LOG_DEBUG("No scope found for syntax {}, using root scope", syntax->toString());
+        scope = &getCompilation()->getRoot().as<ast::Scope>();
     }
 
     // Perform name lookup; this should be most gotos
@@ -375,8 +437,8 @@ const ast::Symbol* ShallowAnalysis::getSymbolAtToken(const parsing::Token* declT
                     if (auto member = std::get_if<ast::LookupResult::MemberSelector>(&sel)) {
                         const ast::Scope* scope = getScopeFromSym(cur);
                         if (!scope) {
-                            INFO("No scope found for sym {} : {}", cur->getHierarchicalPath(),
-                                 toString(cur->kind));
+                            LOG_DEBUG("No scope found for sym {} : {}", cur->getHierarchicalPath(),
+                                      toString(cur->kind));
                             return nullptr;
                         }
                         cur = scope->find(member->name);
@@ -439,12 +501,12 @@ const ast::Symbol* ShallowAnalysis::getSymbolAtToken(const parsing::Token* declT
         return handleInterfacePortHeader(declTok, syntax, scope);
     }
     // Try getting a definition as a last resort
-    auto def = m_compilation->tryGetDefinition(declTok->valueText(), *scope);
+    auto def = getCompilation()->tryGetDefinition(declTok->valueText(), *scope);
     if (def.definition) {
         return def.definition;
     }
 
-    auto pkg = m_compilation->getPackage(declTok->valueText());
+    auto pkg = getCompilation()->getPackage(declTok->valueText());
     if (pkg) {
         return pkg;
     }
@@ -453,12 +515,13 @@ const ast::Symbol* ShallowAnalysis::getSymbolAtToken(const parsing::Token* declT
 }
 
 const ast::Symbol* ShallowAnalysis::getDefinition(std::string_view name) const {
-    auto def = m_compilation->tryGetDefinition(name, m_compilation->getRoot());
+    auto lock = lockQueries();
+    auto def = getCompilation()->tryGetDefinition(name, getCompilation()->getRoot());
     return def.definition;
 }
 
 const ast::Symbol* ShallowAnalysis::getSymbolAt(SourceLocation loc) const {
-    auto node = syntaxes.getWordTokenAt(loc);
+    auto node = getSyntaxes().getWordTokenAt(loc);
     if (!node) {
         return nullptr;
     }
@@ -466,15 +529,17 @@ const ast::Symbol* ShallowAnalysis::getSymbolAt(SourceLocation loc) const {
 }
 
 const ast::Scope* ShallowAnalysis::getScopeAt(SourceLocation loc) const {
-    auto syntax = syntaxes.getSyntaxAt(loc);
+    auto syntax = getSyntaxes().getSyntaxAt(loc);
     if (!syntax) {
         return nullptr;
     }
-    return m_symbolIndexer.getScopeForSyntax(*syntax);
+    auto lock = lockQueries();
+    return getSymbolIndex().getScopeForSyntax(*syntax);
 }
 
 std::vector<lsp::InlayHint> ShallowAnalysis::getInlayHints(lsp::Range range,
                                                            const Config::InlayHints& config) {
+    auto lock = lockQueries();
     // query inlay hints within range
     InlayHintCollector collector(*this, range, config);
     collector.collectHints();
@@ -484,10 +549,12 @@ std::vector<lsp::InlayHint> ShallowAnalysis::getInlayHints(lsp::Range range,
 void ShallowAnalysis::addLocalReferences(std::vector<lsp::Location>& references,
                                          SourceLocation targetLocation,
                                          std::string_view targetName) const {
+    auto lock = lockQueries();
+
     // Get the token and symbol at the target location (may be in a different buffer)
 
-    auto it = syntaxes.collected.begin();
-    auto end = syntaxes.collected.end();
+    auto it = getSyntaxes().collected.begin();
+    auto end = getSyntaxes().collected.end();
 
     const ast::Symbol* targetSymbol = nullptr;
     // First loop: find the target symbol by matching the token location
@@ -558,15 +625,16 @@ bool ShallowAnalysis::hasValidBuffers() {
 }
 
 markup::Paragraph ShallowAnalysis::getDebugHover(const SourceLocation& loc) const {
+    auto lock = lockQueries();
     markup::Paragraph para;
-    auto tok = syntaxes.getTokenAt(loc);
+    auto tok = getSyntaxes().getTokenAt(loc);
     // Token info header
     if (tok) {
         para.appendBold("Token:").appendCode(toString(tok->kind)).newLine();
     }
 
     // Walk up the syntax tree
-    auto node = syntaxes.getSyntaxAt(loc);
+    auto node = getSyntaxes().getSyntaxAt(loc);
     for (auto nodePtr = node; nodePtr; nodePtr = nodePtr->parent) {
         // In case of bad memory
         if (nodePtr->kind > syntax::SyntaxKind::XorAssignmentExpression) {
@@ -597,7 +665,7 @@ markup::Paragraph ShallowAnalysis::getDebugHover(const SourceLocation& loc) cons
         para.newLine();
 
         // Check if we've reached a symbol
-        auto sym = m_symbolIndexer.getSymbol(nodePtr);
+        auto sym = getSymbolIndex().getSymbol(nodePtr);
         if (sym) {
             para.appendText("  - ")
                 .appendText(toString(sym->kind))
@@ -612,6 +680,7 @@ markup::Paragraph ShallowAnalysis::getDebugHover(const SourceLocation& loc) cons
 }
 
 Diagnostics ShallowAnalysis::getAnalysisDiags() {
+    auto lock = lockQueries();
     getAnalysisManager();
 
     if (!m_cachedAnalysisDiags) {
@@ -622,22 +691,27 @@ Diagnostics ShallowAnalysis::getAnalysisDiags() {
 }
 
 const slang::analysis::AnalysisManager* ShallowAnalysis::getAnalysisManager() {
+    auto lock = lockQueries();
     if (m_driverAnalysis) {
         return m_driverAnalysis.get();
     }
 
-    (void)m_compilation->getSemanticDiagnostics();
+    auto& compilation = getCompilation();
+    (void)compilation->getSemanticDiagnostics();
 
-    if (!m_compilation || m_compilation->getRoot().topInstances.empty()) {
+    if (!compilation || compilation->getRoot().topInstances.empty()) {
         m_cachedAnalysisDiags = Diagnostics{};
         return nullptr;
     }
 
     auto manager = std::make_unique<slang::analysis::AnalysisManager>(m_analysisOptions);
 
-    m_compilation->freeze();
-    manager->analyze(*m_compilation);
-    m_compilation->unfreeze();
+    auto path = m_sourceManager.getFullPath(m_buffer).string();
+    buildStage("ShallowAnalysis::driverAnalysis", path, [&] {
+        compilation->freeze();
+        manager->analyze(*compilation);
+        compilation->unfreeze();
+    });
 
     // filter out unused def/decl diags, since shallow analysis will likely not have all references.
     m_cachedAnalysisDiags = manager->getDiagnostics().filter(
@@ -10,12 +10,12 @@
 
 #include "ServerDriver.h"
 #include "document/ShallowAnalysis.h"
+#include "lsp/JsonRpc.h"
 #include "lsp/URI.h"
 #include "util/Converters.h"
 #include "util/Logging.h"
 #include "util/SlangExtensions.h"
 #include <fmt/format.h>
-#include <fmt/ranges.h>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -38,7 +38,7 @@ SlangDoc::SlangDoc(ServerDriver& driver, URI uri, SourceBuffer buffer) :
 }
 
 std::optional<SourceLocation> SlangDoc::getLocation(const lsp::Position& position) {
-    return toSourceLocation(m_buffer.id, position, m_sourceManager);
+    return toSourceLocation(getBuffer(), position, m_sourceManager);
 }
 
 std::shared_ptr<SlangDoc> SlangDoc::fromTree(ServerDriver& driver,
@@ -80,52 +80,82 @@ std::shared_ptr<SlangDoc> SlangDoc::open(ServerDriver& driver, const URI& uri) {
     return std::make_shared<SlangDoc>(driver, uri, buffer);
 }
 
-const std::string_view SlangDoc::getText() const {
+const std::string_view SlangDoc::getText() {
+    std::lock_guard lock(m_textMutex);
+    applyEdits();
     // null terminator is included in data
     return m_sourceManager.getSourceText(m_buffer.id);
 }
 
+const slang::BufferID SlangDoc::getBuffer() {
+    std::lock_guard lock(m_textMutex);
+    applyEdits();
+    return m_buffer.id;
+}
+
 std::shared_ptr<syntax::SyntaxTree> SlangDoc::getSyntaxTree() {
+    std::lock_guard lock(m_textMutex);
     if (!m_tree) {
+        applyEdits();
         // Will read the cached file data if it exists
         if (!m_sourceManager.isLatestData(m_buffer.id)) {
             m_buffer = m_sourceManager.readSource(m_uri.getPath(), nullptr).value();
+            m_edits.reset();
         }
         m_tree = syntax::SyntaxTree::fromBuffer(m_buffer, m_sourceManager, m_options);
     }
     else if (!hasValidBuffers(m_sourceManager, m_tree)) {
         // Tree has invalid buffers, need to reparse
         m_buffer = m_sourceManager.readSource(m_uri.getPath(), nullptr).value();
+        m_edits.reset();
         m_tree = syntax::SyntaxTree::fromBuffer(m_buffer, m_sourceManager, m_options);
     }
     return m_tree;
 }
 
 std::shared_ptr<ShallowAnalysis> SlangDoc::getAnalysis(bool refreshDependencies) {
+    std::lock_guard lock(m_analysisMutex);
+    auto generation = m_driver.getIndexGeneration();
+    if (generation != m_indexGeneration) {
+        refreshDependencies = true;
+    }
+
     if (!m_analysis || !m_analysis->hasValidBuffers() || refreshDependencies) {
         // Load dependent documents from driver if not already loaded
+        auto tree = getSyntaxTree();
         if (m_dependentDocuments.empty() || refreshDependencies) {
-            m_dependentDocuments = m_driver.getDependentDocs(getSyntaxTree());
+            m_dependentDocuments = m_driver.getDependentDocs(tree);
+            m_indexGeneration = generation;
         }
 
-        std::vector<std::shared_ptr<syntax::SyntaxTree>> trees = {getSyntaxTree()};
+        std::vector<std::shared_ptr<syntax::SyntaxTree>> trees = {tree};
         for (const auto& doc : m_dependentDocuments) {
+            lsp::throwIfCancelled();
             if (auto depTree = doc->getSyntaxTree()) {
                 trees.push_back(depTree);
             }
         }
-        m_analysis = std::make_shared<ShallowAnalysis>(m_sourceManager, m_buffer.id, m_tree,
+
+        // Refreshing usually finds the same trees, e.g. when diagnostics are reissued or the
+        // index moves on, and an unchanged tree gives the same compilation. Options are fixed
+        // for the lifetime of the driver, so the trees are the whole key. This only saves
+        // rebuilding this document's own analysis: documents importing the same package share
+        // its syntax tree, but each compilation still elaborates it, since slang symbols can't
+        // move between compilations.
+        if (m_analysis && m_analysis->hasValidBuffers() && m_analysis->isBuiltFrom(trees)) {
+            LOG_DEBUG("Reusing analysis of {}", m_uri.getPath());
+            return m_analysis;
+        }
+        m_analysis = std::make_shared<ShallowAnalysis>(m_sourceManager, getBuffer(), tree,
                                                        m_options, trees);
-        INFO("Analyzed {} with tops: {}", m_uri.getPath(),
-             fmt::join(m_analysis->getCompilation()->getRoot().topInstances |
-                           std::views::transform([](const auto& top) { return top->name; }),
-                       ", "));
     }
 
     return m_analysis;
 }
 
 std::string SlangDoc::getPrevText(const lsp::Position& position) {
+    std::lock_guard lock(m_textMutex);
+    applyEdits();
     auto start = m_sourceManager.getSourceLocation(m_buffer.id, position.line + 1, 1);
     auto end = m_sourceManager.getSourceLocation(m_buffer.id, position.line + 1,
                                                  position.character + 1);
@@ -166,92 +196,83 @@ void SlangDoc::onChange(const std::vector<lsp::TextDocumentContentChangeEvent>&
     // Partial is defined in the variant first, so it will match first iff range and text are both
     // present. WholeDocument will match if text is present, but only be tried second. Less specific
     // cases are tried later.
-    SmallVector<char> buffer;
-    std::string_view textView = getText();
-    std::vector<size_t> lineOffsets;
-
+    //
+    // Edits go into m_edits, which keeps line offsets up to date as it goes. The source buffer is
+    // only replaced when something reads it, so edits that arrive before the next reparse cost
+    // one copy of the document between them.
     if (contentChanges.size() == 0) {
         ERROR("Empty onChange event");
         return;
     }
 
-    auto getOffsets = [&](lsp::Range range) {
-        // Only one thread is able to call onchange, so the offsets remain valid without locking
-        SourceManager::computeLineOffsets(textView, lineOffsets);
-        auto& start = range.start;
-        auto& end = range.end;
-        if (start.line >= lineOffsets.size() || end.line >= lineOffsets.size()) {
-            throw std::runtime_error(fmt::format("Range out of bounds: {},{} / {}", start.line,
-                                                 end.line, lineOffsets.size()));
-        }
-        auto startOffset = lineOffsets[start.line] + start.character;
-        auto endOffset = lineOffsets[end.line] + end.character;
-        return std::make_pair(startOffset, endOffset);
-    };
+    std::unique_lock lock(m_textMutex);
+    if (!m_edits)
+        m_edits = std::make_unique<DocumentText>(bufferText());
 
-    auto ensureNullTerminated = [&]() {
-        if (buffer.empty() || buffer.back() != '\0')
-            buffer.push_back('\0');
-    };
-
-    // Single change (most common)
-    rfl::visit(
-        [&](const auto& change) {
-            using T = std::decay_t<decltype(change)>;
-            if constexpr (std::is_same_v<T, lsp::TextDocumentContentChangePartial>) {
-                auto offsets = getOffsets(change.range);
-                buffer.append(textView.begin(), textView.begin() + offsets.first);
-                buffer.append(change.text.begin(), change.text.end());
-                buffer.append(textView.begin() + offsets.second, textView.end());
-            }
-            else {
-                buffer.append(change.text.begin(), change.text.end());
-            }
-        },
-        contentChanges[0]);
-    ensureNullTerminated();
-
-    // More than one change is rare- typically things like rename actions, or if there's some lag.
-    for (size_t i = 1; i < contentChanges.size(); i++) {
-        textView = std::string_view{buffer.data(), buffer.size()};
-        lineOffsets.clear();
+    for (auto& contentChange : contentChanges) {
         rfl::visit(
             [&](const auto& change) {
                 using T = std::decay_t<decltype(change)>;
                 if constexpr (std::is_same_v<T, lsp::TextDocumentContentChangePartial>) {
-                    auto offsets = getOffsets(change.range);
-                    // handle deletes
-                    if (offsets.second > offsets.first) {
-                        buffer.erase(buffer.begin() + offsets.first,
-                                     buffer.begin() + offsets.second);
+                    auto& range = change.range;
+                    auto start = m_edits->offsetOf(range.start.line, range.start.character);
+                    auto end = m_edits->offsetOf(range.end.line, range.end.character);
+                    if (!start || !end) {
+                        throw std::runtime_error(
+                            fmt::format("Range out of bounds: {},{} / {}", range.start.line,
+                                        range.end.line, m_edits->lineCount()));
                     }
-                    // handle inserts
-                    buffer.insert(buffer.begin() + offsets.first, change.text.begin(),
-                                  change.text.end());
+                    m_edits->replace(*start, *end > *start ? *end - *start : 0, change.text);
                 }
                 else {
                     // WholeDocument collapses all prior changes
-                    buffer.clear();
-                    buffer.append(change.text.begin(), change.text.end());
-                    ensureNullTerminated();
+                    m_edits->assign(change.text);
                 }
             },
-            contentChanges[i]);
+            contentChange);
     }
-    m_buffer = m_sourceManager.replaceBuffer(m_buffer.id, std::move(buffer));
 
     // Invalidate pointers to old buffer
     m_tree.reset();
+    lock.unlock();
+
+    std::lock_guard analysisLock(m_analysisMutex);
     m_analysis.reset();
 }
+
+std::string_view SlangDoc::bufferText() const {
+    auto text = m_sourceManager.getSourceText(m_buffer.id);
+    if (!text.empty() && text.back() == '\0')
+        text.remove_suffix(1);
+    return text;
+}
+
+void SlangDoc::applyEdits() {
+    if (!m_edits || !m_edits->isModified())
+        return;
+
+    SmallVector<char> buffer;
+    buffer.reserve(m_edits->size() + 1);
+    m_edits->appendTo(buffer);
+    if (buffer.empty() || buffer.back() != '\0')
+        buffer.push_back('\0');
+    m_buffer = m_sourceManager.replaceBuffer(m_buffer.id, std::move(buffer));
+    m_edits->rebase(bufferText());
+}
+
 bool SlangDoc::reloadBuffer() {
+    std::unique_lock lock(m_textMutex);
     auto result = m_sourceManager.reloadBuffer(m_buffer.id);
     if (!result) {
         ERROR("Failed to re-read buffer for {}: {}", m_uri.getPath(), result.error().message());
         return false;
     }
     m_buffer = *result;
+    m_edits.reset();
     m_tree.reset();
+    lock.unlock();
+
+    std::lock_guard analysisLock(m_analysisMutex);
     m_analysis.reset();
     return true;
 }
@@ -274,15 +295,16 @@ void SlangDoc::issueDiagnosticsTo(DiagnosticEngine& diagEngine) {
 
     // Parse and shallow compilation diagnostics
     // There will be many diags outside the buffer, like unknown modules.
+    auto buffer = getBuffer();
     for (auto& diag : shallowComp.getSemanticDiagnostics()) {
-        if (m_sourceManager.getFullyOriginalLoc(diag.location).buffer() != m_buffer.id) {
+        if (m_sourceManager.getFullyOriginalLoc(diag.location).buffer() != buffer) {
             continue;
         }
         diagEngine.issue(diag);
     }
     // Analysis on the shallow compilation (unused, multidriven, etc)
     for (auto& diag : analysis->getAnalysisDiags()) {
-        if (m_sourceManager.getFullyOriginalLoc(diag.location).buffer() != m_buffer.id) {
+        if (m_sourceManager.getFullyOriginalLoc(diag.location).buffer() != buffer) {
             continue;
         }
         diagEngine.issue(diag);
@@ -291,9 +313,9 @@ void SlangDoc::issueDiagnosticsTo(DiagnosticEngine& diagEngine) {
 
 std::vector<lsp::Range> SlangDoc::getInactiveRegions() {
     std::vector<lsp::Range> result;
-    result.reserve(getAnalysis()->syntaxes.disabledRegions.size());
+    result.reserve(getAnalysis()->getSyntaxes().disabledRegions.size());
 
-    for (const auto& region : getAnalysis()->syntaxes.disabledRegions) {
+    for (const auto& region : getAnalysis()->getSyntaxes().disabledRegions) {
         result.push_back(toRange(region, m_sourceManager));
     }
 
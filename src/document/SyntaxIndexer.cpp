@@ -9,6 +9,7 @@
 #include "document/SyntaxIndexer.h"
 
 #include "util/Logging.h"
+#include <algorithm>
 
 #include "slang/parsing/Token.h"
 #include "slang/parsing/TokenKind.h"
@@ -40,22 +41,27 @@ SyntaxIndexer::SyntaxIndexer(const slang::syntax::SyntaxTree& tree) {
     m_sourceManager = &tree.sourceManager();
     visit(tree.root());
     flushMacroExpansion();
+
+    // Keep the first node at each offset
+    std::ranges::stable_sort(collectedHints, {}, &Hint::offset);
+    auto duplicates = std::ranges::unique(collectedHints, {}, &Hint::offset);
+    collectedHints.erase(duplicates.begin(), duplicates.end());
 }
 
 void SyntaxIndexer::visit(const slang::syntax::SyntaxNode& node) {
     switch (node.kind) {
         case syntax::SyntaxKind::MacroUsage: {
             if (node.getFirstToken().location().buffer() == m_buffer) {
-                collectedHints.emplace(
-                    static_cast<uint32_t>(node.getFirstToken().location().offset()), &node);
+                collectedHints.push_back(
+                    {static_cast<uint32_t>(node.getFirstToken().location().offset()), &node});
             }
             break;
         }
         case syntax::SyntaxKind::InvocationExpression:
         case syntax::SyntaxKind::HierarchyInstantiation:
         case syntax::SyntaxKind::ClassName:
-            collectedHints.emplace(static_cast<uint32_t>(node.getFirstToken().location().offset()),
-                                   &node);
+            collectedHints.push_back(
+                {static_cast<uint32_t>(node.getFirstToken().location().offset()), &node});
             break;
         default:
             break;
@@ -95,7 +101,11 @@ void SyntaxIndexer::visit(const slang::syntax::SyntaxNode& node) {
                 }
                 collected.push_back(token);
 
-                tokenToParent[token] = &node;
+                auto start = static_cast<uint32_t>(token->location().offset());
+                m_starts.push_back(start);
+                m_ends.push_back(start + static_cast<uint32_t>(token->rawText().size()));
+                m_kinds.push_back(token->kind);
+                m_parents.push_back(&node);
             }
         }
     }
@@ -172,36 +182,31 @@ int SyntaxIndexer::tokenIndexBefore(slang::SourceLocation loc) const {
         return -1;
     }
 
-    if (collected.size() == 0) {
-        return -1;
-    }
+    // The last token starting at or before loc
+    auto after = std::ranges::upper_bound(m_starts, static_cast<uint32_t>(loc.offset()));
+    return static_cast<int>(after - m_starts.begin()) - 1;
+}
 
-    /// collected[low].location <= loc < collected[high].location
-    // check invariants at initial state
-    if (loc < collected[0]->location()) {
+int SyntaxIndexer::tokenIndexOf(const parsing::Token* tok) const {
+    if (!tok || tok->location().buffer() != m_buffer) {
         return -1;
     }
-    // don't need to check high, since we only return low
-
-    size_t low = 0;
-    size_t high = collected.size();
-    while (low + 1 < high) {
-        size_t mid = low + (high - low) / 2;
-        auto node = collected[mid];
-        auto range = node->range();
-        if (range.start() <= loc) {
-            low = mid;
-        }
-        else {
-            high = mid;
+
+    // Zero-width tokens can share a start with the next one
+    auto offset = static_cast<uint32_t>(tok->location().offset());
+    for (auto it = std::ranges::lower_bound(m_starts, offset);
+         it != m_starts.end() && *it == offset; ++it) {
+        auto index = it - m_starts.begin();
+        if (collected[index] == tok) {
+            return static_cast<int>(index);
         }
     }
-    return static_cast<int>(low);
+    return -1;
 }
 
-bool SyntaxIndexer::editorContains(slang::SourceRange range, slang::SourceLocation loc) const {
+bool SyntaxIndexer::editorContains(size_t index, slang::SourceLocation loc) const {
     // TODO: change this to <= since curors are typically between characters (on vscode)
-    return range.start() <= loc && loc < range.end();
+    return m_starts[index] <= loc.offset() && loc.offset() < m_ends[index];
 }
 
 bool SyntaxIndexer::isIdToken(const parsing::TokenKind kind) const {
@@ -214,7 +219,7 @@ const slang::parsing::Token* SyntaxIndexer::getWordTokenAt(slang::SourceLocation
     if (atInd == -1) {
         return nullptr;
     }
-    if (isIdToken(collected[atInd]->kind) && editorContains(collected[atInd]->range(), loc)) {
+    if (isIdToken(m_kinds[atInd]) && editorContains(atInd, loc)) {
         return collected[atInd];
     }
     if (atInd == 0) {
@@ -222,8 +227,7 @@ const slang::parsing::Token* SyntaxIndexer::getWordTokenAt(slang::SourceLocation
     }
     // SomePkg::var
     //        ^^ may be the first loc on this token, but want to match to SomePkg
-    if (isIdToken(collected[atInd - 1]->kind) &&
-        editorContains(collected[atInd - 1]->range(), loc)) {
+    if (isIdToken(m_kinds[atInd - 1]) && editorContains(atInd - 1, loc)) {
         return collected[atInd - 1];
     }
     return nullptr;
@@ -234,19 +238,18 @@ const slang::parsing::Token* SyntaxIndexer::getTokenAt(slang::SourceLocation loc
     if (atInd == -1) {
         return nullptr;
     }
-    auto tok = collected[atInd];
-    if (tok->range().contains(loc)) {
-        return tok;
+    if (loc.offset() < m_ends[atInd]) {
+        return collected[atInd];
     }
     return nullptr;
 }
 
 const syntax::SyntaxNode* SyntaxIndexer::getTokenParent(const parsing::Token* tok) const {
-    auto it = tokenToParent.find(tok);
-    if (it == tokenToParent.end()) {
+    auto index = tokenIndexOf(tok);
+    if (index == -1) {
         return nullptr;
     }
-    return it->second;
+    return m_parents[index];
 }
 
 const syntax::SyntaxNode* SyntaxIndexer::getSyntaxAt(slang::SourceLocation loc) const {
@@ -257,11 +260,9 @@ const syntax::SyntaxNode* SyntaxIndexer::getSyntaxAt(slang::SourceLocation loc)
         return nullptr;
     }
 
-    auto beforeToken = collected[beforeIndex];
-
     // Inside a token
-    if (loc < beforeToken->range().end()) {
-        return getTokenParent(beforeToken);
+    if (loc.offset() < m_ends[beforeIndex]) {
+        return m_parents[beforeIndex];
     }
 
     // After last token
@@ -270,12 +271,12 @@ const syntax::SyntaxNode* SyntaxIndexer::getSyntaxAt(slang::SourceLocation loc)
     }
 
     // Find first common ancestor
-    auto beforeSyntax = getTokenParent(beforeToken);
+    auto beforeSyntax = m_parents[beforeIndex];
     SmallSet<const syntax::SyntaxNode*, 16> beforeParents;
     for (auto ptr = beforeSyntax; ptr != nullptr; ptr = ptr->parent) {
         beforeParents.insert(ptr);
     }
-    auto afterSyntax = getTokenParent(collected[beforeIndex + 1]);
+    auto afterSyntax = m_parents[beforeIndex + 1];
     for (auto ptr = afterSyntax; ptr != nullptr; ptr = ptr->parent) {
         if (beforeParents.contains(ptr)) {
             return ptr;
@@ -0,0 +1,131 @@
+//------------------------------------------------------------------------------
+// MessageReader.cpp
+// Buffered reader for LSP base protocol framing
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#include "lsp/MessageReader.h"
+
+#include "util/Logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#ifdef _WIN32
+#    include <io.h>
+#else
+#    include <unistd.h>
+#endif
+
+namespace lsp {
+
+namespace {
+
+constexpr std::string_view ContentLength = "Content-Length:";
+
+} // namespace
+
+MessageReader::MessageReader(int fd, size_t capacity) :
+    m_fd(fd), m_buffer(new char[capacity]), m_capacity(capacity) {
+}
+
+bool MessageReader::fill() {
+    // Move what's left of a partial message to the front, or grow if it fills the buffer
+    if (m_end == m_capacity) {
+        if (m_begin > 0) {
+            std::memmove(m_buffer.get(), m_buffer.get() + m_begin, m_end - m_begin);
+            m_end -= m_begin;
+            m_begin = 0;
+        }
+        else {
+            auto grown = std::unique_ptr<char[]>(new char[m_capacity * 2]);
+            std::memcpy(grown.get(), m_buffer.get(), m_end);
+            m_buffer = std::move(grown);
+            m_capacity *= 2;
+        }
+    }
+
+    while (true) {
+#ifdef _WIN32
+        auto n = ::_read(m_fd, m_buffer.get() + m_end, unsigned(m_capacity - m_end));
+#else
+        auto n = ::read(m_fd, m_buffer.get() + m_end, m_capacity - m_end);
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        m_end += size_t(n);
+        return true;
+    }
+}
+
+std::optional<std::string_view> MessageReader::next() {
+    // The previous body isn't needed anymore
+    if (m_begin == m_end)
+        m_begin = m_end = 0;
+
+    while (true) {
+        // Scan the header lines, up to the empty line that ends them. Clients differ on whether
+        // lines end with \r\n or just \n.
+        std::optional<size_t> length;
+        size_t pos = m_begin;
+        bool complete = false;
+        while (pos < m_end) {
+            auto lineStart = m_buffer.get() + pos;
+            auto newline = static_cast<const char*>(std::memchr(lineStart, '\n', m_end - pos));
+            if (!newline)
+                break;
+
+            std::string_view line(lineStart, size_t(newline - lineStart));
+            pos += line.size() + 1;
+            if (line.ends_with('\r'))
+                line.remove_suffix(1);
+            if (line.empty()) {
+                complete = true;
+                break;
+            }
+
+            if (line.starts_with(ContentLength)) {
+                auto value = line.substr(ContentLength.size());
+                while (!value.empty() && value.front() == ' ')
+                    value.remove_prefix(1);
+                size_t parsed = 0;
+                auto result = std::from_chars(value.data(), value.data() + value.size(), parsed);
+                if (result.ec == std::errc())
+                    length = parsed;
+            }
+            else if (!line.starts_with("Content-Type:")) {
+                WARN("<-/- Invalid Line: {}", line);
+            }
+        }
+
+        // Headers are scanned again after a fill, which is rare and cheap next to the body
+        if (!complete) {
+            if (!fill())
+                return std::nullopt;
+            continue;
+        }
+
+        if (!length) {
+            // No body to read; drop the headers and look for the next message
+            WARN("<-/- Missing Content-Length");
+            m_begin = pos;
+            continue;
+        }
+
+        while (m_end - pos < *length) {
+            size_t offset = pos - m_begin;
+            if (!fill())
+                return std::nullopt;
+            pos = m_begin + offset;
+        }
+
+        m_begin = pos + *length;
+        return std::string_view(m_buffer.get() + pos, *length);
+    }
+}
+
+} // namespace lsp
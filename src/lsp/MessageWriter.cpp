@@ -0,0 +1,171 @@
+//------------------------------------------------------------------------------
+// MessageWriter.cpp
+// Background writer for outgoing LSP messages
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#include "lsp/MessageWriter.h"
+
+#include "lsp/SessionRecorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <unordered_map>
+#ifdef _WIN32
+#    include <io.h>
+#else
+#    include <climits>
+#    include <sys/uio.h>
+#    include <unistd.h>
+#endif
+
+namespace lsp {
+
+MessageWriter::MessageWriter(int fd, SessionRecorder* recorder) :
+    m_fd(fd), m_recorder(recorder), m_thread([this] { run(); }) {
+}
+
+MessageWriter::~MessageWriter() {
+    // Write whatever is still queued before the thread stops
+    flush();
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void MessageWriter::push(std::string body, std::string key) {
+    auto node = new Node{.body = std::move(body), .key = std::move(key)};
+    m_pushed++;
+    node->next = m_head.load(std::memory_order_relaxed);
+    while (!m_head.compare_exchange_weak(node->next, node))
+        ;
+
+    // The writer sets m_sleeping before its last look at m_head, so either it sees this node or
+    // we see that it's asleep
+    if (m_sleeping) {
+        std::lock_guard lock(m_mutex);
+        m_wake.notify_one();
+    }
+}
+
+void MessageWriter::flush() {
+    size_t target = m_pushed;
+    std::unique_lock lock(m_mutex);
+    m_flushed.wait(lock, [&] { return m_written >= target; });
+}
+
+void MessageWriter::run() {
+    std::vector<Node*> batch;
+    while (true) {
+        Node* head = m_head.exchange(nullptr, std::memory_order_acquire);
+        if (!head) {
+            std::unique_lock lock(m_mutex);
+            m_sleeping = true;
+            m_wake.wait(lock, [&] { return m_stopping || m_head.load() != nullptr; });
+            m_sleeping = false;
+            if (m_stopping && !m_head.load())
+                return;
+            continue;
+        }
+
+        batch.clear();
+        for (auto node = head; node; node = node->next)
+            batch.push_back(node);
+        std::ranges::reverse(batch);
+        write(batch);
+
+        size_t count = batch.size();
+        for (auto node : batch)
+            delete node;
+
+        std::lock_guard lock(m_mutex);
+        m_written += count;
+        m_flushed.notify_all();
+    }
+}
+
+void MessageWriter::write(std::vector<Node*>& batch) {
+    // Keep only the last message for each key
+    std::unordered_map<std::string_view, size_t> lastForKey;
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (!batch[i]->key.empty())
+            lastForKey[batch[i]->key] = i;
+    }
+
+    std::vector<std::string> headers;
+    headers.reserve(batch.size());
+    std::vector<std::string_view> pieces;
+    pieces.reserve(batch.size() * 2);
+    for (size_t i = 0; i < batch.size(); i++) {
+        const auto& node = *batch[i];
+        if (!node.key.empty() && lastForKey[node.key] != i)
+            continue;
+        if (m_recorder)
+            m_recorder->record(SessionRecorder::Direction::Out, node.body);
+        headers.push_back("Content-Length: " + std::to_string(node.body.size()) + "\r\n\r\n");
+        pieces.push_back(headers.back());
+        pieces.push_back(node.body);
+    }
+    writeAll(pieces);
+}
+
+#ifdef _WIN32
+
+void MessageWriter::writeAll(std::vector<std::string_view>& pieces) {
+    std::string buffer;
+    for (auto piece : pieces)
+        buffer += piece;
+
+    size_t offset = 0;
+    while (offset < buffer.size()) {
+        auto n = ::_write(m_fd, buffer.data() + offset, unsigned(buffer.size() - offset));
+        if (n <= 0)
+            return;
+        offset += size_t(n);
+    }
+}
+
+#else
+
+void MessageWriter::writeAll(std::vector<std::string_view>& pieces) {
+    std::vector<iovec> iov;
+    iov.reserve(pieces.size());
+    for (auto piece : pieces)
+        iov.push_back({const_cast<char*>(piece.data()), piece.size()});
+
+    size_t first = 0;
+    while (first < iov.size()) {
+        int count = int(std::min(iov.size() - first, size_t(IOV_MAX)));
+        auto n = ::writev(m_fd, iov.data() + first, count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        // Skip what was written, which may end partway through a piece
+        auto written = size_t(n);
+        while (first < iov.size() && written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            first++;
+        }
+        if (written > 0) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + written;
+            iov[first].iov_len -= written;
+        }
+    }
+}
+
+#endif
+
+MessageWriter& outputWriter() {
+    static MessageWriter writer(1, &sessionRecorder());
+    return writer;
+}
+
+} // namespace lsp
@@ -0,0 +1,197 @@
+//------------------------------------------------------------------------------
+// ServerMetrics.cpp
+// Per-method latency histograms and process statistics for the JSON-RPC server
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#include "lsp/ServerMetrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#ifdef SLANG_SERVER_COUNT_ALLOCATIONS
+#    include <cstdlib>
+#    include <new>
+#endif
+#ifdef _WIN32
+#    define NOMINMAX
+#    include <windows.h>
+
+#    include <psapi.h>
+#elif !defined(__wasi__)
+#    include <sys/resource.h>
+#endif
+
+#ifdef SLANG_SERVER_COUNT_ALLOCATIONS
+namespace {
+thread_local uint64_t threadAllocations = 0;
+
+void* countedAlloc(std::size_t size) {
+    threadAllocations++;
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+} // namespace
+
+// Aligned allocations keep the default implementation, which pairs with its own deletes
+void* operator new(std::size_t size) {
+    return countedAlloc(size);
+}
+void* operator new[](std::size_t size) {
+    return countedAlloc(size);
+}
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+#endif
+
+namespace lsp {
+
+bool allocationsCounted() {
+#ifdef SLANG_SERVER_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint64_t threadAllocationCount() {
+#ifdef SLANG_SERVER_COUNT_ALLOCATIONS
+    return threadAllocations;
+#else
+    return 0;
+#endif
+}
+
+std::optional<uint64_t> peakRssBytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return std::nullopt;
+    return uint64_t(counters.PeakWorkingSetSize);
+#elif defined(__wasi__)
+    return std::nullopt;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return std::nullopt;
+#    ifdef __APPLE__
+    return uint64_t(usage.ru_maxrss);
+#    else
+    return uint64_t(usage.ru_maxrss) * 1024;
+#    endif
+#endif
+}
+
+size_t LatencyHistogram::bucketFor(uint64_t value) {
+    constexpr uint64_t subBuckets = 1 << SubBucketBits;
+    if (value < subBuckets)
+        return size_t(value);
+    // The top bits after the leading one pick the bucket within its power of two
+    size_t shift = size_t(std::bit_width(value)) - 1 - SubBucketBits;
+    return ((shift + 1) << SubBucketBits) + size_t((value >> shift) & (subBuckets - 1));
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t bucket) {
+    constexpr uint64_t subBuckets = 1 << SubBucketBits;
+    if (bucket < subBuckets)
+        return bucket;
+    size_t shift = (bucket >> SubBucketBits) - 1;
+    uint64_t lower = (subBuckets + (bucket & (subBuckets - 1))) << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(Duration duration) {
+    auto value = uint64_t(std::max<Duration::rep>(duration.count(), 0));
+    m_buckets[bucketFor(value)]++;
+    m_count++;
+    m_max = std::max(m_max, value);
+}
+
+LatencyHistogram::Duration LatencyHistogram::percentile(double fraction) const {
+    if (m_count == 0)
+        return Duration(0);
+
+    auto rank = uint64_t(std::ceil(std::clamp(fraction, 0.0, 1.0) * double(m_count)));
+    rank = std::max<uint64_t>(rank, 1);
+
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < NumBuckets; bucket++) {
+        seen += m_buckets[bucket];
+        if (seen >= rank)
+            return Duration(std::min(bucketUpperBound(bucket), m_max));
+    }
+    return Duration(m_max);
+}
+
+ServerMetrics::Scope::Scope(ServerMetrics& metrics, std::string_view method,
+                            Clock::time_point received) :
+    m_metrics(metrics), m_method(method), m_received(received), m_start(Clock::now()),
+    m_allocations(threadAllocationCount()) {
+}
+
+ServerMetrics::Scope::~Scope() {
+    using std::chrono::duration_cast;
+    auto end = Clock::now();
+    m_metrics.record(m_method, duration_cast<LatencyHistogram::Duration>(m_start - m_received),
+                     duration_cast<LatencyHistogram::Duration>(end - m_start),
+                     threadAllocationCount() - m_allocations, m_failed);
+}
+
+void ServerMetrics::record(std::string_view method, LatencyHistogram::Duration queueWait,
+                           LatencyHistogram::Duration latency, uint64_t allocations, bool failed) {
+    std::lock_guard lock(m_mutex);
+    auto it = m_methods.find(method);
+    if (it == m_methods.end())
+        it = m_methods.emplace(std::string(method), MethodStats{}).first;
+
+    auto& stats = it->second;
+    stats.latency.record(latency);
+    stats.queueWait.record(queueWait);
+    stats.allocations += allocations;
+    if (failed)
+        stats.errors++;
+}
+
+MetricsReport ServerMetrics::report() const {
+    auto toMs = [](LatencyHistogram::Duration duration) {
+        return double(duration.count()) / 1000.0;
+    };
+
+    MetricsReport result;
+    result.uptimeSeconds = std::chrono::duration<double>(Clock::now() - m_started).count();
+    result.peakRssBytes = peakRssBytes();
+
+    std::lock_guard lock(m_mutex);
+    for (const auto& [method, stats] : m_methods) {
+        result.methods.push_back(MethodMetrics{
+            .method = method,
+            .count = stats.latency.count(),
+            .errors = stats.errors,
+            .p50 = toMs(stats.latency.percentile(0.5)),
+            .p95 = toMs(stats.latency.percentile(0.95)),
+            .p99 = toMs(stats.latency.percentile(0.99)),
+            .max = toMs(stats.latency.max()),
+            .queueP50 = toMs(stats.queueWait.percentile(0.5)),
+            .queueP95 = toMs(stats.queueWait.percentile(0.95)),
+            .queueP99 = toMs(stats.queueWait.percentile(0.99)),
+            .allocations = allocationsCounted() ? std::make_optional(stats.allocations)
+                                                : std::nullopt,
+        });
+    }
+    return result;
+}
+
+} // namespace lsp
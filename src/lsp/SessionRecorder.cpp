@@ -0,0 +1,64 @@
+//------------------------------------------------------------------------------
+// SessionRecorder.cpp
+// Records the messages of an LSP session for replaying later
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#include "lsp/SessionRecorder.h"
+
+#include <algorithm>
+
+namespace lsp {
+
+SessionRecorder::~SessionRecorder() {
+    if (auto file = m_file.exchange(nullptr))
+        std::fclose(file);
+}
+
+bool SessionRecorder::open(const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    std::lock_guard lock(m_mutex);
+    if (auto old = m_file.exchange(nullptr))
+        std::fclose(old);
+    m_started = std::chrono::steady_clock::now();
+    m_file = file;
+    return true;
+}
+
+void SessionRecorder::record(Direction direction, std::string_view body) {
+    if (!isOpen())
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard lock(m_mutex);
+    FILE* file = m_file;
+    if (!file)
+        return;
+
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(now - m_started);
+    m_line = "{\"t\":";
+    m_line += std::to_string(micros.count());
+    m_line += direction == Direction::In ? ",\"dir\":\"in\",\"msg\":" : ",\"dir\":\"out\",\"msg\":";
+    size_t bodyStart = m_line.size();
+    m_line += body;
+    std::replace_if(
+        m_line.begin() + std::ptrdiff_t(bodyStart), m_line.end(),
+        [](char c) { return c == '\n' || c == '\r'; }, ' ');
+    m_line += "}\n";
+
+    // Flushed per message so a recording of a session that crashes is still complete
+    std::fwrite(m_line.data(), 1, m_line.size(), file);
+    std::fflush(file);
+}
+
+SessionRecorder& sessionRecorder() {
+    static SessionRecorder recorder;
+    return recorder;
+}
+
+} // namespace lsp
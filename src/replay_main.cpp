@@ -0,0 +1,496 @@
+//------------------------------------------------------------------------------
+// replay_main.cpp
+// Replays a recorded LSP session against the server and reports its latency
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#include "SlangServer.h"
+#include "lsp/MessageReader.h"
+#include "lsp/ServerMetrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <rfl/json.hpp>
+#include <sstream>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+
+#include "slang/util/CommandLine.h"
+#include "slang/util/OS.h"
+
+using namespace slang;
+using namespace server;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// Replaced in recordings by the workspace being replayed against, so checked in traces don't
+/// depend on where the repo is
+constexpr std::string_view WorkspaceVar = "${workspace}";
+
+/// Latency differences under this are noise, not regressions, when comparing to a baseline
+constexpr double NoiseMs = 2.0;
+
+/// A message the client sent, from a recording
+struct RecordedMessage {
+    std::string body;
+    /// Empty for responses to the server's requests
+    std::string method;
+    /// The request id as JSON, empty for notifications
+    std::string id;
+};
+
+struct ReplayRequest {
+    std::string method;
+    std::string id;
+    double ms = 0;
+    bool error = false;
+};
+
+struct ReplayMethod {
+    std::string method;
+    uint64_t count = 0;
+    uint64_t errors = 0;
+    double p50 = 0;
+    double p95 = 0;
+    double max = 0;
+};
+
+/// The results of a replay, which are also what --output writes and --baseline reads
+struct ReplayReport {
+    double wallSeconds = 0;
+    double cpuSeconds = 0;
+    std::optional<uint64_t> peakRssBytes;
+    std::vector<ReplayMethod> methods;
+    std::vector<ReplayRequest> requests;
+};
+
+std::string toJson(yyjson_val* value) {
+    size_t length = 0;
+    char* json = yyjson_val_write(value, 0, &length);
+    if (!json)
+        return {};
+    std::string result(json, length);
+    std::free(json);
+    return result;
+}
+
+/// Read the client's messages from a recording made with `slang-server --record`
+std::optional<std::vector<RecordedMessage>> loadRecording(const std::string& path,
+                                                          std::string_view workspace) {
+    std::ifstream file(path);
+    if (!file) {
+        fmt::print(stderr, "Error opening recording {}\n", path);
+        return std::nullopt;
+    }
+
+    std::vector<RecordedMessage> messages;
+    std::string line;
+    for (size_t lineNumber = 1; std::getline(file, line); lineNumber++) {
+        if (line.empty())
+            continue;
+        for (size_t pos = 0; (pos = line.find(WorkspaceVar, pos)) != std::string::npos;
+             pos += workspace.size()) {
+            line.replace(pos, WorkspaceVar.size(), workspace);
+        }
+
+        std::unique_ptr<yyjson_doc, decltype(&yyjson_doc_free)> doc(
+            yyjson_read(line.data(), line.size(), 0), yyjson_doc_free);
+        yyjson_val* root = doc ? yyjson_doc_get_root(doc.get()) : nullptr;
+        yyjson_val* msg = yyjson_obj_get(root, "msg");
+        if (!yyjson_is_obj(msg)) {
+            fmt::print(stderr, "{}:{}: expected a recorded message\n", path, lineNumber);
+            return std::nullopt;
+        }
+        if (!yyjson_equals_str(yyjson_obj_get(root, "dir"), "in"))
+            continue;
+
+        RecordedMessage message{.body = toJson(msg)};
+        if (yyjson_val* method = yyjson_obj_get(msg, "method"); yyjson_is_str(method)) {
+            message.method = std::string(yyjson_get_str(method), yyjson_get_len(method));
+            if (yyjson_val* id = yyjson_obj_get(msg, "id"))
+                message.id = toJson(id);
+        }
+        messages.push_back(std::move(message));
+    }
+
+    // Recordings of sessions that were killed don't end cleanly
+    auto hasMethod = [&](std::string_view method) {
+        return std::ranges::any_of(messages, [&](auto& m) { return m.method == method; });
+    };
+    if (!hasMethod("exit")) {
+        if (!hasMethod("shutdown")) {
+            messages.push_back({.body = R"({"jsonrpc":"2.0","id":"replay","method":"shutdown"})",
+                                .method = "shutdown",
+                                .id = R"("replay")"});
+        }
+        messages.push_back(
+            {.body = R"({"jsonrpc":"2.0","method":"exit"})", .method = "exit", .id = {}});
+    }
+    return messages;
+}
+
+/// Plays a client's messages to a server through pipes and times its responses. Each request is
+/// answered before anything after it is sent, so a slow request shows up as its own latency
+/// rather than as queueing in the ones behind it.
+class Replayer {
+public:
+    Replayer(int toServer, int fromServer, std::chrono::milliseconds timeout) :
+        m_toServer(toServer), m_fromServer(fromServer), m_timeout(timeout) {}
+
+    /// Send every message. False if a request went unanswered.
+    bool run(const std::vector<RecordedMessage>& messages, FILE* errors) {
+        for (auto& message : messages) {
+            if (message.id.empty()) {
+                send(message.body);
+                continue;
+            }
+
+            {
+                std::lock_guard lock(m_mutex);
+                m_waitingFor = message.id;
+                m_answered = false;
+            }
+            auto start = Clock::now();
+            send(message.body);
+
+            std::unique_lock lock(m_mutex);
+            if (!m_response.wait_for(lock, m_timeout, [&] { return m_answered || m_closed; }) ||
+                !m_answered) {
+                fmt::print(errors, "No response to {} {} within {} ms\n", message.method,
+                           message.id, m_timeout.count());
+                return false;
+            }
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                                                 start);
+            auto& stats = m_methods[message.method];
+            stats.latency.record(elapsed);
+            stats.errors += m_error;
+            m_requests.push_back({.method = message.method,
+                                  .id = message.id,
+                                  .ms = double(elapsed.count()) / 1000.0,
+                                  .error = m_error});
+        }
+        return true;
+    }
+
+    /// Read the server's output until it closes, noting responses to the request in flight
+    void readResponses() {
+        lsp::MessageReader reader(m_fromServer);
+        while (auto body = reader.next()) {
+            std::unique_ptr<yyjson_doc, decltype(&yyjson_doc_free)> doc(
+                yyjson_read(body->data(), body->size(), 0), yyjson_doc_free);
+            yyjson_val* root = doc ? yyjson_doc_get_root(doc.get()) : nullptr;
+            // Notifications and the server's own requests aren't waited on
+            if (!root || yyjson_obj_get(root, "method"))
+                continue;
+
+            auto id = toJson(yyjson_obj_get(root, "id"));
+            std::lock_guard lock(m_mutex);
+            if (id == m_waitingFor && !m_answered) {
+                m_answered = true;
+                m_error = yyjson_obj_get(root, "error") != nullptr;
+                m_response.notify_one();
+            }
+        }
+
+        std::lock_guard lock(m_mutex);
+        m_closed = true;
+        m_response.notify_one();
+    }
+
+    void fillReport(ReplayReport& report) {
+        auto toMs = [](lsp::LatencyHistogram::Duration duration) {
+            return double(duration.count()) / 1000.0;
+        };
+
+        std::lock_guard lock(m_mutex);
+        for (auto& [method, stats] : m_methods) {
+            report.methods.push_back({.method = method,
+                                      .count = stats.latency.count(),
+                                      .errors = stats.errors,
+                                      .p50 = toMs(stats.latency.percentile(0.5)),
+                                      .p95 = toMs(stats.latency.percentile(0.95)),
+                                      .max = toMs(stats.latency.max())});
+        }
+        report.requests = m_requests;
+    }
+
+private:
+    void send(std::string_view body) {
+        std::string message = "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        message += body;
+
+        std::string_view rest = message;
+        while (!rest.empty()) {
+            auto n = ::write(m_toServer, rest.data(), rest.size());
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return;
+            rest.remove_prefix(size_t(n));
+        }
+    }
+
+    struct MethodStats {
+        lsp::LatencyHistogram latency;
+        uint64_t errors = 0;
+    };
+
+    int m_toServer;
+    int m_fromServer;
+    std::chrono::milliseconds m_timeout;
+
+    std::mutex m_mutex;
+    std::condition_variable m_response;
+    std::string m_waitingFor;
+    bool m_answered = false;
+    bool m_error = false;
+    bool m_closed = false;
+
+    std::map<std::string, MethodStats, std::less<>> m_methods;
+    std::vector<ReplayRequest> m_requests;
+};
+
+double cpuSeconds() {
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    auto seconds = [](const timeval& time) { return double(time.tv_sec) + time.tv_usec / 1e6; };
+    return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+void printReport(FILE* out, const std::string& recording, size_t messageCount,
+                 const ReplayReport& report) {
+    fmt::print(out, "Replayed {} messages from {} in {:.2f}s ({:.2f}s CPU", messageCount,
+               recording, report.wallSeconds, report.cpuSeconds);
+    if (report.peakRssBytes)
+        fmt::print(out, ", peak RSS {:.1f} MB", double(*report.peakRssBytes) / (1 << 20));
+    fmt::print(out, ")\n\n");
+
+    fmt::print(out, "{:<40}{:>7}{:>8}{:>10}{:>10}{:>10}\n", "method", "count", "errors",
+               "p50 ms", "p95 ms", "max ms");
+    for (auto& method : report.methods) {
+        fmt::print(out, "{:<40}{:>7}{:>8}{:>10.2f}{:>10.2f}{:>10.2f}\n", method.method,
+                   method.count, method.errors, method.p50, method.p95, method.max);
+    }
+
+    auto slowest = report.requests;
+    std::ranges::sort(slowest, std::ranges::greater{}, &ReplayRequest::ms);
+    slowest.resize(std::min<size_t>(slowest.size(), 5));
+    if (!slowest.empty()) {
+        fmt::print(out, "\nSlowest requests:\n");
+        for (auto& request : slowest)
+            fmt::print(out, "  {:>10.2f} ms  {} {}\n", request.ms, request.method, request.id);
+    }
+}
+
+/// Check a report against limits and a baseline, printing each failure
+bool checkReport(FILE* errors, const ReplayReport& report, std::optional<double> maxP95,
+                 std::optional<double> maxCpu, const std::optional<ReplayReport>& baseline,
+                 double tolerance) {
+    bool passed = true;
+    auto fail = [&](const std::string& message) {
+        fmt::print(errors, "FAIL: {}\n", message);
+        passed = false;
+    };
+
+    for (auto& method : report.methods) {
+        if (maxP95 && method.p95 > *maxP95)
+            fail(fmt::format("{} p95 of {:.2f} ms exceeds {} ms", method.method, method.p95,
+                             *maxP95));
+    }
+    if (maxCpu && report.cpuSeconds > *maxCpu)
+        fail(fmt::format("{:.2f}s of CPU time exceeds {}s", report.cpuSeconds, *maxCpu));
+
+    if (baseline) {
+        for (auto& method : report.methods) {
+            auto it = std::ranges::find(baseline->methods, method.method, &ReplayMethod::method);
+            if (it == baseline->methods.end())
+                continue;
+            double allowed = it->p95 * tolerance + NoiseMs;
+            if (method.p95 > allowed)
+                fail(fmt::format("{} p95 of {:.2f} ms regressed from {:.2f} ms", method.method,
+                                 method.p95, it->p95));
+        }
+        if (report.cpuSeconds > baseline->cpuSeconds * tolerance + NoiseMs / 1000.0)
+            fail(fmt::format("{:.2f}s of CPU time regressed from {:.2f}s", report.cpuSeconds,
+                             baseline->cpuSeconds));
+    }
+    return passed;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    OS::setupConsole();
+
+    CommandLine cmdline;
+
+    std::optional<bool> showHelp;
+    cmdline.add("-h,--help", showHelp, "Display available options");
+
+    std::vector<std::string> recordings;
+    cmdline.setPositional(recordings, "recording");
+
+    std::optional<std::string> workspace;
+    cmdline.add("--workspace", workspace,
+                "Directory substituted for ${workspace} in the recording; defaults to the "
+                "current directory",
+                "<dir>");
+
+    std::optional<int32_t> timeoutMs;
+    cmdline.add("--timeout", timeoutMs, "How long to wait for each response (default 60000)",
+                "<ms>");
+
+    std::optional<double> maxP95;
+    cmdline.add("--max-p95", maxP95, "Fail if any method's p95 latency exceeds this", "<ms>");
+
+    std::optional<double> maxCpu;
+    cmdline.add("--max-cpu", maxCpu, "Fail if the replay takes more CPU time than this",
+                "<seconds>");
+
+    std::optional<std::string> output;
+    cmdline.add("--output", output, "Write the report as JSON, e.g. to use as a baseline",
+                "<path>");
+
+    std::optional<std::string> baselinePath;
+    cmdline.add("--baseline", baselinePath,
+                "Fail if a method's p95 latency or the CPU time regressed from this report",
+                "<path>");
+
+    std::optional<double> tolerance;
+    cmdline.add("--tolerance", tolerance,
+                "Allowed ratio to the baseline before it's a regression (default 1.25)",
+                "<ratio>");
+
+    std::optional<bool> verbose;
+    cmdline.add("-v,--verbose", verbose, "Show the server's log instead of discarding it");
+
+    if (!cmdline.parse(argc, argv)) {
+        for (auto& error : cmdline.getErrors())
+            fmt::print(stderr, "{}\n", error);
+        return 1;
+    }
+
+    if (showHelp == true) {
+        OS::print(cmdline.getHelpText("Replays a recorded session against slang-server"));
+        return 0;
+    }
+
+    if (recordings.size() != 1) {
+        fmt::print(stderr, "Expected one recording, made with slang-server --record\n");
+        return 1;
+    }
+
+    auto root = std::filesystem::absolute(workspace.value_or(".")).lexically_normal().string();
+    while (root.size() > 1 && root.ends_with('/'))
+        root.pop_back();
+    auto messages = loadRecording(recordings[0], root);
+    if (!messages)
+        return 1;
+
+    std::optional<ReplayReport> baseline;
+    if (baselinePath) {
+        std::ifstream file(*baselinePath);
+        std::stringstream text;
+        text << file.rdbuf();
+        try {
+            baseline = rfl::json::read<ReplayReport>(text.str()).value();
+        }
+        catch (const std::exception& e) {
+            fmt::print(stderr, "Error reading baseline {}: {}\n", *baselinePath, e.what());
+            return 1;
+        }
+    }
+
+    // The server reads stdin and writes stdout, so those become pipes to it. The report goes to
+    // the original streams.
+    int toServer[2];
+    int fromServer[2];
+    if (::pipe(toServer) != 0 || ::pipe(fromServer) != 0) {
+        fmt::print(stderr, "Error creating pipes\n");
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::fflush(stdout);
+    FILE* out = ::fdopen(::dup(STDOUT_FILENO), "w");
+    FILE* errors = ::fdopen(::dup(STDERR_FILENO), "w");
+    ::dup2(toServer[0], STDIN_FILENO);
+    ::dup2(fromServer[1], STDOUT_FILENO);
+    ::close(toServer[0]);
+    ::close(fromServer[1]);
+    if (verbose != true) {
+        int null = ::open("/dev/null", O_WRONLY);
+        ::dup2(null, STDERR_FILENO);
+        ::close(null);
+    }
+
+    Replayer replayer(toServer[1], fromServer[0],
+                      std::chrono::milliseconds(timeoutMs.value_or(60000)));
+
+    ReplayReport report;
+    double cpuStart = cpuSeconds();
+    auto start = Clock::now();
+
+    std::thread serverThread([] {
+        SlangLspClient client;
+        SlangServer server(client);
+        server.run();
+    });
+    std::thread readerThread([&] { replayer.readResponses(); });
+
+    if (!replayer.run(*messages, errors)) {
+        // The server is stuck on the request, so there's no waiting for it to finish
+        std::fflush(errors);
+        std::_Exit(1);
+    }
+
+    // Input ending stops the server even if the recording's exit didn't
+    ::close(toServer[1]);
+    serverThread.join();
+    lsp::outputWriter().flush();
+
+    report.wallSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    report.cpuSeconds = cpuSeconds() - cpuStart;
+    report.peakRssBytes = lsp::peakRssBytes();
+
+    // Replacing stdout closes the last write end of the pipe, which ends the reader
+    int null = ::open("/dev/null", O_WRONLY);
+    ::dup2(null, STDOUT_FILENO);
+    ::close(null);
+    readerThread.join();
+
+    replayer.fillReport(report);
+    printReport(out, recordings[0], messages->size(), report);
+    std::fflush(out);
+
+    if (output) {
+        std::ofstream file(*output);
+        if (!file) {
+            fmt::print(errors, "Error opening output file {}\n", *output);
+            return 1;
+        }
+        file << rfl::json::write(report, rfl::json::pretty) << '\n';
+    }
+
+    bool passed = checkReport(errors, report, maxP95, maxCpu, baseline, tolerance.value_or(1.25));
+    std::fflush(errors);
+    return passed ? 0 : 1;
+}
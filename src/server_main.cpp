@@ -12,10 +12,14 @@
 #endif
 
 #include "SlangServer.h"
+#include "lsp/SessionRecorder.h"
+#include "util/Logging.h"
 #include <fmt/format.h>
+#include <fstream>
 #include <rfl/DefaultIfMissing.hpp>
 
 #include "slang/util/CommandLine.h"
+#include "slang/util/TimeTrace.h"
 #include "slang/util/VersionInfo.h"
 
 using namespace slang;
@@ -45,6 +49,23 @@ int main(int argc, char** argv) {
     std::optional<bool> configSchema;
     cmdline.add("--config-schema", configSchema, "Print json schema of config file and exit");
 
+    std::optional<std::string> timeTrace;
+    cmdline.add("--time-trace", timeTrace,
+                "Record where the server spends its time, down to slang's elaboration, and write "
+                "it to the given file as a Chrome trace on exit",
+                "<path>");
+
+    std::optional<std::string> record;
+    cmdline.add("--record", record,
+                "Record every message read and sent to the given file, for replaying with "
+                "slang_server_replay",
+                "<path>");
+
+    std::optional<std::string> logLevel;
+    cmdline.add("--log-level", logLevel,
+                "Lowest level of messages to log: debug, info (the default), warn, error or off",
+                "<level>");
+
     cmdline.parse(argc, argv);
 
     if (showHelp == true) {
@@ -75,9 +96,40 @@ int main(int argc, char** argv) {
         }
         return 0;
     }
-    SlangLspClient client;
-    SlangServer server(client);
-    server.run();
+    if (logLevel) {
+        auto level = logging::parseLevel(*logLevel);
+        if (!level) {
+            fmt::print(stderr, "Unknown log level {}\n", *logLevel);
+            return 1;
+        }
+        logging::setLevel(*level);
+    }
+    logging::flushOnTerminate();
+
+    if (record && !lsp::sessionRecorder().open(*record)) {
+        fmt::print(stderr, "Error opening recording file {}\n", *record);
+        return 1;
+    }
+
+    // Tracing has to start before any threads do, so every span that ends was recorded starting
+    if (timeTrace)
+        TimeTrace::initialize();
+
+    {
+        SlangLspClient client;
+        SlangServer server(client);
+        server.run();
+    }
+
+    // Written once the server's threads are done, so no spans are left open
+    if (timeTrace) {
+        std::ofstream file(*timeTrace);
+        if (!file) {
+            fmt::print(stderr, "Error opening time trace file {}\n", *timeTrace);
+            return 1;
+        }
+        TimeTrace::write(file);
+    }
 
     return 0;
 }
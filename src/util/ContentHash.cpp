@@ -0,0 +1,107 @@
+//------------------------------------------------------------------------------
+// ContentHash.cpp
+// Fast, stable hashing of file contents.
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#include "util/ContentHash.h"
+
+#include <cstring>
+
+namespace server {
+
+namespace {
+
+constexpr uint64_t Prime1 = 11400714785074694791ULL;
+constexpr uint64_t Prime2 = 14029467366897019727ULL;
+constexpr uint64_t Prime3 = 1609587929392839161ULL;
+constexpr uint64_t Prime4 = 9650029242287828579ULL;
+constexpr uint64_t Prime5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t accumulate(uint64_t acc, uint64_t input) {
+    acc += input * Prime2;
+    acc = rotl(acc, 31);
+    return acc * Prime1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+    acc ^= accumulate(0, val);
+    return acc * Prime1 + Prime4;
+}
+
+} // namespace
+
+uint64_t contentHash(std::string_view data, uint64_t seed) {
+    const char* p = data.data();
+    const char* const end = p + data.size();
+    uint64_t h;
+
+    if (data.size() >= 32) {
+        uint64_t v1 = seed + Prime1 + Prime2;
+        uint64_t v2 = seed + Prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - Prime1;
+        const char* const limit = end - 32;
+        do {
+            v1 = accumulate(v1, read64(p));
+            v2 = accumulate(v2, read64(p + 8));
+            v3 = accumulate(v3, read64(p + 16));
+            v4 = accumulate(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    }
+    else {
+        h = seed + Prime5;
+    }
+
+    h += static_cast<uint64_t>(data.size());
+
+    while (p + 8 <= end) {
+        h ^= accumulate(0, read64(p));
+        h = rotl(h, 27) * Prime1 + Prime4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(read32(p)) * Prime1;
+        h = rotl(h, 23) * Prime2 + Prime3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= static_cast<uint64_t>(static_cast<unsigned char>(*p)) * Prime5;
+        h = rotl(h, 11) * Prime1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace server
@@ -0,0 +1,173 @@
+//------------------------------------------------------------------------------
+// FileReader.cpp
+// Reads source files with as little copying as possible.
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#include "util/FileReader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#ifdef _WIN32
+#    include <fstream>
+#else
+#    include <fcntl.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+#if !defined(_WIN32) && !defined(__wasi__)
+#    include <sys/mman.h>
+#    define SLANG_SERVER_MMAP 1
+#endif
+
+namespace server {
+
+FileReader::~FileReader() {
+    unmap();
+}
+
+void FileReader::unmap() {
+#ifdef SLANG_SERVER_MMAP
+    if (m_mapping)
+        ::munmap(m_mapping, m_mappingSize);
+#endif
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+}
+
+char* FileReader::reserve(size_t size) {
+    if (size > m_capacity) {
+        // Grow geometrically, so a run of increasingly large files doesn't reallocate each time
+        m_capacity = std::max(size, m_capacity * 2);
+        m_buffer.reset(new char[m_capacity]);
+    }
+    return m_buffer.get();
+}
+
+#ifdef _WIN32
+
+std::error_code FileReader::read(const std::filesystem::path& path) {
+    unmap();
+    m_text = {};
+
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    if (ec)
+        return ec;
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return std::make_error_code(std::errc::no_such_file_or_directory);
+
+    char* data = reserve(size + 1);
+    file.read(data, std::streamsize(size));
+    size = size_t(file.gcount());
+    data[size] = '\0';
+    m_text = std::string_view(data, size + 1);
+    return {};
+}
+
+#else
+
+namespace {
+
+std::error_code lastError() {
+    return std::error_code(errno, std::generic_category());
+}
+
+#    ifdef SLANG_SERVER_MMAP
+size_t pageSize() {
+    static const size_t size = size_t(::sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+// Whether a file was last modified long enough ago to be safe to map. Modification times in
+// the future, e.g. from clock skew on a network filesystem, don't count as settled.
+bool isSettled(const struct stat& info) {
+    auto age = std::chrono::system_clock::now() -
+               std::chrono::system_clock::from_time_t(info.st_mtime);
+    return age >= FileReader::MapMinAge;
+}
+#    endif
+
+struct FileDescriptor {
+    int fd;
+    ~FileDescriptor() {
+        if (fd >= 0)
+            ::close(fd);
+    }
+};
+
+} // namespace
+
+std::error_code FileReader::read(const std::filesystem::path& path) {
+    unmap();
+    m_text = {};
+
+    FileDescriptor file{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (file.fd < 0)
+        return lastError();
+
+    struct stat info;
+    if (::fstat(file.fd, &info) != 0)
+        return lastError();
+    if (!S_ISREG(info.st_mode))
+        return std::make_error_code(std::errc::invalid_argument);
+
+    size_t size = size_t(info.st_size);
+
+#    ifdef SLANG_SERVER_MMAP
+    // The rest of a mapping's last page reads as zeros, which gives us the terminator for free.
+    // If the file fills its last page exactly there's no room for one, so read it instead.
+    if (size >= MapThreshold && size % pageSize() != 0 && isSettled(info)) {
+        void* mapping = ::mmap(nullptr, size + 1, PROT_READ, MAP_PRIVATE, file.fd, 0);
+        if (mapping != MAP_FAILED) {
+            m_mapping = mapping;
+            m_mappingSize = size + 1;
+
+            // If it changed while being mapped it's still being written, and may be truncated
+            // under us. Read it instead, which can't fault.
+            struct stat after;
+            if (::fstat(file.fd, &after) == 0 && after.st_size == info.st_size &&
+                after.st_mtime == info.st_mtime) {
+                ::madvise(mapping, size + 1, MADV_SEQUENTIAL);
+                ::madvise(mapping, size + 1, MADV_WILLNEED);
+                m_text = std::string_view(static_cast<const char*>(mapping), size + 1);
+                return {};
+            }
+            unmap();
+        }
+    }
+#    endif
+
+#    ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#    endif
+
+    // The size is known up front, so this is usually a single read into a buffer that's
+    // already big enough. Stop early if the file shrank since the stat.
+    char* data = reserve(size + 1);
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = ::read(file.fd, data + total, size - total);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return lastError();
+        }
+        if (n == 0)
+            break;
+        total += size_t(n);
+    }
+
+    data[total] = '\0';
+    m_text = std::string_view(data, total + 1);
+    return {};
+}
+
+#endif
+
+} // namespace server
@@ -0,0 +1,268 @@
+//------------------------------------------------------------------------------
+// Logging.cpp
+// Logging utilities for the LSP server.
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#include "util/Logging.h"
+
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace server::logging {
+
+namespace {
+
+constexpr size_t DefaultRateLimit = 1000;
+constexpr auto RateWindow = std::chrono::seconds(1);
+
+std::string_view prefix(Level level) {
+    switch (level) {
+        case Level::Debug:
+            return "DEBUG: ";
+        case Level::Info:
+            return "INFO: ";
+        case Level::Warn:
+            return "WARN: ";
+        case Level::Error:
+            return "ERROR: ";
+        default:
+            return "";
+    }
+}
+
+/// Collects messages into one buffer that a background thread swaps out and writes with a single
+/// call, so logging threads only take a lock and append
+class Sink {
+public:
+    Sink() : m_thread([this] { run(); }) {}
+
+    ~Sink() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    void write(Level level, std::string_view message) {
+        std::unique_lock lock(m_mutex);
+        // Checked before admit, which can queue the count of dropped messages
+        bool wasEmpty = m_pending.empty();
+        if (admit(level)) {
+            m_pending += prefix(level);
+            m_pending += message;
+            m_pending += '\n';
+            m_queued++;
+        }
+        bool queued = !m_pending.empty();
+        lock.unlock();
+
+        // The thread only sleeps with nothing pending
+        if (wasEmpty && queued)
+            m_wake.notify_one();
+
+        // An error may be the last thing logged before the process dies
+        if (level >= Level::Error)
+            flush();
+    }
+
+    void flush() {
+        std::unique_lock lock(m_mutex);
+        bool wasEmpty = m_pending.empty();
+        rollWindow();
+        if (wasEmpty && !m_pending.empty())
+            m_wake.notify_one();
+
+        uint64_t target = m_queued;
+        m_flushed.wait(lock, [&] { return m_written >= target; });
+    }
+
+    /// Write what's pending from the calling thread, for when the sink thread may never run
+    /// again. Gives up if the lock is held, since the holder may be the thread that's dying.
+    void writeNow() {
+        std::unique_lock lock(m_mutex, std::try_to_lock);
+        if (!lock)
+            return;
+        queueDropped();
+        std::fwrite(m_pending.data(), 1, m_pending.size(), m_output);
+        std::fflush(m_output);
+        m_pending.clear();
+        m_written = m_queued;
+    }
+
+    void setOutput(FILE* file) {
+        flush();
+        std::lock_guard lock(m_mutex);
+        m_output = file;
+    }
+
+    void setRateLimit(size_t messagesPerSecond) {
+        std::lock_guard lock(m_mutex);
+        m_rateLimit = messagesPerSecond;
+    }
+
+    void setClock(std::function<std::chrono::steady_clock::time_point()> now) {
+        std::lock_guard lock(m_mutex);
+        m_clock = std::move(now);
+        m_windowStart = this->now();
+        m_windowCount = 0;
+    }
+
+private:
+    std::chrono::steady_clock::time_point now() const {
+        return m_clock ? m_clock() : std::chrono::steady_clock::now();
+    }
+
+    /// Queue the count of dropped messages, if there are any. Called with the lock held.
+    void queueDropped() {
+        if (m_dropped == 0)
+            return;
+        m_pending += fmt::format("{}{} log messages dropped\n", prefix(Level::Warn), m_dropped);
+        m_queued++;
+        m_dropped = 0;
+    }
+
+    /// Start a new window once the current one is over, reporting what was dropped in it.
+    /// Called with the lock held.
+    void rollWindow() {
+        auto time = now();
+        if (time - m_windowStart < RateWindow)
+            return;
+        m_windowStart = time;
+        m_windowCount = 0;
+        queueDropped();
+    }
+
+    /// Count a message against the limit for the current second. Called with the lock held.
+    bool admit(Level level) {
+        if (m_rateLimit == 0)
+            return true;
+
+        rollWindow();
+        if (++m_windowCount > m_rateLimit && level < Level::Error) {
+            m_dropped++;
+            return false;
+        }
+        return true;
+    }
+
+    void run() {
+        std::string batch;
+        std::unique_lock lock(m_mutex);
+        auto ready = [&] { return m_stopping || !m_pending.empty(); };
+        while (true) {
+            // With messages dropped, wake when the window is over to report them, even if
+            // nothing else is logged
+            if (m_dropped > 0) {
+                m_wake.wait_for(lock, RateWindow, ready);
+                rollWindow();
+            }
+            else {
+                m_wake.wait(lock, ready);
+            }
+
+            if (m_stopping)
+                queueDropped();
+            if (m_pending.empty()) {
+                if (m_stopping)
+                    return;
+                continue;
+            }
+
+            batch.swap(m_pending);
+            uint64_t queued = m_queued;
+            FILE* output = m_output;
+            lock.unlock();
+
+            std::fwrite(batch.data(), 1, batch.size(), output);
+            std::fflush(output);
+            batch.clear();
+
+            lock.lock();
+            m_written = queued;
+            m_flushed.notify_all();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_flushed;
+    std::string m_pending;
+    FILE* m_output = stderr;
+    bool m_stopping = false;
+
+    /// Counts of messages queued and written, for flush
+    uint64_t m_queued = 0;
+    uint64_t m_written = 0;
+
+    size_t m_rateLimit = DefaultRateLimit;
+    std::function<std::chrono::steady_clock::time_point()> m_clock;
+    std::chrono::steady_clock::time_point m_windowStart;
+    size_t m_windowCount = 0;
+    size_t m_dropped = 0;
+
+    std::thread m_thread;
+};
+
+Sink& sink() {
+    static Sink sink;
+    return sink;
+}
+
+std::terminate_handler previousTerminate = nullptr;
+
+} // namespace
+
+std::optional<Level> parseLevel(std::string_view name) {
+    if (name == "debug")
+        return Level::Debug;
+    if (name == "info")
+        return Level::Info;
+    if (name == "warn")
+        return Level::Warn;
+    if (name == "error")
+        return Level::Error;
+    if (name == "off")
+        return Level::Off;
+    return std::nullopt;
+}
+
+void write(Level level, std::string_view message) {
+    sink().write(level, message);
+}
+
+void flush() {
+    sink().flush();
+}
+
+void flushOnTerminate() {
+    // Constructed now, so the handler never has to
+    sink();
+    previousTerminate = std::set_terminate([] {
+        sink().writeNow();
+        if (previousTerminate)
+            previousTerminate();
+        std::abort();
+    });
+}
+
+void setOutput(FILE* file) {
+    sink().setOutput(file);
+}
+
+void setRateLimit(size_t messagesPerSecond) {
+    sink().setRateLimit(messagesPerSecond);
+}
+
+void setClock(std::function<std::chrono::steady_clock::time_point()> now) {
+    sink().setClock(std::move(now));
+}
+
+} // namespace server::logging
@@ -0,0 +1,35 @@
+//------------------------------------------------------------------------------
+// StringPool.cpp
+// Append-only arena for interned strings.
+//
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+//------------------------------------------------------------------------------
+
+#include "util/StringPool.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace server {
+
+std::string_view StringPool::add(std::string_view str) {
+    if (str.empty())
+        return {};
+
+    if (static_cast<size_t>(m_end - m_cur) < str.size()) {
+        // Oversized strings get a chunk of their own
+        size_t size = std::max(ChunkSize, str.size());
+        m_chunks.push_back(std::unique_ptr<char[]>(new char[size]));
+        m_cur = m_chunks.back().get();
+        m_end = m_cur + size;
+        m_allocated += size;
+    }
+
+    char* result = m_cur;
+    std::memcpy(result, str.data(), str.size());
+    m_cur += str.size();
+    return {result, str.size()};
+}
+
+} // namespace server
@@ -0,0 +1,128 @@
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+
+#include "catch2/catch_test_macros.hpp"
+#include "util/ChunkedVector.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace server;
+
+TEST_CASE("ChunkedVector copies share chunks until they're edited") {
+    ChunkedVector<int, 4> original;
+    for (int i = 0; i < 10; i++)
+        original.push_back(i);
+    CHECK(original.size() == 10);
+
+    ChunkedVector<int, 4> copy(original);
+    for (size_t i = 0; i < copy.size(); i++)
+        CHECK(&copy[i] == &original[i]);
+
+    // Only the edited chunk is duplicated
+    copy.edit(5) = 50;
+    CHECK(copy[5] == 50);
+    CHECK(original[5] == 5);
+    for (size_t i = 0; i < copy.size(); i++) {
+        bool edited = i >= 4 && i < 8;
+        CHECK((&copy[i] == &original[i]) != edited);
+    }
+
+    // Once a copy owns a chunk, writing to it again doesn't duplicate it
+    const int* owned = &copy[5];
+    copy.edit(6) = 60;
+    CHECK(&copy[5] == owned);
+
+    // Shrinking resets the dropped elements, in case the vector grows again
+    copy.resize(5);
+    copy.resize(7);
+    CHECK(copy[4] == 4);
+    CHECK(copy[6] == 0);
+    CHECK(original[6] == 6);
+
+    CHECK(std::ranges::count_if(original, [](int i) { return i % 2 == 0; }) == 5);
+}
+
+TEST_CASE("ChunkedVector originals don't write into chunks a copy shares") {
+    ChunkedVector<int, 4> original;
+    for (int i = 0; i < 8; i++)
+        original.push_back(i);
+
+    {
+        ChunkedVector<int, 4> copy(original);
+        original.edit(1) = 10;
+        CHECK(original[1] == 10);
+        CHECK(copy[1] == 1);
+        CHECK(&copy[5] == &original[5]);
+    }
+
+    // Once the copy is gone the chunk is the original's alone again
+    const int* owned = &original[5];
+    original.edit(5) = 50;
+    CHECK(&original[5] == owned);
+}
+
+TEST_CASE("ChunkedVector copies share elements that own memory") {
+    ChunkedVector<std::vector<int>, 4> original;
+    for (int i = 0; i < 4; i++)
+        original.push_back(std::vector<int>(100, i));
+
+    // Writing through a copy duplicates the chunk's pointers and the one element written to
+    ChunkedVector<std::vector<int>, 4> copy(original);
+    copy.edit(2).push_back(-1);
+    CHECK(copy[2].size() == 101);
+    CHECK(original[2].size() == 100);
+    CHECK(&copy[0] == &original[0]);
+    CHECK(&copy[2] != &original[2]);
+
+    // Elements never written to read as empty
+    copy.resize(6);
+    CHECK(copy[5].empty());
+    CHECK(original.size() == 4);
+}
+
+TEST_CASE("ChunkedMap copies share buckets until they're edited") {
+    ChunkedMap<std::string, int> original;
+    for (int i = 0; i < 1000; i++)
+        original.edit(std::to_string(i)) = i;
+    CHECK(original.size() == 1000);
+
+    ChunkedMap<std::string, int> copy(original);
+    copy.edit("500") = -1;
+    CHECK(*copy.find("500") == -1);
+    CHECK(*original.find("500") == 500);
+
+    // The write duplicated only the bucket holding "500", so nearly every value is still the
+    // original's
+    size_t shared = 0;
+    for (int i = 0; i < 1000; i++) {
+        auto key = std::to_string(i);
+        if (copy.find(key) == original.find(key))
+            shared++;
+    }
+    CHECK(shared >= 990);
+    CHECK(shared < 1000);
+
+    copy.edit("new") = 1000;
+    CHECK(copy.size() == 1001);
+    CHECK(original.size() == 1000);
+    CHECK(*copy.find("new") == 1000);
+    CHECK(original.find("new") == nullptr);
+}
+
+TEST_CASE("ChunkedMap edits of existing keys don't rehash") {
+    ChunkedMap<int, int> map;
+    for (int i = 0; i < 256; i++)
+        map.edit(i) = i;
+
+    // The table is full, so only an insert may grow it and move the entries
+    const int* before = map.find(5);
+    map.edit(7) = 70;
+    CHECK(map.find(5) == before);
+    CHECK(map.size() == 256);
+
+    map.edit(256) = 256;
+    CHECK(map.size() == 257);
+    CHECK(*map.find(5) == 5);
+    CHECK(*map.find(7) == 70);
+}
@@ -3,6 +3,7 @@
 
 #include "utils/GoldenTest.h"
 #include "utils/ServerHarness.h"
+#include <algorithm>
 #include <cstdlib>
 
 TEST_CASE("SingleFileDiag") {
@@ -493,3 +494,61 @@ endmodule
         }
     }
 }
+
+namespace {
+// Sends a change to the driver; without a message loop the server would update right away
+void changeWithoutUpdate(ServerHarness& server, DocumentHandle& doc, std::string text) {
+    doc.replaceAll(std::move(text));
+    server.m_driver->onDocDidChange(lsp::DidChangeTextDocumentParams{
+        .textDocument = lsp::VersionedTextDocumentIdentifier{.uri = doc.m_uri},
+        .contentChanges = doc.pending_changes});
+    doc.pending_changes.clear();
+    doc.state = DocState::Open;
+}
+} // namespace
+
+TEST_CASE("DiagsDeferredUntilEditsStop") {
+    ServerHarness server;
+
+    auto doc = server.openFile("deferred.sv", "module top;\nendmodule\n");
+    CHECK(doc.getDiagnostics().empty());
+    auto& driver = *server.m_driver;
+
+    // Edits apply immediately, but diagnostics wait for the delay
+    changeWithoutUpdate(server, doc, "module top;\n    blargh\nendmodule\n");
+    CHECK(doc.doc->getText().starts_with("module top;\n    blargh"));
+    CHECK(doc.getDiagnostics().empty());
+
+    // A later edit supersedes the pending update
+    changeWithoutUpdate(server, doc, "module top;\n    blargh2\nendmodule\n");
+    auto delay = driver.flushDueUpdates();
+    REQUIRE(delay);
+    CHECK(delay->count() <= server.getConfig().diagnosticsDelay.value());
+    CHECK(doc.getDiagnostics().empty());
+
+    // Looking the document up for a query sees the edit without publishing anything
+    CHECK(driver.getDocument(doc.m_uri)->getSyntaxTree()->diagnostics().size() > 0);
+    CHECK(doc.getDiagnostics().empty());
+    CHECK(driver.flushDueUpdates());
+
+    driver.flushUpdates();
+    CHECK(!doc.getDiagnostics().empty());
+    CHECK(!driver.flushDueUpdates());
+}
+
+TEST_CASE("CompletionMidBurstLeavesDiagsPending") {
+    ServerHarness server;
+
+    auto doc = server.openFile("deferred_completion.sv", "module top;\nendmodule\n");
+    CHECK(doc.getDiagnostics().empty());
+
+    changeWithoutUpdate(server, doc,
+                        "module top;\n    logic fresh;\n    blargh\n    assign f\nendmodule\n");
+    auto completions = doc.after("assign f").getCompletions();
+    CHECK(std::ranges::any_of(completions,
+                              [](const auto& item) { return item.m_item.label == "fresh"; }));
+    CHECK(doc.getDiagnostics().empty());
+
+    server.m_driver->flushUpdates();
+    CHECK(!doc.getDiagnostics().empty());
+}
@@ -0,0 +1,114 @@
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+
+#include "catch2/catch_test_macros.hpp"
+#include "document/DocumentText.h"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace server;
+
+namespace {
+using Starts = std::vector<size_t>;
+
+/// Line starts computed from scratch, as SourceManager::computeLineOffsets does
+Starts lineStarts(std::string_view text) {
+    Starts starts{0};
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c != '\n' && c != '\r')
+            continue;
+        if (i + 1 < text.size() && (text[i + 1] == '\n' || text[i + 1] == '\r') &&
+            text[i + 1] != c)
+            i++;
+        starts.push_back(i + 1);
+    }
+    return starts;
+}
+} // namespace
+
+TEST_CASE("DocumentText applies edits by line and character") {
+    std::string original = "module m;\n  logic a;\nendmodule\n";
+    DocumentText text(original);
+    REQUIRE(text.lineCount() == 4);
+    CHECK(!text.isModified());
+
+    // Type a declaration on a new line
+    auto offset = text.offsetOf(2, 0).value();
+    for (char c : std::string_view("  logic b;\n")) {
+        text.replace(offset++, 0, std::string_view(&c, 1));
+    }
+    CHECK(text.isModified());
+    CHECK(text.str() == "module m;\n  logic a;\n  logic b;\nendmodule\n");
+    CHECK(text.lineStarts() == Starts({0, 10, 21, 32, 42}));
+
+    // Delete across lines
+    auto start = text.offsetOf(1, 2).value();
+    text.replace(start, text.offsetOf(2, 2).value() - start, "");
+    CHECK(text.str() == "module m;\n  logic b;\nendmodule\n");
+    CHECK(text.lineStarts() == lineStarts(text.str()));
+
+    CHECK(!text.offsetOf(4, 0));
+    CHECK(text.offsetOf(3, 100) == text.size());
+
+    std::string materialized = text.str();
+    text.rebase(materialized);
+    CHECK(!text.isModified());
+    CHECK(text.str() == materialized);
+}
+
+TEST_CASE("DocumentText line breaks combine like the source manager's") {
+    std::string original = "a\rb";
+    DocumentText text(original);
+    CHECK(text.lineStarts() == Starts({0, 2}));
+
+    // \r then \n is one line break
+    text.replace(2, 0, "\n");
+    CHECK(text.lineStarts() == Starts({0, 3}));
+
+    // Until something comes between them
+    text.replace(2, 0, "x");
+    CHECK(text.lineStarts() == Starts({0, 2, 4}));
+
+    text.assign("\n\r\n\r");
+    CHECK(text.lineStarts() == Starts({0, 2, 4}));
+}
+
+TEST_CASE("DocumentText matches a string under random edits") {
+    std::mt19937 rng(1234);
+    const std::string alphabet = "ab \n\n\r";
+    auto randomText = [&](size_t maxLength) {
+        std::string result(std::uniform_int_distribution<size_t>(0, maxLength)(rng), ' ');
+        for (auto& c : result)
+            c = alphabet[std::uniform_int_distribution<size_t>(0, alphabet.size() - 1)(rng)];
+        return result;
+    };
+
+    for (int round = 0; round < 50; round++) {
+        std::string original = randomText(200);
+        std::string expected = original;
+        DocumentText text(original);
+
+        for (int edit = 0; edit < 40; edit++) {
+            size_t offset = std::uniform_int_distribution<size_t>(0, expected.size())(rng);
+            size_t length = std::uniform_int_distribution<size_t>(0, expected.size() - offset)(rng);
+            length = std::min<size_t>(length, 8);
+            std::string inserted = randomText(6);
+
+            text.replace(offset, length, inserted);
+            expected.replace(offset, length, inserted);
+            REQUIRE(text.str() == expected);
+            REQUIRE(text.lineStarts() == lineStarts(expected));
+        }
+
+        // Writing it out and starting over keeps working
+        std::string materialized = text.str();
+        text.rebase(materialized);
+        text.replace(0, 0, "\n");
+        expected.insert(0, "\n");
+        CHECK(text.str() == expected);
+        CHECK(text.lineStarts() == lineStarts(expected));
+    }
+}
@@ -134,6 +134,23 @@ TEST_CASE("getAnalysis with cross-file dependencies is stable") {
     CHECK(a1.get() == a2.get());
 }
 
+TEST_CASE("getAnalysis reuses the analysis when refreshed dependencies are unchanged") {
+    ServerHarness server("indexer_test");
+    auto hdl = server.openFile("crossfile_module.sv");
+    hdl.ensureSynced();
+
+    // Refreshing finds the same dependency trees
+    auto before = hdl.doc->getAnalysis();
+    auto refreshed = hdl.doc->getAnalysis(true);
+    CHECK(before.get() == refreshed.get());
+
+    // But not after an edit
+    hdl.append("\n// comment\n");
+    hdl.publishChanges();
+    auto after = hdl.doc->getAnalysis(true);
+    CHECK(before.get() != after.get());
+}
+
 TEST_CASE("LoadConfig") {
     ServerHarness server("basic_config");
     auto flags = server.getConfig().flags.value();
@@ -0,0 +1,203 @@
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+
+#include "Indexer.h"
+#include "catch2/catch_test_macros.hpp"
+#include "util/ContentHash.h"
+#include "util/FileReader.h"
+#include "utils/Utils.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <fmt/format.h>
+#include <sstream>
+#ifdef __linux__
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
+
+#include "slang/util/OS.h"
+
+using namespace server;
+
+namespace {
+void writeFile(const fs::path& path, std::string_view text) {
+    std::ofstream out(path, std::ios::binary);
+    out << text;
+}
+} // namespace
+
+TEST_CASE("FileReader reads small and large files with a null terminator") {
+    auto tempDir = fs::temp_directory_path() / "slang_test_file_reader";
+    fs::remove_all(tempDir);
+    fs::create_directories(tempDir);
+
+    std::string small = "module small; endmodule\n";
+    std::string large;
+    while (large.size() < FileReader::MapThreshold * 2)
+        large += "module m" + std::to_string(large.size()) + "; endmodule\n";
+
+    writeFile(tempDir / "small.sv", small);
+    writeFile(tempDir / "large.sv", large);
+    writeFile(tempDir / "empty.sv", "");
+
+    FileReader reader;
+    REQUIRE(!reader.read(tempDir / "large.sv"));
+    CHECK(reader.getText() == large + '\0');
+
+    // Reusing the reader drops the previous file
+    REQUIRE(!reader.read(tempDir / "small.sv"));
+    CHECK(!reader.isMapped());
+    CHECK(reader.getText() == small + '\0');
+
+    REQUIRE(!reader.read(tempDir / "empty.sv"));
+    CHECK(reader.getText() == std::string_view("\0", 1));
+
+    CHECK(reader.read(tempDir / "missing.sv"));
+    CHECK(reader.getText().empty());
+
+    // Same bytes as the slang reader, so content hashes in the index cache stay valid
+    slang::SmallVector<char> buffer;
+    REQUIRE(!slang::OS::readFile(tempDir / "large.sv", buffer));
+    REQUIRE(!reader.read(tempDir / "large.sv"));
+    CHECK(contentHash(reader.getText()) ==
+          contentHash(std::string_view(buffer.data(), buffer.size())));
+
+    fs::remove_all(tempDir);
+}
+
+TEST_CASE("FileReader only maps files that have stopped changing") {
+    auto tempDir = fs::temp_directory_path() / "slang_test_file_reader_settled";
+    fs::remove_all(tempDir);
+    fs::create_directories(tempDir);
+
+    std::string large;
+    while (large.size() < FileReader::MapThreshold * 2)
+        large += "module m" + std::to_string(large.size()) + "; endmodule\n";
+    // A file that fills its last page exactly is never mapped
+    if (large.size() % 4096 == 0)
+        large += '\n';
+
+    writeFile(tempDir / "recent.sv", large);
+    writeFile(tempDir / "settled.sv", large);
+    fs::last_write_time(tempDir / "settled.sv",
+                        fs::file_time_type::clock::now() - std::chrono::hours(1));
+
+    // A file that was just written may still be truncated, which would fault a mapping. Read
+    // into a buffer, the text survives it.
+    FileReader reader;
+    REQUIRE(!reader.read(tempDir / "recent.sv"));
+    CHECK(!reader.isMapped());
+    writeFile(tempDir / "recent.sv", "module cut;");
+    CHECK(reader.getText() == large + '\0');
+
+    REQUIRE(!reader.read(tempDir / "settled.sv"));
+#if !defined(_WIN32) && !defined(__wasi__)
+    CHECK(reader.isMapped());
+#endif
+    CHECK(reader.getText() == large + '\0');
+
+    fs::remove_all(tempDir);
+}
+
+// Run with: server_unittests "[benchmark]"
+// Set SLANG_BENCH_DIR to measure a real source tree instead of a generated one.
+TEST_CASE("FileReader throughput", "[.][benchmark]") {
+    auto tempDir = fs::temp_directory_path() / "slang_bench_file_reader";
+    std::vector<fs::path> files;
+    if (auto dir = std::getenv("SLANG_BENCH_DIR")) {
+        for (const auto& entry : fs::recursive_directory_iterator(dir)) {
+            auto ext = entry.path().extension();
+            if (entry.is_regular_file() && (ext == ".sv" || ext == ".svh" || ext == ".v"))
+                files.push_back(entry.path());
+        }
+    }
+    else {
+        // A mix of typical small files and a few large generated ones
+        std::stringstream corpus;
+        corpus << std::ifstream(findSlangRoot() / "tests" / "data" / "all.sv").rdbuf();
+        auto text = corpus.str();
+        REQUIRE(!text.empty());
+
+        fs::remove_all(tempDir);
+        fs::create_directories(tempDir);
+        auto generate = [&](std::string_view prefix, size_t count, size_t size) {
+            for (size_t i = 0; i < count; i++) {
+                std::string contents;
+                while (contents.size() < size)
+                    contents += text;
+                auto path = tempDir / fmt::format("{}_{}.sv", prefix, i);
+                writeFile(path, contents);
+                files.push_back(path);
+            }
+        };
+        generate("small", 2000, 8 * 1024);
+        generate("large", 40, 1024 * 1024);
+    }
+    REQUIRE(!files.empty());
+
+    size_t totalBytes = 0;
+    for (const auto& file : files)
+        totalBytes += fs::file_size(file);
+
+    auto evict = [&] {
+#ifdef __linux__
+        for (const auto& file : files) {
+            int fd = ::open(file.c_str(), O_RDONLY);
+            if (fd >= 0) {
+                ::fdatasync(fd);
+                ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                ::close(fd);
+            }
+        }
+#endif
+    };
+
+    auto measure = [&](std::string_view name, bool cold, auto&& run) {
+        if (cold)
+            evict();
+        auto start = std::chrono::steady_clock::now();
+        run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        fmt::print("{:<28} {:>5} {:>10.1f} MB/s\n", name, cold ? "cold" : "warm",
+                   double(totalBytes) / (1024 * 1024) / elapsed.count());
+    };
+
+    // Both read paths hash every byte, like indexing does, so mapped pages are actually touched
+    uint64_t readHash = 0;
+    auto readWithSlang = [&] {
+        slang::SmallVector<char> buffer;
+        for (const auto& file : files) {
+            buffer.clear();
+            if (!slang::OS::readFile(file, buffer))
+                readHash += contentHash(std::string_view(buffer.data(), buffer.size()));
+        }
+    };
+    uint64_t readerHash = 0;
+    auto readWithReader = [&] {
+        FileReader reader;
+        for (const auto& file : files) {
+            if (!reader.read(file))
+                readerHash += contentHash(reader.getText());
+        }
+    };
+
+    std::vector<std::string> globs;
+    for (const auto& file : files)
+        globs.push_back(file.string());
+    auto index = [&] {
+        Indexer indexer;
+        indexer.startIndexing(globs, {});
+    };
+
+    fmt::print("{} files, {:.1f} MB\n", files.size(), double(totalBytes) / (1024 * 1024));
+    for (bool cold : {true, false}) {
+        measure("OS::readFile", cold, readWithSlang);
+        measure("FileReader", cold, readWithReader);
+        measure("Indexer", cold, index);
+    }
+    CHECK(readHash == readerHash);
+
+    if (!std::getenv("SLANG_BENCH_DIR"))
+        fs::remove_all(tempDir);
+}
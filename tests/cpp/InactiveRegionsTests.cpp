@@ -190,7 +190,7 @@ endmodule
 )");
 
     auto& sm = server.sourceManager();
-    auto& syntaxes = doc.doc->getAnalysis()->syntaxes;
+    auto& syntaxes = doc.doc->getAnalysis()->getSyntaxes();
 
     std::vector<RegionInfo> regions;
     regions.reserve(syntaxes.disabledRegions.size());
@@ -5,7 +5,17 @@
 #include "catch2/catch_test_macros.hpp"
 #include "utils/ServerHarness.h"
 #include "utils/Utils.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include "slang/text/SourceManager.h"
 
 using namespace server;
 
@@ -296,5 +306,474 @@ TEST_CASE("Index document lifecycle - macros") {
     files = indexer.getFilesForMacro("ANOTHER_MACRO");
     CHECK(files.empty());
 
+    // Names stay interned after removal, but aren't listed without entries
+    auto names = indexer.getAllMacroNames();
+    CHECK(std::ranges::find(names, "MY_MACRO") != names.end());
+    CHECK(std::ranges::find(names, "ANOTHER_MACRO") == names.end());
+
     doc.close();
 }
+
+TEST_CASE("Index cache reuses unchanged files") {
+    auto tempDir = std::filesystem::temp_directory_path() / "slang_test_index_cache";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir);
+    auto cacheFile = tempDir / "cache" / "index.cache";
+    auto fileA = tempDir / "a.sv";
+    auto fileB = tempDir / "b.sv";
+    {
+        std::ofstream out(fileA);
+        out << "module cached_a; endmodule\n";
+    }
+    {
+        std::ofstream out(fileB);
+        out << "module cached_b; endmodule\n";
+    }
+
+    {
+        Indexer indexer;
+        indexer.setCacheFile(cacheFile);
+        indexer.startIndexing({fileA.string(), fileB.string()}, {});
+        CHECK(indexer.getFilesForSymbol("cached_a").size() == 1);
+        CHECK(indexer.getFilesForSymbol("cached_b").size() == 1);
+    }
+    REQUIRE(std::filesystem::exists(cacheFile));
+
+    // Rewrite a.sv keeping its size and mtime; the cached entry is trusted, so the new module
+    // name must not show up. b.sv really changed and has to be re-indexed.
+    auto timeA = std::filesystem::last_write_time(fileA);
+    {
+        std::ofstream out(fileA);
+        out << "module cached_x; endmodule\n";
+    }
+    std::filesystem::last_write_time(fileA, timeA);
+    {
+        std::ofstream out(fileB);
+        out << "module cached_renamed; endmodule\n";
+    }
+
+    Indexer indexer;
+    indexer.setCacheFile(cacheFile);
+    indexer.startIndexing({fileA.string(), fileB.string()}, {});
+    CHECK(indexer.getFilesForSymbol("cached_a").size() == 1);
+    CHECK(indexer.getFilesForSymbol("cached_x").empty());
+    CHECK(indexer.getFilesForSymbol("cached_b").empty());
+    CHECK(indexer.getFilesForSymbol("cached_renamed").size() == 1);
+
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST_CASE("IndexScanMatchesParser") {
+    // Every file in tests/data, including all.sv, which exercises every corner of the grammar
+    auto root = findSlangRoot() / "tests" / "data";
+    std::vector<std::filesystem::path> paths;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(root)) {
+        auto ext = entry.path().extension();
+        if (entry.is_regular_file() && (ext == ".sv" || ext == ".svh"))
+            paths.push_back(entry.path());
+    }
+    std::ranges::sort(paths);
+    REQUIRE(!paths.empty());
+
+    Indexer scanIndexer;
+    scanIndexer.setExtractMode(Indexer::ExtractMode::Scan);
+    scanIndexer.addDocuments(paths);
+
+    Indexer parseIndexer;
+    parseIndexer.setExtractMode(Indexer::ExtractMode::Parse);
+    parseIndexer.addDocuments(paths);
+
+    CHECK(scanIndexer.getSymbolCount() > 0);
+
+    // Each dump line prefixed with its file, relative to tests/data
+    auto entries = [&](const std::string& dump) {
+        std::set<std::string> result;
+        std::string file;
+        std::istringstream lines(dump);
+        for (std::string line; std::getline(lines, line);) {
+            if (!line.starts_with(' '))
+                file = std::filesystem::path(line).lexically_relative(root).generic_string();
+            else
+                result.insert(file + ":" + line);
+        }
+        return result;
+    };
+    auto scanned = entries(scanIndexer.dumpIndex());
+    auto parsed = entries(parseIndexer.dumpIndex());
+
+    // The scanner is only trusted because it agrees with the parser; report any difference
+    auto onlyIn = [](const std::set<std::string>& a, const std::set<std::string>& b) {
+        std::string result;
+        for (const auto& entry : a) {
+            if (!b.contains(entry))
+                result += entry + "\n";
+        }
+        return result;
+    };
+    auto onlyScanned = onlyIn(scanned, parsed);
+    auto onlyParsed = onlyIn(parsed, scanned);
+    CAPTURE(onlyScanned, onlyParsed);
+    CHECK(onlyScanned.empty());
+    CHECK(onlyParsed.empty());
+}
+
+TEST_CASE("Index scan handles constructs that look like instantiations") {
+    auto tempDir = std::filesystem::temp_directory_path() / "slang_test_scan_constructs";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir);
+    auto file = tempDir / "constructs.sv";
+    {
+        std::ofstream out(file);
+        out << R"(
+package pk;
+    program; endprogram
+endpackage
+
+module user(interface.mp gen, Ifc.mp named);
+    prim prim_inst(q, r);
+    chk c1(a, b);
+    initial begin
+        chk c2(a, b);
+    end
+    program nested_prog;
+    endprogram
+    nested_prog np();
+    A b1 = B::new;
+endmodule
+
+bind user bound_mod #(1) bound(.a());
+
+config cfg;
+    design work.user;
+    default liblist lib_a lib_b;
+    cell user use work.user;
+endconfig
+
+function int Cls::foo;
+endfunction
+
+function Gen::T Gen::bar;
+endfunction
+)";
+    }
+
+    for (auto mode : {Indexer::ExtractMode::Scan, Indexer::ExtractMode::Parse}) {
+        Indexer indexer;
+        indexer.setExtractMode(mode);
+        indexer.addDocuments({file});
+        auto dump = indexer.dumpIndex();
+        CAPTURE(dump);
+
+        // UDPs, checkers, bind targets, interface port types, and the class or package of a
+        // scoped name are all references
+        for (auto name : {"prim", "chk", "bound_mod", "Ifc", "B", "Cls", "Gen"})
+            CHECK(indexer.getFilesReferencingSymbol(name).size() == 1);
+
+        // A generic interface port, a nested program, config cells and libraries, and the left
+        // side of a declaration with an initializer aren't
+        for (auto name : {"interface", "nested_prog", "lib_a", "work", "A"})
+            CHECK(indexer.getFilesReferencingSymbol(name).empty());
+
+        // Config declarations and nested or anonymous programs aren't global symbols
+        CHECK(indexer.getFilesForSymbol("pk").size() == 1);
+        CHECK(indexer.getFilesForSymbol("user").size() == 1);
+        CHECK(indexer.getFilesForSymbol("cfg").empty());
+        CHECK(indexer.getFilesForSymbol("nested_prog").empty());
+    }
+
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST_CASE("Index queries see a complete snapshot while reindexing") {
+    auto testPath = std::filesystem::path(getTestDataPath());
+    Indexer indexer;
+    indexer.startIndexing({(testPath / "modules.sv").string()}, {});
+
+    // Re-adding a file swaps in a new snapshot; readers must never see it half removed
+    std::atomic<bool> done = false;
+    std::thread writer([&] {
+        for (int i = 0; i < 50; i++)
+            indexer.addDocuments({testPath / "modules.sv"});
+        done = true;
+    });
+
+    size_t misses = 0;
+    while (!done) {
+        if (indexer.getFilesForSymbol("m1").size() != 1)
+            misses++;
+    }
+    writer.join();
+
+    CHECK(misses == 0);
+    CHECK(indexer.getFilesForSymbol("m1").size() == 1);
+}
+
+TEST_CASE("Background indexing reports progress and prioritizes requested files") {
+    auto testPath = getTestDataPath();
+    Indexer indexer;
+
+    // Requested before indexing starts, so the package goes in its own first batch
+    std::vector<std::string> names{"crossfile_pkg"};
+    indexer.prioritize(names);
+
+    std::vector<std::pair<size_t, size_t>> progress;
+    indexer.startBackgroundIndexing(std::vector<std::string>{testPath + "/*.sv"}, {},
+                                    [&](size_t done, size_t total) {
+                                        progress.emplace_back(done, total);
+                                    });
+    CHECK(indexer.isIndexing());
+    indexer.waitForIndexing();
+    CHECK(!indexer.isIndexing());
+
+    REQUIRE(progress.size() >= 2);
+    CHECK(progress.front().first < progress.front().second);
+    CHECK(progress.back().first == progress.back().second);
+    CHECK(std::ranges::is_sorted(progress));
+
+    // Once for the prioritized batch, once when done
+    CHECK(indexer.getGeneration() >= 2);
+    CHECK(indexer.getFilesForSymbol("m1").size() == 1);
+    CHECK(indexer.getFilesForSymbol("crossfile_pkg").size() == 1);
+}
+
+TEST_CASE("Indexing progress is only sent once the client has created its token") {
+    ServerHarness server(lsp::InitializeParams{
+        .capabilities = {.window = lsp::WindowClientCapabilities{.workDoneProgress = true}}});
+    auto& client = server.client;
+    REQUIRE(client.m_progressCreated.empty());
+
+    auto kinds = [&] {
+        std::vector<std::string> result;
+        for (const auto& params : client.m_progress) {
+            auto json = rfl::json::write(params.value);
+            for (auto kind : {"begin", "report", "end"}) {
+                if (json.find(fmt::format(R"("kind":"{}")", kind)) != std::string::npos)
+                    result.emplace_back(kind);
+            }
+        }
+        return result;
+    };
+
+    server.onIndexingProgress(1, 10);
+    REQUIRE(client.m_progressCreated.size() == 1);
+    server.onIndexingProgress(5, 10);
+    CHECK(client.m_progress.empty());
+
+    // Begins with where indexing got to while the client was creating the token
+    client.m_progressCreated[0]();
+    server.onIndexingProgress(8, 10);
+    server.onIndexingProgress(10, 10);
+    CHECK(kinds() == std::vector<std::string>{"begin", "report", "end"});
+
+    // A token created after indexing finished is never used
+    server.onIndexingProgress(1, 10);
+    REQUIRE(client.m_progressCreated.size() == 2);
+    server.onIndexingProgress(10, 10);
+    client.m_progressCreated[1]();
+    CHECK(kinds() == std::vector<std::string>{"begin", "report", "end"});
+}
+
+TEST_CASE("Directory crawl skips excluded directory names at any level") {
+    auto tempDir = std::filesystem::temp_directory_path() / "slang_test_index_crawl";
+    std::filesystem::remove_all(tempDir);
+    auto write = [&](const std::filesystem::path& rel, std::string_view module) {
+        auto path = tempDir / rel;
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream out(path);
+        out << "module " << module << "; endmodule\n";
+    };
+    write("rtl/top.sv", "crawl_top");
+    write("rtl/sub/deep/leaf.v", "crawl_leaf");
+    write("rtl/build/gen.sv", "crawl_generated");
+    write("build/gen.sv", "crawl_generated_root");
+    write("rebuild/kept.sv", "crawl_kept");
+    write("rtl/notes.txt", "crawl_not_sv");
+
+    Config::IndexConfig config;
+    config.dirs.value() = {"."};
+    config.excludeDirs.value() = std::vector<std::string>{"build"};
+
+    Indexer indexer;
+    indexer.setNumThreads(4);
+    indexer.startIndexing({config}, tempDir.string());
+
+    CHECK(indexer.getFilesForSymbol("crawl_top").size() == 1);
+    CHECK(indexer.getFilesForSymbol("crawl_leaf").size() == 1);
+    CHECK(indexer.getFilesForSymbol("crawl_kept").size() == 1);
+    CHECK(indexer.getFilesForSymbol("crawl_generated").empty());
+    CHECK(indexer.getFilesForSymbol("crawl_generated_root").empty());
+    CHECK(indexer.getFilesForSymbol("crawl_not_sv").empty());
+
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST_CASE("Transitive dependencies and dependents follow the reference graph") {
+    auto tempDir = std::filesystem::temp_directory_path() / "slang_test_index_deps";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir);
+    auto write = [&](std::string_view name, std::string_view text) {
+        std::ofstream out(tempDir / name);
+        out << text;
+    };
+    write("dep_base_pkg.sv", "package dep_base_pkg; endpackage\n");
+    write("dep_pkg.sv", "package dep_pkg; import dep_base_pkg::*; endpackage\n");
+    write("dep_leaf.sv", "module dep_leaf; endmodule\n");
+    write("dep_mid.sv", "module dep_mid; import dep_pkg::*; dep_leaf u(); endmodule\n");
+    write("dep_top.sv", "module dep_top; dep_mid u(); endmodule\n");
+
+    Indexer indexer;
+    indexer.startIndexing(std::vector<std::string>{(tempDir / "*.sv").string()}, {});
+
+    auto names = [](const std::vector<std::filesystem::path>& paths) {
+        std::vector<std::string> result;
+        for (const auto& path : paths)
+            result.push_back(path.filename().string());
+        return result;
+    };
+    auto sorted = [](std::vector<std::string> files) {
+        std::ranges::sort(files);
+        return files;
+    };
+
+    auto deps = names(indexer.getDependencies("dep_top"));
+    REQUIRE(deps.size() == 4);
+    CHECK(deps.front() == "dep_mid.sv");
+    CHECK(deps.back() == "dep_base_pkg.sv");
+    CHECK(sorted(deps) == std::vector<std::string>{"dep_base_pkg.sv", "dep_leaf.sv", "dep_mid.sv",
+                                                    "dep_pkg.sv"});
+    CHECK(indexer.getDependencies("dep_leaf").empty());
+    CHECK(indexer.getDependencies("no_such_symbol").empty());
+
+    auto dependents = names(indexer.getDependents("dep_base_pkg"));
+    CHECK(dependents == std::vector<std::string>{"dep_pkg.sv", "dep_mid.sv", "dep_top.sv"});
+    CHECK(indexer.getDependents("dep_top").empty());
+
+    // Only packages and interfaces are followed when collecting files for analysis
+    std::vector<std::string_view> referenced{"dep_mid", "dep_pkg", "dep_top"};
+    std::vector<std::string_view> declared{"dep_top"};
+    auto analysis = names(indexer.getAnalysisDependencies(referenced, declared));
+    CHECK(analysis == std::vector<std::string>{"dep_mid.sv", "dep_pkg.sv", "dep_base_pkg.sv"});
+
+    // The graph follows edits to the files
+    write("dep_pkg.sv", "package dep_pkg; endpackage\n");
+    indexer.startIndexing(std::vector<std::string>{(tempDir / "*.sv").string()}, {});
+    CHECK(names(indexer.getDependents("dep_base_pkg")).empty());
+    CHECK(sorted(names(indexer.getDependencies("dep_top"))) ==
+          std::vector<std::string>{"dep_leaf.sv", "dep_mid.sv", "dep_pkg.sv"});
+
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST_CASE("Changed files are only reindexed when their symbols change") {
+    auto tempDir = std::filesystem::temp_directory_path() / "slang_test_index_changed";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir);
+    auto path = tempDir / "changed.sv";
+    auto write = [&](std::string_view text) {
+        std::ofstream out(path);
+        out << text;
+    };
+    write("module changed_a; changed_b u(); endmodule\n");
+    Indexer indexer;
+    indexer.startIndexing(std::vector<std::string>{path.string()}, {});
+    auto before = indexer.dumpIndex();
+
+    auto changed = [&] {
+        indexer.onWorkspaceDidChangeWatchedFiles(lsp::DidChangeWatchedFilesParams{
+            .changes = {{lsp::FileEvent{.uri = URI::fromFile(path),
+                                        .type = lsp::FileChangeType::Changed}}}});
+    };
+
+    // Rewritten with the same contents, e.g. by a branch switch
+    write("module changed_a; changed_b u(); endmodule\n");
+    changed();
+    CHECK(indexer.dumpIndex() == before);
+    CHECK(indexer.getUpdateStats().unchangedContent == 1);
+    CHECK(indexer.getUpdateStats().unchangedNames == 0);
+
+    // Different contents, same symbols
+    write("// A comment\nmodule changed_a;\n    changed_b u();\nendmodule\n");
+    changed();
+    CHECK(indexer.dumpIndex() == before);
+    CHECK(indexer.getUpdateStats().unchangedNames == 1);
+    CHECK(indexer.getUpdateStats().reindexed == 0);
+
+    write("module changed_c; endmodule\n");
+    changed();
+    CHECK(indexer.getUpdateStats().reindexed == 1);
+    CHECK(indexer.getFilesForSymbol("changed_a").empty());
+    CHECK(indexer.getFilesForSymbol("changed_c").size() == 1);
+    CHECK(indexer.getFilesReferencingSymbol("changed_b").empty());
+
+    std::filesystem::remove_all(path);
+    changed();
+    CHECK(indexer.getFilesForSymbol("changed_c").empty());
+
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST_CASE("Saved documents are indexed with their file stats and content hash") {
+    auto tempDir = std::filesystem::temp_directory_path() / "slang_test_index_saved";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir);
+    auto cacheFile = tempDir / "cache" / "index.cache";
+    auto path = tempDir / "saved.sv";
+    std::string text = "module saved_a; endmodule\n";
+    std::ofstream(path) << text;
+
+    {
+        slang::SourceManager sm;
+        auto tree = slang::syntax::SyntaxTree::fromText(text, sm, "saved.sv", "", {});
+        Indexer indexer;
+        indexer.setCacheFile(cacheFile);
+        indexer.updateDocument(path, *tree);
+
+        // The hash is the file's, so a change event for the same contents doesn't parse it
+        indexer.onWorkspaceDidChangeWatchedFiles(lsp::DidChangeWatchedFilesParams{
+            .changes = {{lsp::FileEvent{.uri = URI::fromFile(path),
+                                        .type = lsp::FileChangeType::Changed}}}});
+        CHECK(indexer.getUpdateStats().unchangedContent == 1);
+        indexer.saveCache();
+    }
+
+    // The size and mtime are the file's, so the next startup trusts the cached entry
+    auto time = std::filesystem::last_write_time(path);
+    std::ofstream(path) << "module saved_x; endmodule\n";
+    std::filesystem::last_write_time(path, time);
+
+    Indexer indexer;
+    indexer.setCacheFile(cacheFile);
+    indexer.startIndexing(std::vector<std::string>{path.string()}, {});
+    CHECK(indexer.getFilesForSymbol("saved_a").size() == 1);
+    CHECK(indexer.getFilesForSymbol("saved_x").empty());
+
+    std::filesystem::remove_all(tempDir);
+}
+
+// Run with: server_unittests "[benchmark]"
+TEST_CASE("Updating one file takes the same time in a larger index", "[.][benchmark]") {
+    for (size_t fileCount : {1000, 16000}) {
+        slang::SourceManager sm;
+        Indexer indexer;
+        auto update = [&](size_t i, std::string_view suffix) {
+            auto name = fmt::format("bench_{}", i);
+            auto text = fmt::format("module {}{}; bench_{} u(); endmodule\n", name, suffix,
+                                    (i + 1) % fileCount);
+            auto tree = slang::syntax::SyntaxTree::fromText(text, sm, name, "", {});
+            indexer.updateDocument(name + ".sv", *tree);
+        };
+        for (size_t i = 0; i < fileCount; i++)
+            update(i, "");
+
+        // Renaming the module each time, so the update edits postings rather than only the entry
+        constexpr size_t Rounds = 500;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < Rounds; round++)
+            update(fileCount / 2, round % 2 ? "_renamed" : "");
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() -
+                                                            start;
+        fmt::print("{:>6} files {:>10.1f} us/update\n", fileCount, elapsed.count() / Rounds);
+
+        CHECK(indexer.getSymbolCount() == fileCount);
+    }
+}
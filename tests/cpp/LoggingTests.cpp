@@ -0,0 +1,109 @@
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+
+#include "catch2/catch_test_macros.hpp"
+#include "util/Logging.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+using namespace server;
+
+// Catch2 has its own INFO and WARN, so these tests use SLANG_LOG directly
+
+namespace {
+/// Counts how often it's formatted
+struct Counted {
+    int* count;
+};
+
+/// Restores the logging defaults after a test that writes to a temporary file
+struct CapturedLog {
+    FILE* file = std::tmpfile();
+    logging::Level level = logging::getLevel();
+
+    ~CapturedLog() {
+        logging::setOutput(stderr);
+        logging::setRateLimit(1000);
+        logging::setClock({});
+        logging::setLevel(level);
+        std::fclose(file);
+    }
+
+    std::string read() {
+        logging::flush();
+        return written();
+    }
+
+    /// What's in the file, without waiting for anything still queued
+    std::string written() {
+        std::string text;
+        std::rewind(file);
+        for (int c; (c = std::fgetc(file)) != EOF;)
+            text += char(c);
+        return text;
+    }
+};
+} // namespace
+
+template<>
+struct fmt::formatter<Counted> : fmt::formatter<std::string_view> {
+    auto format(const Counted& counted, format_context& ctx) const {
+        ++*counted.count;
+        return fmt::formatter<std::string_view>::format("counted", ctx);
+    }
+};
+
+TEST_CASE("Log levels parse from their names") {
+    CHECK(logging::parseLevel("debug") == logging::Level::Debug);
+    CHECK(logging::parseLevel("warn") == logging::Level::Warn);
+    CHECK(logging::parseLevel("off") == logging::Level::Off);
+    CHECK(!logging::parseLevel("verbose"));
+}
+
+TEST_CASE("Disabled log messages aren't formatted") {
+    CapturedLog log;
+    logging::setOutput(log.file);
+    logging::setLevel(logging::Level::Info);
+
+    int formatted = 0;
+    LOG_DEBUG("value: {}", Counted{&formatted});
+    CHECK(formatted == 0);
+
+    SLANG_LOG(logging::Level::Info, "value: {}", Counted{&formatted});
+    CHECK(formatted == 1);
+    SLANG_LOG(logging::Level::Warn, "last");
+
+    CHECK(log.read() == "INFO: value: counted\nWARN: last\n");
+}
+
+TEST_CASE("Log messages past the rate limit are dropped") {
+    CapturedLog log;
+    logging::setOutput(log.file);
+    logging::setLevel(logging::Level::Info);
+    logging::setRateLimit(3);
+    auto now = std::chrono::steady_clock::time_point() + std::chrono::hours(1);
+    logging::setClock([&] { return now; });
+
+    for (int i = 0; i < 100; i++)
+        SLANG_LOG(logging::Level::Info, "message {}", i);
+
+    // Errors aren't dropped, and are written before the call returns
+    SLANG_LOG(logging::Level::Error, "errors are never dropped");
+    auto text = log.written();
+    CHECK(text.find("ERROR: errors are never dropped\n") != std::string::npos);
+    CHECK(text.find("INFO: message 2\n") != std::string::npos);
+    CHECK(text.find("INFO: message 99\n") == std::string::npos);
+    CHECK(text.find(" log messages dropped\n") == std::string::npos);
+
+    // The drops are reported once the second is over, without waiting for another message
+    now += std::chrono::seconds(1);
+    text = log.read();
+    CHECK(text.find("WARN: 97 log messages dropped\n") != std::string::npos);
+
+    SLANG_LOG(logging::Level::Info, "next window");
+    SLANG_LOG(logging::Level::Info, "still writing");
+    text = log.read();
+    CHECK(text.find("INFO: next window\n") != std::string::npos);
+    CHECK(text.find("INFO: still writing\n") != std::string::npos);
+}
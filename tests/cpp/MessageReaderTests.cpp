@@ -0,0 +1,367 @@
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+
+#include "catch2/catch_test_macros.hpp"
+#include "lsp/JsonRpc.h"
+#include "lsp/MessageReader.h"
+#include "lsp/MessageWriter.h"
+#include "lsp/SessionRecorder.h"
+#include "utils/Utils.h"
+#include <chrono>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#    include <io.h>
+#else
+#    include <unistd.h>
+#endif
+
+using namespace lsp;
+
+namespace {
+// Writes input to a file and opens it for a reader
+struct InputFile {
+    fs::path path;
+    int fd;
+
+    InputFile(std::string_view name, std::string_view contents) :
+        path(fs::temp_directory_path() / name) {
+        std::ofstream(path, std::ios::binary) << contents;
+#ifdef _WIN32
+        fd = ::_open(path.string().c_str(), _O_RDONLY | _O_BINARY);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+#endif
+        REQUIRE(fd >= 0);
+    }
+
+    ~InputFile() {
+#ifdef _WIN32
+        ::_close(fd);
+#else
+        ::close(fd);
+#endif
+        fs::remove(path);
+    }
+};
+
+std::string frame(std::string_view body) {
+    return fmt::format("Content-Length: {}\r\n\r\n{}", body.size(), body);
+}
+} // namespace
+
+TEST_CASE("MessageReader splits framed messages") {
+    std::string large(5000, 'x');
+    std::string input = frame("{}") +
+                        // Optional header, and bare newlines
+                        "Content-Length: 3\nContent-Type: application/vscode-jsonrpc\n\nabc" +
+                        // Bigger than the buffer
+                        frame(large) +
+                        // Garbage before a message is skipped
+                        "junk\r\n" + frame("last") +
+                        // Truncated
+                        "Content-Length: 10\r\n\r\nshort";
+    InputFile file("slang_test_message_reader", input);
+
+    // A tiny buffer exercises refills and growth on every message
+    MessageReader reader(file.fd, 8);
+    CHECK(reader.next() == "{}");
+    CHECK(reader.next() == "abc");
+    CHECK(reader.next() == large);
+    CHECK(reader.next() == "last");
+    CHECK(!reader.next());
+    CHECK(!reader.next());
+}
+
+TEST_CASE("Incoming messages are classified after parsing") {
+    auto idOf = [](const ID_t& id) { return id ? rfl::json::write(*id) : "null"; };
+
+    // A response whose result mentions a method is still a response
+    CHECK(std::holds_alternative<IncomingResponse>(
+        parseMessage(R"({"jsonrpc":"2.0","id":0,"result":{"method":"textDocument/hover"}})")));
+    CHECK(std::holds_alternative<IncomingResponse>(
+        parseMessage(R"({"jsonrpc":"2.0","id":1,"error":{"code":1,"message":"\"method\""}})")));
+
+    auto request = parseMessage(R"({"jsonrpc":"2.0","id":2,"method":"shutdown"})");
+    REQUIRE(std::holds_alternative<IncomingMessage>(request));
+    CHECK(std::get<IncomingMessage>(request).method == "shutdown");
+    CHECK(idOf(std::get<IncomingMessage>(request).id) == "2");
+
+    auto notification = parseMessage(R"({"jsonrpc":"2.0","method":"initialized","params":{}})");
+    REQUIRE(std::holds_alternative<IncomingMessage>(notification));
+    CHECK(!std::get<IncomingMessage>(notification).id);
+    CHECK(std::get<IncomingMessage>(notification).params != nullptr);
+
+    // Errors answer with the message's own id, or null if it can't be read
+    auto invalid = parseMessage(R"({"jsonrpc":"2.0","id":"a","params":{}})");
+    REQUIRE(std::holds_alternative<InvalidMessage>(invalid));
+    CHECK(idOf(std::get<InvalidMessage>(invalid).id) == R"("a")");
+    CHECK(std::get<InvalidMessage>(invalid).error.code == -32600);
+
+    auto unparsed = parseMessage(R"({"jsonrpc":"2.0","id":3,"method")");
+    REQUIRE(std::holds_alternative<InvalidMessage>(unparsed));
+    CHECK(idOf(std::get<InvalidMessage>(unparsed).id) == "null");
+    CHECK(std::get<InvalidMessage>(unparsed).error.code == -32700);
+
+    // readMessage skips the response and returns the notification after it
+    InputFile file(
+        "slang_test_read_message",
+        frame(R"({"jsonrpc":"2.0","id":0,"result":{"method":"window/showMessage"}})") +
+            frame(R"({"jsonrpc":"2.0","method":"exit"})"));
+    MessageReader reader(file.fd);
+    auto message = readMessage(reader);
+    REQUIRE(message);
+    CHECK(message->method == "exit");
+    CHECK(!readMessage(reader));
+}
+
+TEST_CASE("Responses to our requests run their callbacks") {
+    int created = 0;
+    int first = pendingRequests().add([&] { created++; });
+    int second = pendingRequests().add([&] { created += 10; });
+    CHECK(first != second);
+
+    // The failed request's callback is dropped, and an unknown id is ignored
+    InputFile file("slang_test_read_response",
+                   frame(fmt::format(R"({{"jsonrpc":"2.0","id":{},"result":null}})", first)) +
+                       frame(fmt::format(R"({{"jsonrpc":"2.0","id":{},"error":{{"code":1}}}})",
+                                         second)) +
+                       frame(fmt::format(R"({{"jsonrpc":"2.0","id":{},"result":null}})", first)) +
+                       frame(R"({"jsonrpc":"2.0","id":"other","result":null})"));
+    MessageReader reader(file.fd);
+    CHECK(!readMessage(reader));
+    CHECK(created == 1);
+}
+
+TEST_CASE("MessageWriter output reads back without superseded messages") {
+    auto path = fs::temp_directory_path() / "slang_test_message_writer";
+#ifdef _WIN32
+    int fd = ::_open(path.string().c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                     _S_IREAD | _S_IWRITE);
+#else
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    REQUIRE(fd >= 0);
+    {
+        MessageWriter writer(fd);
+        writer.push("first");
+        writer.flush();
+
+        std::vector<std::thread> senders;
+        for (int i = 0; i < 4; i++) {
+            senders.emplace_back([&writer, i] {
+                for (int j = 0; j < 100; j++)
+                    writer.push(fmt::format("{}:{}", i, j));
+            });
+        }
+        for (auto& sender : senders)
+            sender.join();
+        // The older diagnostics for a.sv are dropped if they're still queued when the newer
+        // ones arrive
+        writer.push("a.sv old", "a.sv");
+        writer.push("b.sv", "b.sv");
+        writer.push("a.sv new", "a.sv");
+    }
+#ifdef _WIN32
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+
+    std::ifstream in(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    InputFile file("slang_test_message_writer_read", contents);
+    fs::remove(path);
+
+    MessageReader reader(file.fd);
+    CHECK(reader.next() == "first");
+
+    // Each sender's messages stay in order
+    std::vector<int> nextFromSender(4, 0);
+    for (int i = 0; i < 400; i++) {
+        auto body = reader.next();
+        REQUIRE(body);
+        int sender = (*body)[0] - '0';
+        CHECK(*body == fmt::format("{}:{}", sender, nextFromSender[sender]++));
+    }
+
+    auto rest = std::vector<std::string>();
+    while (auto body = reader.next())
+        rest.emplace_back(*body);
+    std::erase(rest, "a.sv old");
+    CHECK(rest == std::vector<std::string>{"b.sv", "a.sv new"});
+}
+
+namespace {
+// The reader this replaced, for comparison
+std::optional<std::string_view> readWithGetline(std::istream& in, std::string& line,
+                                                std::string& content) {
+    while (std::getline(in, line)) {
+        if (line.find("Content-Length: ") != 0)
+            continue;
+
+        int contentLength = std::stoi(line.substr(16));
+        content.resize(contentLength);
+        do {
+            std::getline(in, line);
+        } while (line.size() > 1);
+
+        in.read(&content[0], contentLength);
+        return content;
+    }
+    return std::nullopt;
+}
+} // namespace
+
+// Run with: server_unittests "[benchmark]"
+TEST_CASE("MessageReader throughput", "[.][benchmark]") {
+    // Traffic shaped like an editing session: a few large didOpen/didChange bodies carrying
+    // whole files, between many small position requests
+    std::stringstream source;
+    source << std::ifstream(findSlangRoot() / "tests" / "data" / "all.sv").rdbuf();
+    std::string text = source.str();
+    std::string escaped;
+    for (char c : text) {
+        if (c == '\n')
+            escaped += "\\n";
+        else if (c == '"' || c == '\\')
+            escaped += {'\\', c};
+        else
+            escaped += c;
+    }
+
+    std::string traffic;
+    size_t messages = 0;
+    for (int i = 0; i < 2000; i++) {
+        auto uri = fmt::format("file:///workspace/rtl/file_{}.sv", i % 50);
+        if (i % 20 == 0) {
+            traffic += frame(fmt::format(
+                R"({{"jsonrpc":"2.0","method":"textDocument/didChange","params":{{)"
+                R"("textDocument":{{"uri":"{}","version":{}}},)"
+                R"("contentChanges":[{{"text":"{}"}}]}}}})",
+                uri, i, escaped));
+            messages++;
+        }
+        for (std::string_view method : {"textDocument/hover", "textDocument/completion",
+                                        "textDocument/documentHighlight"}) {
+            traffic += frame(fmt::format(
+                R"({{"jsonrpc":"2.0","id":{},"method":"{}",)"
+                R"("params":{{"textDocument":{{"uri":"{}"}},)"
+                R"("position":{{"line":{},"character":{}}}}}}})",
+                messages, method, uri, i % 300, i % 40));
+            messages++;
+        }
+    }
+    InputFile file("slang_bench_message_reader", traffic);
+
+    auto report = [&](std::string_view name, auto&& run) {
+        auto start = std::chrono::steady_clock::now();
+        size_t count = 0;
+        size_t bytes = 0;
+        run([&](std::string_view body) {
+            count++;
+            bytes += body.size();
+        });
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        fmt::print("{:<16} {:>10.1f} MB/s {:>12.0f} msgs/s\n", name,
+                   double(bytes) / (1024 * 1024) / elapsed.count(),
+                   double(count) / elapsed.count());
+        CHECK(count == messages);
+    };
+
+    fmt::print("{} messages, {:.1f} MB\n", messages, double(traffic.size()) / (1024 * 1024));
+    report("std::getline", [&](auto&& onMessage) {
+        std::ifstream in(file.path, std::ios::binary);
+        std::string line;
+        std::string content;
+        while (auto body = readWithGetline(in, line, content))
+            onMessage(*body);
+    });
+    report("MessageReader", [&](auto&& onMessage) {
+        MessageReader reader(file.fd);
+        while (auto body = reader.next())
+            onMessage(*body);
+    });
+}
+
+TEST_CASE("SessionRecorder writes one line per message") {
+    auto path = fs::temp_directory_path() / "slang_test_session.jsonl";
+    {
+        SessionRecorder recorder;
+        recorder.record(SessionRecorder::Direction::In, R"({"ignored":true})");
+        REQUIRE(recorder.open(path.string()));
+        recorder.record(SessionRecorder::Direction::In,
+                        "{\"jsonrpc\":\"2.0\",\r\n\"method\":\"initialized\"}");
+        recorder.record(SessionRecorder::Direction::Out, R"({"jsonrpc":"2.0","id":1})");
+    }
+
+    std::ifstream in(path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line);)
+        lines.push_back(line);
+    REQUIRE(lines.size() == 2);
+
+    CHECK(lines[0].starts_with(R"({"t":)"));
+    CHECK(lines[0].ends_with(
+        R"(,"dir":"in","msg":{"jsonrpc":"2.0",  "method":"initialized"}})"));
+    CHECK(lines[1].ends_with(R"(,"dir":"out","msg":{"jsonrpc":"2.0","id":1}})"));
+    fs::remove(path);
+}
+
+TEST_CASE("Session recordings keep only the messages the writer wrote") {
+    auto outPath = fs::temp_directory_path() / "slang_test_recorded_writer";
+    auto recordPath = fs::temp_directory_path() / "slang_test_recorded_writer.jsonl";
+#ifdef _WIN32
+    int fd = ::_open(outPath.string().c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                     _S_IREAD | _S_IWRITE);
+#else
+    int fd = ::open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    REQUIRE(fd >= 0);
+    {
+        SessionRecorder recorder;
+        REQUIRE(recorder.open(recordPath.string()));
+        MessageWriter writer(fd, &recorder);
+        for (int i = 0; i < 50; i++)
+            writer.push(fmt::format("a.sv {}", i), "a.sv");
+        writer.push("done");
+    }
+#ifdef _WIN32
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+
+    std::ifstream out(outPath, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(out)), std::istreambuf_iterator<char>());
+    out.close();
+    InputFile file("slang_test_recorded_writer_read", contents);
+    fs::remove(outPath);
+
+    std::vector<std::string> written;
+    MessageReader reader(file.fd);
+    while (auto body = reader.next())
+        written.emplace_back(*body);
+
+    // Superseded diagnostics that were never written aren't in the recording either
+    std::vector<std::string> recorded;
+    std::ifstream recording(recordPath);
+    for (std::string line; std::getline(recording, line);) {
+        auto start = line.find(R"("dir":"out","msg":)");
+        REQUIRE(start != std::string::npos);
+        start += std::string_view(R"("dir":"out","msg":)").size();
+        recorded.push_back(line.substr(start, line.size() - start - 1));
+    }
+    recording.close();
+    fs::remove(recordPath);
+
+    CHECK(written.back() == "done");
+    CHECK(recorded == written);
+}
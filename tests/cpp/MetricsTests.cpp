@@ -0,0 +1,75 @@
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+
+#include "catch2/catch_test_macros.hpp"
+#include "lsp/ServerMetrics.h"
+#include <chrono>
+#include <memory>
+
+using namespace lsp;
+using std::chrono::microseconds;
+
+TEST_CASE("Latency histogram buckets cover every value") {
+    for (uint64_t value : {0ull, 7ull, 8ull, 15ull, 16ull, 17ull, 1000ull, 123456789ull, ~0ull}) {
+        auto bucket = LatencyHistogram::bucketFor(value);
+        REQUIRE(bucket < LatencyHistogram::NumBuckets);
+        CHECK(LatencyHistogram::bucketUpperBound(bucket) >= value);
+        if (bucket > 0)
+            CHECK(LatencyHistogram::bucketUpperBound(bucket - 1) < value);
+    }
+}
+
+TEST_CASE("Latency histogram percentiles") {
+    LatencyHistogram histogram;
+    CHECK(histogram.percentile(0.5) == microseconds(0));
+
+    for (int i = 1; i <= 100; i++)
+        histogram.record(microseconds(i * 1000));
+
+    CHECK(histogram.count() == 100);
+    CHECK(histogram.max() == microseconds(100000));
+
+    // Within a bucket's width (1/8 of its power of two) above the exact value
+    auto p50 = histogram.percentile(0.5).count();
+    CHECK(p50 >= 50000);
+    CHECK(p50 <= 50000 * 9 / 8);
+    auto p95 = histogram.percentile(0.95).count();
+    CHECK(p95 >= 95000);
+    CHECK(p95 <= 100000);
+    CHECK(histogram.percentile(0.99) <= histogram.max());
+    CHECK(histogram.percentile(1.0) == histogram.max());
+}
+
+TEST_CASE("Server metrics are recorded per method") {
+    ServerMetrics metrics;
+    metrics.record("textDocument/hover", microseconds(10), microseconds(2000), 5, false);
+    metrics.record("textDocument/hover", microseconds(30), microseconds(4000), 7, true);
+    {
+        auto measured = metrics.measure("textDocument/definition", ServerMetrics::Clock::now());
+        auto allocated = std::make_unique<int>(1);
+    }
+
+    auto report = metrics.report();
+    REQUIRE(report.methods.size() == 2);
+
+    // Sorted by method
+    const auto& definition = report.methods[0];
+    CHECK(definition.method == "textDocument/definition");
+    CHECK(definition.count == 1);
+    CHECK(definition.errors == 0);
+    if (allocationsCounted()) {
+        REQUIRE(definition.allocations);
+        CHECK(*definition.allocations >= 1);
+    }
+
+    const auto& hover = report.methods[1];
+    CHECK(hover.method == "textDocument/hover");
+    CHECK(hover.count == 2);
+    CHECK(hover.errors == 1);
+    CHECK(hover.max == 4.0);
+    CHECK(hover.p50 >= 2.0);
+    CHECK(hover.p50 < 4.0);
+    CHECK(hover.queueP99 == 0.03);
+    if (allocationsCounted())
+        CHECK(hover.allocations == 12u);
+}
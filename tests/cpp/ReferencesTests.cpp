@@ -2,6 +2,10 @@
 // SPDX-License-Identifier: MIT
 
 #include "utils/ServerHarness.h"
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <sstream>
 
 using namespace slang;
 
@@ -232,6 +236,43 @@ TEST_CASE("FindReferences - Cross-File Package Type") {
     CHECK(filesWithRefs.size() >= 2); // At least pkg and module files
 }
 
+TEST_CASE("FindReferences - Partial Results") {
+    ServerHarness server("indexer_test");
+    auto pkgHdl = server.openFile("crossfile_pkg.sv");
+    auto modHdl = server.openFile("crossfile_module.sv");
+    pkgHdl.ensureSynced();
+    modHdl.ensureSynced();
+
+    auto params = lsp::ReferenceParams{
+        .context = {.includeDeclaration = true},
+        .textDocument = {.uri = pkgHdl.m_uri},
+        .position = pkgHdl.after("typedef struct packed {").after("} ").getPosition(),
+    };
+    auto refs = server.getDocReferences(params);
+    REQUIRE(refs.has_value());
+
+    // With a token, each file's references are reported on their own and the response is empty
+    params.partialResultToken = lsp::ProgressToken(std::string("refs"));
+    auto streamed = server.getDocReferences(params);
+    REQUIRE(streamed.has_value());
+    CHECK(streamed->empty());
+
+    auto batches = server.client.getPartialResults<lsp::Location>("refs");
+    REQUIRE(batches.size() >= 2);
+    CHECK(batches[0][0].uri == pkgHdl.m_uri);
+
+    size_t total = 0;
+    for (const auto& batch : batches) {
+        REQUIRE(!batch.empty());
+        std::set<std::string> files;
+        for (const auto& ref : batch)
+            files.insert(ref.uri.str());
+        CHECK(files.size() == 1);
+        total += batch.size();
+    }
+    CHECK(total == refs->size());
+}
+
 TEST_CASE("FindReferences - Cross-File Parameter") {
     ServerHarness server("indexer_test");
     auto pkgHdl = server.openFile("crossfile_pkg.sv");
@@ -1084,3 +1125,57 @@ TEST_CASE("FindReferences - Port Across Instance Boundary") {
     CHECK(refs->size() == 5);
     verifyReferenceTokens(server, *refs, "data_out");
 }
+
+TEST_CASE("FindReferences - Concurrent With Other Queries") {
+    ServerHarness server("indexer_test");
+
+    // Read-only requests run on the worker pool together. Nothing is open yet, so the threads
+    // race to load, parse and analyze the same documents.
+    auto find = [](const std::string& file, std::string_view text) {
+        std::ifstream in(file);
+        std::stringstream contents;
+        contents << in.rdbuf();
+        auto str = contents.str();
+        auto offset = str.find(text);
+        REQUIRE(offset != std::string::npos);
+        auto lineStart = str.rfind('\n', offset);
+        lineStart = lineStart == std::string::npos ? 0 : lineStart + 1;
+        return std::pair{URI::fromFile(fs::absolute(file)),
+                         lsp::Position{.line = lsp::uint(std::count(str.begin(),
+                                                                    str.begin() + offset, '\n')),
+                                       .character = lsp::uint(offset - lineStart)}};
+    };
+    auto typeDecl = find("crossfile_pkg.sv", "transaction_t;");
+    auto paramDecl = find("crossfile_pkg.sv", "FIFO_DEPTH");
+    auto typeUse = find("crossfile_module.sv", "transaction_t buffer");
+
+    auto& driver = *server.m_driver;
+    auto summarize = [](const std::optional<std::vector<lsp::Location>>& refs) {
+        std::set<std::tuple<std::string, lsp::uint, lsp::uint>> result;
+        for (auto& ref : refs.value_or(std::vector<lsp::Location>{}))
+            result.emplace(ref.uri.str(), ref.range.start.line, ref.range.start.character);
+        return result;
+    };
+    auto query = [&] {
+        return std::tuple{
+            summarize(driver.getDocReferences(typeDecl.first, typeDecl.second, true)),
+            summarize(driver.getDocReferences(paramDecl.first, paramDecl.second, true)),
+            driver.getDocHover(typeUse.first, typeUse.second).has_value(),
+            driver.getDocDefinition(typeUse.first, typeUse.second).size()};
+    };
+
+    std::vector<std::future<decltype(query())>> concurrent;
+    for (int i = 0; i < 4; i++)
+        concurrent.push_back(std::async(std::launch::async, query));
+
+    // Each thread gets the answers a request would get on its own
+    for (auto& result : concurrent)
+        result.wait();
+    auto expected = query();
+    CHECK(std::get<0>(expected).size() >= 5);
+    CHECK(std::get<1>(expected).size() >= 2);
+    CHECK(std::get<2>(expected));
+    CHECK(std::get<3>(expected) == 1);
+    for (auto& result : concurrent)
+        CHECK(result.get() == expected);
+}
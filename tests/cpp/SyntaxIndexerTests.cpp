@@ -0,0 +1,105 @@
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+
+#include "document/SyntaxIndexer.h"
+#include "utils/Utils.h"
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <fmt/format.h>
+#include <fstream>
+#include <sstream>
+
+#include "slang/syntax/SyntaxTree.h"
+#include "slang/text/SourceManager.h"
+
+using namespace server;
+
+namespace {
+std::shared_ptr<slang::syntax::SyntaxTree> parseAllSv(slang::SourceManager& sm) {
+    std::stringstream text;
+    text << std::ifstream(findSlangRoot() / "tests" / "data" / "all.sv").rdbuf();
+    REQUIRE(!text.str().empty());
+    return slang::syntax::SyntaxTree::fromText(text.str(), sm, "all.sv", "", {});
+}
+} // namespace
+
+TEST_CASE("SyntaxIndexer lookups match the collected tokens") {
+    slang::SourceManager sm;
+    auto tree = parseAllSv(sm);
+    SyntaxIndexer indexer(*tree);
+    REQUIRE(!indexer.collected.empty());
+
+    auto buffer = tree->getSourceBufferIds()[0];
+    auto size = sm.getSourceText(buffer).size();
+
+    // Every offset maps to the last token starting at or before it, if it's inside that token
+    size_t next = 0;
+    const slang::parsing::Token* before = nullptr;
+    for (size_t offset = 0; offset < size; offset++) {
+        while (next < indexer.collected.size() &&
+               indexer.collected[next]->location().offset() <= offset) {
+            before = indexer.collected[next++];
+        }
+
+        slang::SourceLocation loc(buffer, offset);
+        auto expected = before && before->range().contains(loc) ? before : nullptr;
+        REQUIRE(indexer.getTokenAt(loc) == expected);
+        if (expected) {
+            REQUIRE(indexer.getSyntaxAt(loc) == indexer.getTokenParent(expected));
+        }
+    }
+
+    for (auto* token : indexer.collected) {
+        CHECK(indexer.getTokenParent(token) != nullptr);
+    }
+    CHECK(!indexer.getTokenAt(slang::SourceLocation(slang::BufferID(), 0)));
+
+    // Hints are sorted with one per offset
+    for (size_t i = 1; i < indexer.collectedHints.size(); i++) {
+        CHECK(indexer.collectedHints[i - 1].offset < indexer.collectedHints[i].offset);
+    }
+}
+
+// Run with: server_unittests "[benchmark]"
+TEST_CASE("SyntaxIndexer lookup throughput", "[.][benchmark]") {
+    slang::SourceManager sm;
+    auto tree = parseAllSv(sm);
+    auto buffer = tree->getSourceBufferIds()[0];
+    auto size = sm.getSourceText(buffer).size();
+
+    auto measure = [&](std::string_view name, size_t count, auto&& run) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() -
+                                                           start;
+        fmt::print("{:<20} {:>10.1f} ns/op\n", name, elapsed.count() / double(count));
+    };
+
+    constexpr size_t Rounds = 200;
+    measure("index", Rounds, [&] {
+        for (size_t i = 0; i < Rounds; i++)
+            SyntaxIndexer indexer(*tree);
+    });
+
+    SyntaxIndexer indexer(*tree);
+    size_t found = 0;
+    auto everyOffset = [&](auto&& lookup) {
+        for (size_t round = 0; round < Rounds; round++) {
+            for (size_t offset = 0; offset < size; offset++)
+                found += lookup(slang::SourceLocation(buffer, offset)) != nullptr;
+        }
+    };
+    measure("getTokenAt", Rounds * size,
+            [&] { everyOffset([&](auto loc) { return indexer.getTokenAt(loc); }); });
+    measure("getWordTokenAt", Rounds * size,
+            [&] { everyOffset([&](auto loc) { return indexer.getWordTokenAt(loc); }); });
+    measure("getSyntaxAt", Rounds * size,
+            [&] { everyOffset([&](auto loc) { return indexer.getSyntaxAt(loc); }); });
+    measure("getTokenParent", Rounds * indexer.collected.size(), [&] {
+        for (size_t round = 0; round < Rounds; round++) {
+            for (auto* token : indexer.collected)
+                found += indexer.getTokenParent(token) != nullptr;
+        }
+    });
+    CHECK(found > 0);
+}
@@ -0,0 +1,39 @@
+// SPDX-FileCopyrightText: Hudson River Trading
+// SPDX-License-Identifier: MIT
+
+#include "catch2/catch_test_macros.hpp"
+#include "lsp/JsonRpcServer.h"
+#include <atomic>
+#include <chrono>
+#include <future>
+
+using namespace lsp;
+using namespace std::chrono_literals;
+
+TEST_CASE("DelayQueue runs tasks after their delay") {
+    WorkQueue target(1);
+    DelayQueue delayed(target);
+
+    std::promise<std::chrono::steady_clock::time_point> ran;
+    auto pushed = std::chrono::steady_clock::now();
+    CHECK(delayed.push(20ms, [&] { ran.set_value(std::chrono::steady_clock::now()); }));
+
+    auto done = ran.get_future();
+    REQUIRE(done.wait_for(10s) == std::future_status::ready);
+    CHECK(done.get() - pushed >= 20ms);
+}
+
+TEST_CASE("DelayQueue refuses tasks once it's closed") {
+    WorkQueue target(1);
+    DelayQueue delayed(target);
+    std::atomic<int> ran = 0;
+
+    // A task still waiting is dropped by close
+    CHECK(delayed.push(1h, [&] { ran++; }));
+    delayed.close();
+
+    // The caller is told when a task won't run, so it can do the work itself
+    CHECK(!delayed.push(0ms, [&] { ran++; }));
+    target.close();
+    CHECK(ran == 0);
+}
@@ -134,3 +134,85 @@ endmodule
 
     doc.close();
 }
+
+static std::vector<std::string> getRankedNames(ServerHarness& server, const std::string& query) {
+    auto result = server.getWorkspaceSymbol(lsp::WorkspaceSymbolParams{.query = query});
+    std::vector<std::string> names;
+    for (const auto& sym : rfl::get<std::vector<lsp::WorkspaceSymbol>>(result))
+        names.push_back(sym.name);
+    return names;
+}
+
+TEST_CASE("Workspace symbol - ranked best first") {
+    ServerHarness server;
+
+    auto doc = server.openFile("test.sv", R"(
+module ArbLongPathHandlerA; endmodule
+module BigAlpha; endmodule
+module AlphaBeta; endmodule
+module Alpha; endmodule
+module Gamma; endmodule
+)");
+    doc.save();
+
+    // Exact, prefix, substring, then subsequence
+    auto names = getRankedNames(server, "alpha");
+    CHECK(names ==
+          std::vector<std::string>{"Alpha", "AlphaBeta", "BigAlpha", "ArbLongPathHandlerA"});
+
+    // Short queries rank the same way
+    names = getRankedNames(server, "al");
+    REQUIRE(names.size() == 4);
+    CHECK(names[0] == "Alpha");
+    CHECK(names[1] == "AlphaBeta");
+
+    doc.close();
+}
+
+TEST_CASE("Workspace symbol - partial results") {
+    ServerHarness server;
+
+    auto doc = server.openFile("test.sv", R"(
+module ArbLongPathHandlerA; endmodule
+module BigAlpha; endmodule
+module AlphaBeta; endmodule
+module Alpha; endmodule
+)");
+    doc.save();
+
+    // Names containing the query are reported before the scan for the rest
+    auto result = server.getWorkspaceSymbol(lsp::WorkspaceSymbolParams{
+        .query = "alpha", .partialResultToken = lsp::ProgressToken(std::string("symbols"))});
+    CHECK(rfl::get<std::vector<lsp::WorkspaceSymbol>>(result).empty());
+
+    std::vector<std::vector<std::string>> batches;
+    for (const auto& batch : server.client.getPartialResults<lsp::WorkspaceSymbol>("symbols")) {
+        auto& names = batches.emplace_back();
+        for (const auto& sym : batch)
+            names.push_back(sym.name);
+    }
+    CHECK(batches == std::vector<std::vector<std::string>>{{"Alpha", "AlphaBeta", "BigAlpha"},
+                                                           {"ArbLongPathHandlerA"}});
+
+    doc.close();
+}
+
+TEST_CASE("Workspace symbol - results are capped") {
+    ServerHarness server;
+
+    Config config;
+    config.workspaceSymbolLimit.value() = 2;
+    server.loadConfig(config);
+
+    auto doc = server.openFile("test.sv", R"(
+module Counter; endmodule
+module CounterWide; endmodule
+module UpCounter; endmodule
+)");
+    doc.save();
+
+    auto names = getRankedNames(server, "counter");
+    CHECK(names == std::vector<std::string>{"Counter", "CounterWide"});
+
+    doc.close();
+}
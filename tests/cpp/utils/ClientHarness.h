@@ -10,6 +10,7 @@
 #include "catch2/catch_test_macros.hpp"
 #include "lsp/LspTypeExtensions.h"
 #include <algorithm>
+#include <functional>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
@@ -41,6 +42,14 @@ public:
         return std::monostate{};
     }
 
+    /// Callbacks for progress tokens the server asked to create, which the test may accept
+    std::vector<std::function<void()>> m_progressCreated;
+
+    void createWorkDoneProgress(const lsp::ProgressToken&,
+                                std::function<void()> onCreated) override {
+        m_progressCreated.push_back(std::move(onCreated));
+    }
+
     void onDocPublishDiagnostics(const lsp::PublishDiagnosticsParams& params) override {
         m_diagnostics.insert_or_assign(params.uri, params.diagnostics);
     }
@@ -71,6 +80,23 @@ public:
         return {};
     }
 
+    std::vector<lsp::ProgressParams> m_progress;
+
+    void onProgress(const lsp::ProgressParams& params) override { m_progress.push_back(params); }
+
+    /// The batches of results reported for a request with the given `partialResultToken`
+    template<typename T>
+    std::vector<std::vector<T>> getPartialResults(const std::string& token) {
+        std::vector<std::vector<T>> batches;
+        for (const auto& params : m_progress) {
+            if (rfl::json::write(params.token) != rfl::json::write(lsp::ProgressToken(token)))
+                continue;
+            batches.push_back(
+                rfl::from_generic<std::vector<T>, rfl::UnderlyingEnums>(params.value).value());
+        }
+        return batches;
+    }
+
     std::deque<lsp::ShowDocumentParams> m_showDocuments;
 
     void onShowDocument(const lsp::ShowDocumentParams& params) final {
@@ -98,6 +98,9 @@ public:
 
     // For access to indexer in tests
     using SlangServer::m_indexer;
+
+    // For reporting indexing progress without a workspace to index
+    using SlangServer::onIndexingProgress;
 };
 
 enum DocState {